@@ -1,5 +1,7 @@
 #include <stdio.h>
+#include <getopt.h>
 #include <strings.h>
+#include <ctype.h>
 #include "gdal.h"
 #include "gdal_priv.h"
 #include "gdal_rat.h"
@@ -10,27 +12,215 @@
 #include "ogrsf_frmts.h"
 #include "ogr_api.h"
 //#include "commonutils.h"
-//#include <vector>
-//#include <map>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "ccap_queue.h"
+#include "ccap_kernels.h"
+#include "ccap_mem.h"
+#include "ccap_scheme.h"
+#include "ccap_lut.h"
 
-#define CCAP_CLASSES 25
+/* most memory the strips in flight through the pipeline may use, unless -m says less */
+#define CCAP_MAX_PIPELINE_BYTES (512*1024*1024)
+
+/* GeoTIFF output layout unless the options say otherwise */
+#define CCAP_DEFAULT_COMPRESS "DEFLATE"
+#define CCAP_DEFAULT_TILE 512
+
+/* width and height of the tile files of a .vrt output unless -split says */
+#define CCAP_DEFAULT_SPLIT 16384
+
+/* GeoTIFF outputs this big or bigger uncompressed are made BigTIFF */
+#define CCAP_BIGTIFF_BYTES ((double)4000 * 1000 * 1000)
+
+/*
+* Long options; -m is also --mem-limit. The output options are spelled
+* the way the GDAL utilities spell them, with one dash: -co, -cog ...
+*/
+enum { OPT_CO = 256, OPT_COMPRESS, OPT_LEVEL, OPT_PREDICTOR, OPT_TILE, OPT_OVERVIEWS, OPT_COG, OPT_SPLIT };
+static struct option aoLongOptions[] = {
+	{ "mem-limit", required_argument, NULL, 'm' },
+	{ "co", required_argument, NULL, OPT_CO },
+	{ "compress", required_argument, NULL, OPT_COMPRESS },
+	{ "level", required_argument, NULL, OPT_LEVEL },
+	{ "predictor", no_argument, NULL, OPT_PREDICTOR },
+	{ "tile", required_argument, NULL, OPT_TILE },
+	{ "overviews", required_argument, NULL, OPT_OVERVIEWS },
+	{ "cog", no_argument, NULL, OPT_COG },
+	{ "split", required_argument, NULL, OPT_SPLIT },
+	{ NULL, 0, NULL, 0 }
+};
+
+/*
+* How the GeoTIFF outputs are laid out and compressed. The pipeline
+* writes a strip of lines at a time, so tiles of up to a strip's height
+* cost nothing over strips to write, and make the windows ccap2tbl
+* reads for each feature much cheaper.
+*/
+typedef struct {
+	const char *pszCompress; // NONE, PACKBITS, LZW, DEFLATE, ZSTD ...
+	int nLevel;              // ZLEVEL or ZSTD_LEVEL, 0 for the codec's own default
+	int bPredictor;          // horizontal differencing, PREDICTOR=2
+	int nTileSize;           // 0 for strips
+	int nThreads;            // NUM_THREADS, compressing blocks in parallel
+	char **papszExtra;       // -co NAME=VALUE, over all of the above
+} TiffLayout;
+
+/*
+* A band of whole lines moving through the pipeline: read by a reader,
+* combined by a worker, then written by the writer in strip order.
+* pabyEpochs has the lines of every epoch one after the other, and
+* panOut those of every pair's bivariate, nStripPixels apart; panOut is
+* NULL when only the histograms are wanted.
+*/
+typedef struct {
+	int nStrip;
+	int nYOff;
+	int nLines;
+	unsigned char *pabyEpochs;
+	unsigned short *panOut;
+} BivarStrip;
+
+/*
+* Where the writer puts a pair's bivariate: the one output file, as a
+* single tile the size of the raster, or the tile files of a .vrt
+* output, row by row. Tiles are nTileXSize by nTileYSize but for those
+* in the last column and row.
+*/
+struct BivarOutput {
+	int nTileXSize, nTileYSize;
+	int nTileCols, nTileRows;
+	std::vector<GDALDataset *> apoTiles;
+	std::vector<std::string> aosTileNames;
+};
+
+/*
+* Every nColStep'th column of tiles from nFirstCol, of one output, for a
+* strip: what a writer thread is handed.
+*/
+typedef struct {
+	const BivarOutput *poOutput;
+	const unsigned short *panStrip;
+	int nYOff, nLines;
+	int nFirstCol, nColStep;
+} BivarColumns;
+
+/*
+* State shared by the pipeline threads. Strip buffers cycle from the
+* free queue to a reader, to the read queue, to a worker, to the done
+* map, and back to the free queue once the writer has written them.
+* Workers count the values they combine in their own histograms and add
+* them to panHistogram, nBuckets per pair, when they finish. With -L
+* each pair's bivariates are turned into its codes after being counted.
+* The writer passes all but the first columns of tiles of each strip to
+* the writer threads through the columns queue, and waits for
+* nColumnsLeft to come back to 0 before freeing the strip.
+*/
+struct BivarPipeline {
+	std::vector<const char *> apszEpochNames;
+	std::vector<std::pair<int, int> > aoPairs; // start and end epoch of each bivariate
+	bool bWrite;                               // bivariates go in panOut to be written
+	CCAPScheme sScheme;
+	unsigned char abyClasses[256];             // pixel value to class, for schemes with codes
+	int nBuckets;                              // histogram buckets, one per bivariate value and 0
+	std::vector<std::vector<unsigned char> > aabyCodes; // each pair's code for each value, empty without -L
+	int nXSize, nYSize;
+	int nStripLines, nStrips;
+	size_t nStripPixels;
+	CCAPQueue<BivarStrip *> *poFree;
+	CCAPQueue<BivarStrip *> *poRead;
+	CCAPQueue<BivarColumns> *poColumns;
+	std::mutex oMutex; // guards everything below
+	std::condition_variable oDoneCond;
+	std::condition_variable oColumnsCond;
+	int nNextStrip;
+	int nReadersLeft;
+	int nColumnsLeft;
+	std::map<int, BivarStrip *> oDone;
+	GUIntBig *panHistogram;
+};
 
 
 static int GDALExit( int nCode );
-GDALColorTable * makeColorTable(char *psFilename);
+GDALColorTable * makeColorTable(const char *psFilename);
 void printRGB(const GDALColorEntry *color);
 char **getHFAOptions();
-char **getTiffOptions();
+char **getTiffOptions(const TiffLayout *psLayout);
 void printColorTable(GDALColorTable *poColorTable);
+static int pipelineStripLines(GDALRasterBand **papoBands, int nBands, size_t nLineBytes, int nBuffers,
+                              size_t nExtraLineBytes, size_t nMaxBytes);
+static int parsePairs(const char *pszPairs, int nEpochs, std::vector<std::pair<int, int> > &aoPairs);
+static std::string pairFileName(const char *pszName, const std::pair<int, int> &oPair);
+static void loadColors(const char *psColorTable, const char *psRATBivarName, int nValues, int verbose,
+                       GDALColorTable **ppoColorTable, GDALRasterAttributeTable **ppoRAT);
+static void setColors(GDALRasterBand *poBandOut, GDALColorTable *poColorTable, GDALRasterAttributeTable *poRAT);
+static void readerThread(BivarPipeline *poPipe);
+static void combineThread(BivarPipeline *poPipe);
+static void writerThread(BivarPipeline *poPipe);
+static void combineStrip(const unsigned char *pabyStart, const unsigned char *pabyEnd,
+                         unsigned short *panOut, size_t nPixels, const CCAPScheme *psScheme);
+static void histogramStrip(const unsigned short *panOut, size_t nPixels, unsigned long long *panHistogram,
+                           int nBuckets);
+static void setRATHistogram(GDALRasterBand *poBand, const GUIntBig *panHistogram, int nBuckets);
+static void runPipeline(BivarPipeline *poPipe, const std::vector<GDALRasterBand *> &apoEpochBands,
+                        const std::vector<BivarOutput> &aoOutputs, int nThreads, GIntBig nMemLimit,
+                        int verbose);
+static int parseOverviews(const char *pszLevels, int nXSize, int nYSize, int nTileSize, std::vector<int> &anLevels);
+static void writeTiles(const BivarOutput *poOutput, const unsigned short *panStrip, int nXSize, int nYSize,
+                       int nYOff, int nLines, int nFirstCol, int nColStep, std::vector<unsigned short> *panOverview);
+static void writeOverviews(GDALRasterBand *poBand, const unsigned short *panStrip, int nLineSpace, int nXSize,
+                           int nYSize, int nYOff, int nLines, std::vector<unsigned short> &anOverview);
+static std::string tileFileName(const std::string &osName, int nRow, int nCol);
+static void setGeoreference(GDALDataset *poBivariate, GDALDataset *poEndCCAP, int nXOff, int nYOff, int bWarn);
+static void addTileSources(GDALDataset *poVRT, const BivarOutput *poOutput);
+static char **setBigTIFF(char **papszOptions, int nXSize, int nYSize, GDALDataType eType, int bOverviews,
+                         int verbose);
+static int makeCOG(GDALDriver *poDriver, GDALDataset *poSrc, const char *pszName, char **papszOptions, int verbose);
 
 void usage(char *name){
 	fprintf(stderr,"%s - calculate the bivariate CCAP file from the single date files\n",name);
-	fprintf(stderr,"USAGE: %s [-c colorfile | -b bivariate_sample] -s start_ccap -e end_ccap -o bivariate_file\n",name);
+	fprintf(stderr,"USAGE: %s [-c colorfile | -b bivariate_sample] [-j threads] [-m size] [-S scheme] [-L] -s start_ccap -e end_ccap -o bivariate_file\n",name);
+	fprintf(stderr,"   or: %s [-c colorfile | -b bivariate_sample] [-j threads] [-m size] [-S scheme] [-L] -E epoch_ccap -E epoch_ccap ... [-P pairs] [-H] [-o bivariate_file]\n",name);
 	fprintf(stderr,"\tcolorfile = 4 column space separated color file for bivariate (index red green blue)\n");
 	fprintf(stderr,"\tbivariate_sample = existing bivariate file with good raster attributes and colormap to copy\n");
 	fprintf(stderr,"\tstart_ccap = C-CAP file with first year of data\n");
 	fprintf(stderr,"\tend_ccap = C-CAP file with final year of data\n");
-	fprintf(stderr,"\tbivariate_file = C-CAP bivariate output file\n");
+	fprintf(stderr,"\tbivariate_file = C-CAP bivariate output file, .tif, .img, or .vrt for a grid of GeoTIFF tile files\n");
+	fprintf(stderr,"\t         put together by a VRT, written by up to threads at once\n");
+	fprintf(stderr,"\tepoch_ccap = C-CAP file of one epoch, oldest first. Each is read once for all the pairs\n");
+	fprintf(stderr,"\tpairs = epochs to pair up, numbered from 1, eg 1:2,1:6, each once and the\n");
+	fprintf(stderr,"\t         earlier epoch first [every pair]\n");
+	fprintf(stderr,"\t         With more than one pair, epochs 1 and 3 go in bivariate_file_1_3 and so on\n");
+	fprintf(stderr,"\t-H = print each pair's histogram: start epoch, end epoch, bivariate class, pixels\n");
+	fprintf(stderr,"\t     Without -o no bivariate files are written\n");
+	fprintf(stderr,"\tthreads = number of threads combining strips while others read and write [1]\n");
+	fprintf(stderr,"\tsize = -m or --mem-limit, memory to stay under, eg 4G or 512M [no limit]\n");
+	fprintf(stderr,"\tscheme = -S, class scheme of the C-CAP files: %s, or the number of classes [ccap]\n",
+	        CCAPSchemeNames());
+	fprintf(stderr,"\t         Schemes of 15 classes or less make Byte bivariates\n");
+	fprintf(stderr,"\t-L = write Byte bivariates holding a code per transition that occurs, with the\n");
+	fprintf(stderr,"\t     bivariate value of each code in the RAT; ccap_summarize and ccap2tbl decode\n");
+	fprintf(stderr,"\t     them as they read. Costs a first pass over the C-CAP files to find the\n");
+	fprintf(stderr,"\t     transitions, and fails if a pair has more than 255\n");
+	fprintf(stderr,"GeoTIFF output: [-compress codec] [-level level] [-predictor] [-tile size] [-overviews levels] [-cog] [-co NAME=VALUE]...\n");
+	fprintf(stderr,"\tcodec = NONE, PACKBITS, LZW, DEFLATE or ZSTD (if GDAL has it) [%s]\n",CCAP_DEFAULT_COMPRESS);
+	fprintf(stderr,"\tlevel = DEFLATE 1 to 9 or ZSTD 1 to 22, higher is smaller and slower [the codec's default]\n");
+	fprintf(stderr,"\t-predictor = horizontal differencing before compressing, PREDICTOR=2\n");
+	fprintf(stderr,"\tsize = tile width and height, 0 for strips [%d]\n",CCAP_DEFAULT_TILE);
+	fprintf(stderr,"\tlevels = internal overviews, eg 2,4,8,16, or auto to halve down to one tile. They are\n");
+	fprintf(stderr,"\t         sampled (nearest) from each strip as it is written, not read back afterwards\n");
+	fprintf(stderr,"\t-cog = Cloud Optimized GeoTIFF layout, overviews auto unless -overviews says\n");
+	fprintf(stderr,"\t-co = any other GDAL creation option, applied last\n");
+	fprintf(stderr,"\tWith -j the blocks are also compressed by that many threads (NUM_THREADS)\n");
+	fprintf(stderr,"\tFiles of 4GB or more uncompressed are BigTIFF, unless -co BIGTIFF=NO\n");
+	fprintf(stderr,"VRT output: [-split size] and the GeoTIFF options, for the tile files\n");
+	fprintf(stderr,"\tsize = tile files' width and height, a multiple of the -tile size [%d]\n",CCAP_DEFAULT_SPLIT);
+	fprintf(stderr,"\tWith -j up to that many tile files are written at once, sharing the NUM_THREADS\n");
 	fprintf(stderr,"Note: use one of the colorfile or the bivariate_sample\n");
 
 }
@@ -40,17 +230,28 @@ int main(int argc, char **argv)
 	
 	
 	int c, i, j;
-	char *shpname = NULL;
-	char *fieldname = NULL;
 	char *psColorTable = NULL;
 	char *psRATBivarName = NULL;
-	FILE *tfp = stdout;
 	int verbose = 0;
-	GDALDataset *poStartCCAP = NULL;
-	GDALDataset *poEndCCAP = NULL;
-	GDALDataset *poBivariate = NULL;
+	std::vector<GDALDataset *> apoEpochs;   // the C-CAP files, in date order
+	std::vector<const char *> apszEpochNames;
+	std::vector<GDALDataset *> apoBivariates; // one per pair, unless only the histograms are wanted
+	std::vector<std::pair<int, int> > aoPairs;
 	char *psBivariateName = NULL;
-	unsigned int *histogram = NULL;
+	const char *psStartName = NULL;
+	const char *psEndName = NULL;
+	const char *pszPairs = NULL;
+	int bHistograms = FALSE;
+	int bLUT = FALSE;
+	TiffLayout sLayout = { CCAP_DEFAULT_COMPRESS, 0, FALSE, CCAP_DEFAULT_TILE, 1, NULL };
+	const char *pszOverviews = NULL;
+	int bCOG = FALSE;
+	int nSplit = 0;
+	int bTiffOptions = FALSE; // any GeoTIFF only option given, for the warning with .img
+	CCAPScheme sScheme;
+	const char *pszScheme = "ccap";
+	int nThreads = 1;
+	GIntBig nMemLimit = 0;
 
 
 	extern int optind;
@@ -58,38 +259,89 @@ int main(int argc, char **argv)
 
 	//const char *pszFormat = "HFA";
 	char gdalformat[10];
-	GDALDriver *poDriver;
+	GDALDriver *poDriver = NULL;
+	GDALDriver *poTileDriver = NULL; // GTiff, for GeoTIFF and the tile files of a VRT
 	char **papszMetadata;
 
 	GDALAllRegister();
 	OGRRegisterAll();
 
 	
-	
-
-	
 
-	while((c = getopt(argc,argv,"c:s:e:o:vhb:")) != -1){
+	while((c = getopt_long_only(argc,argv,"c:s:e:E:P:Ho:S:Lvhb:j:m:",aoLongOptions,NULL)) != -1){
 		switch(c){
-			case 'c':
-				psColorTable = optarg; // file name for a colortable (3 column)
+			case OPT_CO:
+				sLayout.papszExtra = CSLAddString(sLayout.papszExtra, optarg);
+				bTiffOptions = TRUE;
 				break;
-			case 's':
-				poStartCCAP = (GDALDataset *)GDALOpen( optarg, GA_ReadOnly );
-				if(poStartCCAP == NULL){
-					fprintf(stderr,"Failed to open start C-CAP file %s\n",optarg);
+			case OPT_COMPRESS:
+				for(char *p = optarg; *p; p++) *p = toupper(*p);
+				sLayout.pszCompress = optarg;
+				bTiffOptions = TRUE;
+				break;
+			case OPT_LEVEL:
+				sLayout.nLevel = atoi(optarg);
+				bTiffOptions = TRUE;
+				break;
+			case OPT_PREDICTOR:
+				sLayout.bPredictor = TRUE;
+				bTiffOptions = TRUE;
+				break;
+			case OPT_TILE:
+				sLayout.nTileSize = atoi(optarg);
+				if(sLayout.nTileSize < 0 || sLayout.nTileSize % 16 != 0){
+					fprintf(stderr,"Tile size %s must be a multiple of 16, or 0 for strips\n",optarg);
 					usage(argv[0]);
 					return 1;
 				}
+				bTiffOptions = TRUE;
 				break;
-			case 'e':
-				poEndCCAP = (GDALDataset *)GDALOpen( optarg, GA_ReadOnly );
-				if(poEndCCAP == NULL){
-					fprintf(stderr,"Failed to open end C-CAP file %s\n",optarg);
+			case OPT_OVERVIEWS:
+				pszOverviews = optarg;
+				break;
+			case OPT_COG:
+				bCOG = TRUE;
+				bTiffOptions = TRUE;
+				break;
+			case OPT_SPLIT:
+				nSplit = atoi(optarg);
+				if(nSplit <= 0 || nSplit % 16 != 0){
+					fprintf(stderr,"Tile file size %s must be a multiple of 16\n",optarg);
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'm':
+				if((nMemLimit = CCAPParseMemSize(optarg)) < 0){
+					fprintf(stderr,"Bad memory limit %s\n",optarg);
 					usage(argv[0]);
 					return 1;
 				}
 				break;
+			case 'c':
+				psColorTable = optarg; // file name for a colortable (3 column)
+				break;
+			case 's':
+				psStartName = optarg;
+				break;
+			case 'e':
+				psEndName = optarg;
+				break;
+			case 'E':
+				apszEpochNames.push_back(optarg);
+				break;
+			case 'P':
+				pszPairs = optarg;
+				break;
+			case 'H':
+				bHistograms = TRUE;
+				break;
+			case 'S':
+				pszScheme = optarg;
+				break;
+			case 'L':
+				bLUT = TRUE;
+				break;
 			case 'b':
 				// existing bivariate file for the RAT
 				psRATBivarName = optarg;
@@ -97,6 +349,10 @@ int main(int argc, char **argv)
 			case 'o':
 				psBivariateName = optarg;
 				break;
+			case 'j':
+				nThreads = atoi(optarg);
+				if(nThreads < 1) nThreads = 1;
+				break;
 			case 'v':
 				verbose++;
 				break;
@@ -111,124 +367,705 @@ int main(int argc, char **argv)
 		}
 	}
 
-	if (poEndCCAP == NULL || poStartCCAP == NULL){
-		fprintf(stderr,"Must supply start and end C-CAP files\n");
+	/*
+	* -s and -e are the first and second of the epochs, so the one pair
+	* ccap2bivar has always made is just the smallest case of -E.
+	*/
+	if(psStartName != NULL || psEndName != NULL){
+		if(psStartName == NULL || psEndName == NULL || !apszEpochNames.empty()){
+			fprintf(stderr,"Must supply both start and end C-CAP files, or -E epochs\n");
+			usage(argv[0]);
+			return 1;
+		}
+		apszEpochNames.push_back(psStartName);
+		apszEpochNames.push_back(psEndName);
+	}
+	if(apszEpochNames.size() < 2){
+		fprintf(stderr,"Must supply start and end C-CAP files, or two or more -E epochs\n");
 		usage(argv[0]);
 		return 1;
 	}
-
-	// figure out the format for the output
-	if(psBivariateName == NULL){
-		fprintf(stderr,"Must supply output file name\n");
+	if(!CCAPSchemeFromName(pszScheme, &sScheme)){
 		usage(argv[0]);
 		return 1;
 	}
-	char **papszOptions = NULL;
-	
-	const char * psLastPeriod = strrchr(psBivariateName,'.');
-	if(strcasecmp(psLastPeriod,".img") == 0){
-		strcpy(gdalformat,"HFA");
-		papszOptions = getHFAOptions();
-	}else if(strcasecmp(psLastPeriod,".tif") == 0){
-		strcpy(gdalformat,"GTiff");
-		papszOptions = getTiffOptions();
-	}else{
-		fprintf(stderr,"Not supported output format yet\n");
+	if(!parsePairs(pszPairs, (int)apszEpochNames.size(), aoPairs)){
+		usage(argv[0]);
+		return 1;
+	}
+	if(psBivariateName == NULL && !bHistograms){
+		fprintf(stderr,"Must supply output file name, or -H for just the histograms\n");
+		usage(argv[0]);
 		return 1;
 	}
 
-	// validate that we can use create
-	poDriver = GetGDALDriverManager()->GetDriverByName(gdalformat);
+	for(i = 0; i < (int)apszEpochNames.size(); i++){
+		GDALDataset *poDS = (GDALDataset *)GDALOpen( apszEpochNames[i], GA_ReadOnly );
+		if(poDS == NULL){
+			fprintf(stderr,"Failed to open C-CAP file %s\n",apszEpochNames[i]);
+			usage(argv[0]);
+			return 1;
+		}
+		apoEpochs.push_back(poDS);
+	}
+
+	// figure out the format for the output
+	char **papszOptions = NULL;
+	if(psBivariateName != NULL){
+		const char * psLastPeriod = strrchr(psBivariateName,'.');
+		if(psLastPeriod != NULL && strcasecmp(psLastPeriod,".img") == 0){
+			strcpy(gdalformat,"HFA");
+			papszOptions = getHFAOptions();
+		}else if(psLastPeriod != NULL && strcasecmp(psLastPeriod,".tif") == 0){
+			strcpy(gdalformat,"GTiff");
+			sLayout.nThreads = nThreads;
+			papszOptions = getTiffOptions(&sLayout);
+		}else if(psLastPeriod != NULL && strcasecmp(psLastPeriod,".vrt") == 0){
+			// the options are for the tile files, made once the split is known
+			strcpy(gdalformat,"VRT");
+		}else{
+			fprintf(stderr,"Not supported output format yet\n");
+			return 1;
+		}
+
+		// validate that we can use create
+		poDriver = GetGDALDriverManager()->GetDriverByName(gdalformat);
 
-  if( poDriver == NULL )
-      return 1;
+	  if( poDriver == NULL )
+	      return 1;
 
-  papszMetadata = poDriver->GetMetadata();
-  if( ! CSLFetchBoolean( papszMetadata, GDAL_DCAP_CREATE, FALSE ) ) {
-  	printf( "Driver %s does not support Create() method.\n", gdalformat );
-  	return 1;
-  }
+	  papszMetadata = poDriver->GetMetadata();
+	  if( ! CSLFetchBoolean( papszMetadata, GDAL_DCAP_CREATE, FALSE ) ) {
+	  	printf( "Driver %s does not support Create() method.\n", gdalformat );
+	  	return 1;
+	  }
+
+	  if(EQUAL(gdalformat,"GTiff") || EQUAL(gdalformat,"VRT")){
+	  	poTileDriver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	  	if(poTileDriver == NULL) return 1;
+	  	// ZSTD (and LZW or DEFLATE in odd builds) may not be compiled in
+	  	const char *pszCreationOptions = poTileDriver->GetMetadataItem(GDAL_DMD_CREATIONOPTIONLIST);
+	  	if(pszCreationOptions != NULL && !EQUAL(sLayout.pszCompress,"NONE")
+	  	   && strstr(pszCreationOptions, CPLSPrintf("<Value>%s</Value>",sLayout.pszCompress)) == NULL){
+	  		fprintf(stderr,"This GDAL can't write %s compressed GeoTIFF\n",sLayout.pszCompress);
+	  		return 1;
+	  	}
+	  	if(bCOG && EQUAL(gdalformat,"VRT")){
+	  		fprintf(stderr,"-cog makes one file, it doesn't go with .vrt output\n");
+	  		return 1;
+	  	}
+	  	if(bCOG && sLayout.nTileSize == 0){
+	  		fprintf(stderr,"A cloud optimized GeoTIFF has to be tiled, -tile 0 won't do\n");
+	  		return 1;
+	  	}
+	  	if(bCOG && pszOverviews == NULL) pszOverviews = "auto";
+	  }else if(bCOG){
+	  	fprintf(stderr,"-cog needs GeoTIFF output\n");
+	  	return 1;
+	  }else if(bTiffOptions){
+	  	fprintf(stderr,"Warning: -compress, -level, -predictor, -tile and -co are for GeoTIFF output, ignoring them\n");
+	  }
+
+	  if(EQUAL(gdalformat,"VRT")){
+	  	if(nSplit == 0) nSplit = CCAP_DEFAULT_SPLIT;
+	  	if(sLayout.nTileSize > 0 && nSplit % sLayout.nTileSize != 0){
+	  		fprintf(stderr,"The tile files' size %d must be a multiple of the -tile size %d\n",nSplit,sLayout.nTileSize);
+	  		return 1;
+	  	}
+	  }else if(nSplit > 0){
+	  	fprintf(stderr,"-split is for .vrt output\n");
+	  	return 1;
+	  }
+	}
       
 
 
 	// Validate that the input rasters are the same size, etc. 
-	if(poEndCCAP->GetRasterXSize() != poStartCCAP->GetRasterXSize() 
-		|| poEndCCAP->GetRasterYSize() != poStartCCAP->GetRasterYSize()){
-		fprintf(stderr,"Input files are not the same size!\n");
+	int nXSize = apoEpochs[0]->GetRasterXSize();
+	int nYSize = apoEpochs[0]->GetRasterYSize();
+	for(i = 1; i < (int)apoEpochs.size(); i++){
+		if(apoEpochs[i]->GetRasterXSize() != nXSize || apoEpochs[i]->GetRasterYSize() != nYSize){
+			fprintf(stderr,"Input files are not the same size!\n");
+			return 1;
+		}
+	}
+	std::vector<GDALRasterBand *> apoBands;
+	for(i = 0; i < (int)apoEpochs.size(); i++){
+		GDALRasterBand *poBand = apoEpochs[i]->GetRasterBand( 1 );
+		if(poBand == NULL){
+			fprintf(stderr,"Failed to get one of the bands!\n");
+			GDALExit(1);
+		}
+		apoBands.push_back(poBand);
+	}
+	// the size of each file written, for a VRT that of a whole tile file
+	int bVRT = psBivariateName != NULL && EQUAL(gdalformat,"VRT");
+	int nFileXSize = bVRT ? MIN(nXSize, nSplit) : nXSize;
+	int nFileYSize = bVRT ? MIN(nYSize, nSplit) : nYSize;
+	if(bVRT){
+		// a row's tile files are written by up to -j writers at once, each compressing with its share of -j
+		int nColWriters = MIN(nThreads, (nXSize + nFileXSize - 1) / nFileXSize);
+		sLayout.nThreads = MAX(1, nThreads / nColWriters);
+		papszOptions = getTiffOptions(&sLayout);
+	}
+	std::vector<int> anOverviews;
+	if(psBivariateName != NULL && pszOverviews != NULL
+	   && !parseOverviews(pszOverviews, nFileXSize, nFileYSize,
+	                      sLayout.nTileSize > 0 ? sLayout.nTileSize : CCAP_DEFAULT_TILE, anOverviews)){
+		usage(argv[0]);
 		return 1;
 	}
+	int bStripOverviews = !anOverviews.empty() && poTileDriver != NULL;
+
+	// the histograms, filled in by the combine threads
+	int nPairBuckets = CCAPSchemeCells(&sScheme);
+	size_t nBuckets = aoPairs.size() * nPairBuckets;
+	GUIntBig *anHistogram = (GUIntBig *)CPLMalloc(sizeof(GUIntBig) * nBuckets);
+	for (size_t b = 0; b < nBuckets; b++){ anHistogram[b] = 0;}
+
+	BivarPipeline oPipe;
+	oPipe.apszEpochNames = apszEpochNames;
+	oPipe.aoPairs = aoPairs;
+	oPipe.sScheme = sScheme;
+	CCAPSchemeClassTable(&sScheme, oPipe.abyClasses);
+	oPipe.nBuckets = nPairBuckets;
+	oPipe.nXSize = nXSize;
+	oPipe.nYSize = nYSize;
+	oPipe.panHistogram = anHistogram;
+
+	/*
+	* -L: count every pair's transitions first, writing nothing, so each
+	* output has its codes before it is made. The C-CAP files get read
+	* twice, but they are bytes, and the bivariates written are half the
+	* size of UInt16 ones.
+	*/
+	if(bLUT && CCAPSchemeByteBivariate(&sScheme)){
+		fprintf(stderr,"The %s scheme's bivariates already fit in a byte, ignoring -L\n", sScheme.pszName);
+		bLUT = FALSE;
+	}
+	std::vector<CCAPBivariateLUT> asLUTs;
+	if(bLUT && psBivariateName != NULL){
+		verbose && fprintf(stderr,"Finding the transitions to code\n");
+		runPipeline(&oPipe, apoBands, std::vector<BivarOutput>(), nThreads, nMemLimit, verbose);
+		asLUTs.resize(aoPairs.size());
+		oPipe.aabyCodes.resize(aoPairs.size());
+		for(size_t p = 0; p < aoPairs.size(); p++){
+			if(!CCAPBuildBivariateLUT(anHistogram + p * nPairBuckets, nPairBuckets, &asLUTs[p])){
+				fprintf(stderr,"%s to %s has more than 255 transitions, too many to code with -L\n",
+				        apszEpochNames[aoPairs[p].first], apszEpochNames[aoPairs[p].second]);
+				GDALExit(1);
+			}
+			verbose && fprintf(stderr,"%s to %s: %d transitions\n", apszEpochNames[aoPairs[p].first],
+			                   apszEpochNames[aoPairs[p].second], asLUTs[p].nCodes - 1);
+			oPipe.aabyCodes[p].resize(nPairBuckets);
+			CCAPBivariateCodes(&asLUTs[p], nPairBuckets, &oPipe.aabyCodes[p][0]);
+		}
+		for (size_t b = 0; b < nBuckets; b++){ anHistogram[b] = 0;}
+	}
 
-	int nXSize = poEndCCAP->GetRasterXSize();
-	int nYSize = poEndCCAP->GetRasterYSize();
 	/**
 	* Want to create an output file the same size as the input files,
-	* but with 16 bit unsigned instead of 8 bit.
+	* but with 16 bit unsigned instead of 8 bit, unless the scheme is
+	* small enough for every bivariate to fit in a byte or they are coded
+	* with -L. With more than one pair each gets its own, named for the
+	* two epochs. A COG is written as a plain tiled GeoTIFF first and
+	* copied into the cloud optimized layout, overviews first, at the end.
+	* A .vrt is made empty here, and gets its tile files as sources once
+	* the pipeline has written and closed them.
 	*/
-	
-	if( (poBivariate = poDriver->Create(psBivariateName, nXSize, nYSize, 1,
-		GDT_UInt16,papszOptions)) == NULL){
-		fprintf(stderr,"Failed to created output file %s\n",psBivariateName);
-		return 1;
+	GDALDataType eBivariateType = bLUT || CCAPSchemeByteBivariate(&sScheme) ? GDT_Byte : GDT_UInt16;
+	if(poTileDriver != NULL){
+		papszOptions = setBigTIFF(papszOptions, nFileXSize, nFileYSize, eBivariateType, !anOverviews.empty(), verbose);
 	}
+	std::vector<std::string> aosOutputNames;
+	std::vector<std::string> aosCreateNames;
+	std::vector<BivarOutput> aoOutputs;
+	GDALColorTable *poColorTable = NULL;
+	GDALRasterAttributeTable *poRAT = NULL;
+	if(psBivariateName != NULL) loadColors(psColorTable, psRATBivarName, nPairBuckets, verbose, &poColorTable, &poRAT);
+	for(size_t p = 0; psBivariateName != NULL && p < aoPairs.size(); p++){
+		std::string osName = aoPairs.size() == 1 ? std::string(psBivariateName)
+		                                         : pairFileName(psBivariateName, aoPairs[p]);
+		std::string osCreateName = bCOG ? osName + ".tmp.tif" : osName;
+		GDALDataset *poBivariate;
+		if( (poBivariate = poDriver->Create(osCreateName.c_str(), nXSize, nYSize, 1,
+			eBivariateType, bVRT ? NULL : papszOptions)) == NULL){
+			fprintf(stderr,"Failed to created output file %s\n",osCreateName.c_str());
+			return 1;
+		}
+		aosOutputNames.push_back(osName);
+		aosCreateNames.push_back(osCreateName);
+		verbose && aoPairs.size() > 1 && fprintf(stderr,"%s is %s to %s\n",osName.c_str(),
+		                                         apszEpochNames[aoPairs[p].first],apszEpochNames[aoPairs[p].second]);
 
-	// add georeferencing and such
-	double adfGeoTransform[6];
-	if(poEndCCAP->GetGeoTransform( adfGeoTransform ) == CE_None){
-		poBivariate->SetGeoTransform(adfGeoTransform);
-	}else{
-		fprintf(stderr,"Warning: End date C-CAP file missing georeferencing\n");
+		// add georeferencing and such, from the later epoch
+		GDALDataset *poEndCCAP = apoEpochs[aoPairs[p].second];
+		setGeoreference(poBivariate, poEndCCAP, 0, 0, TRUE);
+
+		GDALRasterBand *poBandOut = poBivariate->GetRasterBand( 1 );
+		if(poBandOut == NULL){
+			fprintf(stderr,"Failed to get one of the bands!\n");
+			GDALExit(1);
+			return 1;
+		}
+		setColors(poBandOut, poColorTable, poRAT);
+		if(!asLUTs.empty()) CCAPSetBivariateLUT(poBandOut, &asLUTs[p], sScheme.nClasses);
+		apoBivariates.push_back(poBivariate);
+
+		BivarOutput oOutput;
+		oOutput.nTileXSize = nFileXSize;
+		oOutput.nTileYSize = nFileYSize;
+		oOutput.nTileCols = (nXSize + nFileXSize - 1) / nFileXSize;
+		oOutput.nTileRows = (nYSize + nFileYSize - 1) / nFileYSize;
+		if(!bVRT){
+			oOutput.apoTiles.push_back(poBivariate);
+			oOutput.aosTileNames.push_back(osCreateName);
+		}
+		for(int r = 0; bVRT && r < oOutput.nTileRows; r++){
+			for(int t = 0; t < oOutput.nTileCols; t++){
+				std::string osTileName = tileFileName(osName, r, t);
+				int nXOff = t * nFileXSize;
+				int nYOff = r * nFileYSize;
+				GDALDataset *poTile = poTileDriver->Create(osTileName.c_str(), MIN(nFileXSize, nXSize - nXOff),
+				                                           MIN(nFileYSize, nYSize - nYOff), 1, eBivariateType,
+				                                           papszOptions);
+				if(poTile == NULL){
+					fprintf(stderr,"Failed to created output file %s\n",osTileName.c_str());
+					return 1;
+				}
+				setGeoreference(poTile, poEndCCAP, nXOff, nYOff, FALSE);
+				setColors(poTile->GetRasterBand( 1 ), poColorTable, poRAT);
+				if(!asLUTs.empty()) CCAPSetBivariateLUT(poTile->GetRasterBand( 1 ), &asLUTs[p], sScheme.nClasses);
+				oOutput.apoTiles.push_back(poTile);
+				oOutput.aosTileNames.push_back(osTileName);
+			}
+		}
+		verbose && bVRT && fprintf(stderr,"%s is %d by %d tile files of %s\n",osName.c_str(),oOutput.nTileCols,
+		                           oOutput.nTileRows,tileFileName(osName, 0, 0).c_str());
+
+		// empty overviews for the writer to fill from each strip
+		for(size_t t = 0; bStripOverviews && t < oOutput.apoTiles.size(); t++){
+			if(oOutput.apoTiles[t]->BuildOverviews("NONE", (int)anOverviews.size(), &anOverviews[0],
+			                                       0, NULL, NULL, NULL) != CE_None){
+				fprintf(stderr,"Failed to add overviews to %s\n",oOutput.aosTileNames[t].c_str());
+				GDALExit(1);
+			}
+		}
+		aoOutputs.push_back(oOutput);
 	}
 
-	poBivariate->SetProjection(poEndCCAP->GetProjectionRef());
+	verbose && fprintf(stderr,"%s scheme, %d classes, %s bivariates\n", sScheme.pszName, sScheme.nClasses,
+	                   GDALGetDataTypeName(eBivariateType));
+	runPipeline(&oPipe, apoBands, aoOutputs, nThreads, nMemLimit, verbose);
+	int nOutputs = (int)apoBivariates.size();
+	int nEpochs = (int)apoEpochs.size();
+
+	// the tile files are done, so close them and put them in their VRTs
+	for(j = 0; j < nOutputs && bVRT; j++){
+		for(size_t t = 0; t < aoOutputs[j].apoTiles.size(); t++){
+			GDALClose((GDALDatasetH) aoOutputs[j].apoTiles[t]);
+		}
+		addTileSources(apoBivariates[j], &aoOutputs[j]);
+	}
+
+	// formats that can't have empty overviews get them read back from the file
+	for(j = 0; j < nOutputs && !anOverviews.empty() && !bStripOverviews; j++){
+		verbose && fprintf(stderr,"Building overviews of %s\n",aosOutputNames[j].c_str());
+		if(apoBivariates[j]->BuildOverviews("NEAREST", (int)anOverviews.size(), &anOverviews[0], 0, NULL,
+		                                    NULL, NULL) != CE_None){
+			fprintf(stderr,"Failed to build overviews of %s\n",aosOutputNames[j].c_str());
+			GDALExit(1);
+		}
+	}
 
+	// the histograms were counted as the strips were combined, so there is
+	// no need to read the outputs back with GetHistogram(). Coded outputs
+	// get theirs by code.
+	double dfMin = -0.5; // first bucket is from -0.5 to 0.5, so center on zero
+	double dfMax = CCAPSchemeBivariateMax(&sScheme) + 0.5;
+	for(j = 0; j < nOutputs; j++){
+		GDALRasterBand *poBandOut = apoBivariates[j]->GetRasterBand( 1 );
+		if(asLUTs.empty()){
+			poBandOut->SetDefaultHistogram(dfMin, dfMax, nPairBuckets, anHistogram + j * nPairBuckets);
+			setRATHistogram(poBandOut, anHistogram + j * nPairBuckets, nPairBuckets);
+			continue;
+		}
+		int nCodes = asLUTs[j].nCodes;
+		std::vector<GUIntBig> anCodeHistogram(nCodes);
+		for(int k = 0; k < nCodes; k++){
+			anCodeHistogram[k] = anHistogram[j * nPairBuckets + asLUTs[j].anValues[k]];
+		}
+		poBandOut->SetDefaultHistogram(dfMin, nCodes - 0.5, nCodes, &anCodeHistogram[0]);
+		setRATHistogram(poBandOut, &anCodeHistogram[0], nCodes);
+	}
+
+	// -H: the pairs' counts in the form start epoch, end epoch, bivariate class, #counted
+	if(bHistograms){
+		for(size_t p = 0; p < aoPairs.size(); p++){
+			for(i = 1; i < nPairBuckets; i++){
+				GUIntBig nCount = anHistogram[p * nPairBuckets + i];
+				if(nCount > 0) printf("%d, %d, %d, %llu\n", aoPairs[p].first + 1, aoPairs[p].second + 1, i, nCount);
+			}
+		}
+	}
 	
+	// check the color table
+	/*GDALColorTable *poTestColor = poBandOut->GetColorTable();
+	//if (! poTestColor->IsSame(poColorTable)){
+		fprintf(stderr,"Color table comparison\n");
+		for(int i = 0; i < poTestColor->GetColorEntryCount(); i++){
+			fprintf(stderr,"%d: ", i);
+			printRGB(poTestColor->GetColorEntry(i));
+			fprintf(stderr," vs ");
+			printRGB(poColorTable->GetColorEntry(i));
+			fprintf(stderr,"\n");
+		}*/
+	//}
+
+
+	// All done. Close properly
+	for(j = 0; j < nOutputs; j++){
+		GDALFlushCache( (GDALDatasetH)apoBivariates[j] );
+		if(bCOG && !makeCOG(poDriver, apoBivariates[j], aosOutputNames[j].c_str(), papszOptions, verbose)){
+			GDALExit(1);
+		}
+		GDALClose((GDALDatasetH) apoBivariates[j]);
+		if(bCOG) poDriver->Delete(aosCreateNames[j].c_str());
+	}
+	for(i = 0; i < nEpochs; i++){
+		GDALClose((GDALDatasetH) apoEpochs[i]);
+	}
+
+
+
+	// and deallocate stuff
+	CPLFree(anHistogram);
+	delete poColorTable;
+	delete poRAT;
+
+	if(verbose || nMemLimit > 0) CCAPReportPeakRSS(nMemLimit);
+
+	GDALExit(0);
+
+}
+
 	
-	// allocate for a line at a time
-	unsigned char *pasScanlineStart;
-	unsigned char *pasScanlineEnd;
-	unsigned short *pasScanlineOut;
-	pasScanlineStart = (unsigned char *)CPLMalloc(sizeof(unsigned char)*nXSize);
-	pasScanlineEnd = (unsigned char *)CPLMalloc(sizeof(unsigned char)*nXSize);
-	pasScanlineOut = (unsigned short *)CPLMalloc(sizeof(unsigned short)*nXSize);
-	if(pasScanlineStart == NULL || pasScanlineEnd == NULL || pasScanlineOut == NULL){
-		fprintf(stderr,"Failed to allocate scanlines for %d width\n",nXSize);
-		GDALExit(1);
-		return 1;
+
+/************************************************************************/
+/*                             parsePairs()                             */
+/*                                                                      */
+/*      -P 1:2,1:6,5:6 as epoch numbers from 1, the earlier first.      */
+/*      Without -P, every pair of epochs in date order.                 */
+/************************************************************************/
+
+static int parsePairs(const char *pszPairs, int nEpochs, std::vector<std::pair<int, int> > &aoPairs)
+{
+	if(pszPairs == NULL){
+		for(int s = 0; s < nEpochs; s++){
+			for(int e = s + 1; e < nEpochs; e++) aoPairs.push_back(std::make_pair(s, e));
+		}
+		return TRUE;
 	}
 
-	// get the band info
-	GDALRasterBand *poBandStart = poStartCCAP->GetRasterBand( 1 );
-	GDALRasterBand *poBandEnd = poEndCCAP->GetRasterBand( 1 );
-	GDALRasterBand *poBandOut = poBivariate->GetRasterBand( 1 );
+	char **papszPairs = CSLTokenizeString2(pszPairs, ",", 0);
+	int bOK = CSLCount(papszPairs) > 0;
+	for(int i = 0; bOK && papszPairs[i] != NULL; i++){
+		int nStart, nEnd;
+		char chExtra;
+		if(sscanf(papszPairs[i], "%d:%d%c", &nStart, &nEnd, &chExtra) != 2
+		   || nStart < 1 || nEnd < 1 || nStart > nEpochs || nEnd > nEpochs || nStart >= nEnd){
+			fprintf(stderr,"Bad pair %s, expected start:end epoch numbers from 1 to %d, the earlier first\n",
+			        papszPairs[i],nEpochs);
+			bOK = FALSE;
+		}else if(std::find(aoPairs.begin(), aoPairs.end(), std::make_pair(nStart - 1, nEnd - 1)) != aoPairs.end()){
+			// both would be written to the same bivariate_file_s_e
+			fprintf(stderr,"Pair %s is given twice\n",papszPairs[i]);
+			bOK = FALSE;
+		}else{
+			aoPairs.push_back(std::make_pair(nStart - 1, nEnd - 1));
+		}
+	}
+	CSLDestroy(papszPairs);
+	return bOK;
+}
 
-	// look at what a color table looks like
-	//printColorTable(poBandEnd->GetColorTable());
+/************************************************************************/
+/*                            pairFileName()                            */
+/*                                                                      */
+/*      bivar.tif becomes bivar_1_3.tif for epochs 1 and 3.             */
+/************************************************************************/
 
+static std::string pairFileName(const char *pszName, const std::pair<int, int> &oPair)
+{
+	std::string osPath = CPLGetPath(pszName);
+	std::string osBase = CPLGetBasename(pszName);
+	std::string osExtension = CPLGetExtension(pszName);
+	osBase += CPLSPrintf("_%d_%d", oPair.first + 1, oPair.second + 1);
+	return CPLFormFilename(osPath.c_str(), osBase.c_str(), osExtension.c_str());
+}
 
-	if(poBandStart == NULL || poBandEnd == NULL || poBandOut == NULL){
-		fprintf(stderr,"Failed to get one of the bands!\n");
-		GDALExit(1);
-		return 1;
+/************************************************************************/
+/*                           parseOverviews()                           */
+/*                                                                      */
+/*      -overviews 2,4,8 as increasing factors, or auto for halving     */
+/*      until the smallest overview fits in one tile.                   */
+/************************************************************************/
+
+static int parseOverviews(const char *pszLevels, int nXSize, int nYSize, int nTileSize, std::vector<int> &anLevels)
+{
+	anLevels.clear();
+	if(EQUAL(pszLevels,"auto")){
+		int nSize = nXSize > nYSize ? nXSize : nYSize;
+		for(int nLevel = 2; nSize / (nLevel / 2) > nTileSize; nLevel *= 2){
+			anLevels.push_back(nLevel);
+		}
+		return TRUE;
 	}
 
-	// initialize the color table for bivariate if we can.
-	
-	GDALColorTable *poColorTable = NULL;
+	char **papszLevels = CSLTokenizeString2(pszLevels, ",", 0);
+	for(int i = 0; papszLevels != NULL && papszLevels[i] != NULL; i++){
+		int nLevel = atoi(papszLevels[i]);
+		if(nLevel < 2 || (!anLevels.empty() && nLevel <= anLevels.back())){
+			fprintf(stderr,"Bad overview levels %s, they go up from 2, eg 2,4,8\n",pszLevels);
+			CSLDestroy(papszLevels);
+			return FALSE;
+		}
+		anLevels.push_back(nLevel);
+	}
+	CSLDestroy(papszLevels);
+	if(anLevels.empty()){
+		fprintf(stderr,"No overview levels in %s\n",pszLevels);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/************************************************************************/
+/*                             writeTiles()                             */
+/*                                                                      */
+/*      Write a strip's lines to the tiles of every nColStep'th column  */
+/*      from nFirstCol, and to their overviews. panStrip is the whole   */
+/*      width of the raster; a plain output is the one tile.            */
+/************************************************************************/
+
+static void writeTiles(const BivarOutput *poOutput, const unsigned short *panStrip, int nXSize, int nYSize,
+                       int nYOff, int nLines, int nFirstCol, int nColStep, std::vector<unsigned short> *panOverview)
+{
+	int nFirstRow = nYOff / poOutput->nTileYSize;
+	int nLastRow = (nYOff + nLines - 1) / poOutput->nTileYSize;
+	for(int r = nFirstRow; r <= nLastRow; r++){
+		int nTileYOff = r * poOutput->nTileYSize;
+		int nTileYSize = MIN(poOutput->nTileYSize, nYSize - nTileYOff);
+		int y0 = MAX(nYOff, nTileYOff);
+		int y1 = MIN(nYOff + nLines, nTileYOff + nTileYSize);
+		for(int t = nFirstCol; t < poOutput->nTileCols; t += nColStep){
+			int nTileXOff = t * poOutput->nTileXSize;
+			int nTileXSize = MIN(poOutput->nTileXSize, nXSize - nTileXOff);
+			unsigned short *panWindow = (unsigned short *)panStrip + (size_t)(y0 - nYOff) * nXSize + nTileXOff;
+			GDALRasterBand *poBand = poOutput->apoTiles[(size_t)r * poOutput->nTileCols + t]->GetRasterBand( 1 );
+			if(poBand->RasterIO(GF_Write, 0, y0 - nTileYOff, nTileXSize, y1 - y0, panWindow, nTileXSize, y1 - y0,
+			                    GDT_UInt16, 0, (GSpacing)nXSize * sizeof(unsigned short)) != CE_None){
+				fprintf(stderr,"Failed to write rows %d to %d to %s\n", y0, y1,
+				        poOutput->aosTileNames[(size_t)r * poOutput->nTileCols + t].c_str());
+				GDALExit(1);
+			}
+			if(poBand->GetOverviewCount() > 0){
+				writeOverviews(poBand, panWindow, nXSize, nTileXSize, nTileYSize, y0 - nTileYOff, y1 - y0,
+				               *panOverview);
+			}
+		}
+	}
+}
+
+/************************************************************************/
+/*                           writeOverviews()                           */
+/*                                                                      */
+/*      Write the lines of every overview that sample this strip.       */
+/*      Overview pixels take the source pixel at the center of the      */
+/*      cells they cover, a nearest neighbour that never mixes classes, */
+/*      so the overviews are made in the same pass as the bivariate.    */
+/*      The strip's lines are nLineSpace pixels apart, wider than the   */
+/*      band when it is one of a VRT's tile files.                      */
+/************************************************************************/
+
+// source column or line of overview column or line i
+static inline int overviewSource(int i, double dfRatio, int nSize)
+{
+	int s = (int)((i + 0.5) * dfRatio);
+	return s < nSize ? s : nSize - 1;
+}
+
+static void writeOverviews(GDALRasterBand *poBand, const unsigned short *panStrip, int nLineSpace, int nXSize,
+                           int nYSize, int nYOff, int nLines, std::vector<unsigned short> &anOverview)
+{
+	for(int k = 0; k < poBand->GetOverviewCount(); k++){
+		GDALRasterBand *poOverview = poBand->GetOverview(k);
+		int nOvXSize = poOverview->GetXSize();
+		int nOvYSize = poOverview->GetYSize();
+		double dfXRatio = (double)nXSize / nOvXSize;
+		double dfYRatio = (double)nYSize / nOvYSize;
+		int oy0 = (int)(nYOff / dfYRatio) - 1;
+		if(oy0 < 0) oy0 = 0;
+		while(oy0 < nOvYSize && overviewSource(oy0, dfYRatio, nYSize) < nYOff) oy0++;
+		int oy1 = oy0;
+		while(oy1 < nOvYSize && overviewSource(oy1, dfYRatio, nYSize) < nYOff + nLines) oy1++;
+		if(oy1 == oy0) continue;
+
+		anOverview.resize((size_t)nOvXSize * (oy1 - oy0));
+		for(int oy = oy0; oy < oy1; oy++){
+			const unsigned short *panLine = panStrip + (size_t)(overviewSource(oy, dfYRatio, nYSize) - nYOff) * nLineSpace;
+			unsigned short *panOut = &anOverview[(size_t)(oy - oy0) * nOvXSize];
+			for(int ox = 0; ox < nOvXSize; ox++){
+				panOut[ox] = panLine[overviewSource(ox, dfXRatio, nXSize)];
+			}
+		}
+		if(poOverview->RasterIO(GF_Write, 0, oy0, nOvXSize, oy1 - oy0, &anOverview[0], nOvXSize, oy1 - oy0,
+		                        GDT_UInt16, 0, 0) != CE_None){
+			fprintf(stderr,"Failed to write overview lines %d to %d\n", oy0, oy1);
+			GDALExit(1);
+		}
+	}
+}
+
+/************************************************************************/
+/*                              makeCOG()                               */
+/*                                                                      */
+/*      COPY_SRC_OVERVIEWS puts the overviews ahead of the full         */
+/*      resolution tiles, the cloud optimized layout, and works back    */
+/*      to GDAL 2, well before the COG driver.                          */
+/************************************************************************/
+
+static int makeCOG(GDALDriver *poDriver, GDALDataset *poSrc, const char *pszName, char **papszOptions, int verbose)
+{
+	char **papszCOG = CSLDuplicate(papszOptions);
+	papszCOG = CSLSetNameValue(papszCOG, "COPY_SRC_OVERVIEWS", "YES");
+	verbose && fprintf(stderr,"Copying to %s in the cloud optimized layout\n",pszName);
+	GDALDataset *poCOG = poDriver->CreateCopy(pszName, poSrc, FALSE, papszCOG, verbose ? GDALTermProgress : NULL, NULL);
+	CSLDestroy(papszCOG);
+	if(poCOG == NULL){
+		fprintf(stderr,"Failed to write %s\n",pszName);
+		return FALSE;
+	}
+	GDALClose((GDALDatasetH) poCOG);
+	return TRUE;
+}
+
+/************************************************************************/
+/*                             setBigTIFF()                             */
+/*                                                                      */
+/*      GDAL's own BIGTIFF=IF_NEEDED only goes by the size of an        */
+/*      uncompressed file, so a compressed CONUS bivariate would be     */
+/*      started as a classic TIFF and fail at 4GB. Go by the            */
+/*      uncompressed size, overviews and all, unless -co BIGTIFF says.  */
+/************************************************************************/
+
+static char **setBigTIFF(char **papszOptions, int nXSize, int nYSize, GDALDataType eType, int bOverviews,
+                         int verbose)
+{
+	if(CSLFetchNameValue(papszOptions, "BIGTIFF") != NULL) return papszOptions;
+	double dfBytes = (double)nXSize * nYSize * (GDALGetDataTypeSize(eType) / 8);
+	if(bOverviews) dfBytes *= 4.0 / 3.0;
+	if(dfBytes < CCAP_BIGTIFF_BYTES) return papszOptions;
+	verbose && fprintf(stderr,"%.1fGB uncompressed, writing BigTIFF\n", dfBytes / 1e9);
+	return CSLSetNameValue(papszOptions, "BIGTIFF", "YES");
+}
+
+/************************************************************************/
+/*                            tileFileName()                            */
+/*                                                                      */
+/*      bivar.vrt has its tile files beside it, bivar_r2_c3.tif for     */
+/*      the one in row 2, column 3, counting from 0.                    */
+/************************************************************************/
+
+static std::string tileFileName(const std::string &osName, int nRow, int nCol)
+{
+	std::string osPath = CPLGetPath(osName.c_str());
+	std::string osBase = CPLGetBasename(osName.c_str());
+	osBase += CPLSPrintf("_r%d_c%d", nRow, nCol);
+	return CPLFormFilename(osPath.c_str(), osBase.c_str(), "tif");
+}
+
+/************************************************************************/
+/*                          setGeoreference()                           */
+/*                                                                      */
+/*      The later epoch's georeferencing, with the origin moved to      */
+/*      pixel nXOff, nYOff of it for a tile file.                       */
+/************************************************************************/
+
+static void setGeoreference(GDALDataset *poBivariate, GDALDataset *poEndCCAP, int nXOff, int nYOff, int bWarn)
+{
+	double adfGeoTransform[6];
+	if(poEndCCAP->GetGeoTransform( adfGeoTransform ) == CE_None){
+		adfGeoTransform[0] += nXOff * adfGeoTransform[1] + nYOff * adfGeoTransform[2];
+		adfGeoTransform[3] += nXOff * adfGeoTransform[4] + nYOff * adfGeoTransform[5];
+		poBivariate->SetGeoTransform(adfGeoTransform);
+	}else if(bWarn){
+		fprintf(stderr,"Warning: End date C-CAP file missing georeferencing\n");
+	}
+
+	poBivariate->SetProjection(poEndCCAP->GetProjectionRef());
+}
+
+/************************************************************************/
+/*                           addTileSources()                           */
+/*                                                                      */
+/*      Each tile file becomes a simple source of the VRT's band. They  */
+/*      go in through the new_vrt_sources metadata, which needs no more */
+/*      than the public GDAL API, and GDAL writes their names relative  */
+/*      to the VRT when it is closed.                                   */
+/************************************************************************/
+
+static void addTileSources(GDALDataset *poVRT, const BivarOutput *poOutput)
+{
+	GDALRasterBand *poBand = poVRT->GetRasterBand( 1 );
+	int nXSize = poVRT->GetRasterXSize();
+	int nYSize = poVRT->GetRasterYSize();
+	for(int r = 0; r < poOutput->nTileRows; r++){
+		for(int t = 0; t < poOutput->nTileCols; t++){
+			int nTile = r * poOutput->nTileCols + t;
+			int nXOff = t * poOutput->nTileXSize;
+			int nYOff = r * poOutput->nTileYSize;
+			int nTileXSize = MIN(poOutput->nTileXSize, nXSize - nXOff);
+			int nTileYSize = MIN(poOutput->nTileYSize, nYSize - nYOff);
+			char *pszName = CPLEscapeString(poOutput->aosTileNames[nTile].c_str(), -1, CPLES_XML);
+			std::string osSource = CPLSPrintf("<SimpleSource><SourceFilename>%s</SourceFilename>"
+			                                  "<SourceBand>1</SourceBand>", pszName);
+			osSource += CPLSPrintf("<SrcRect xOff=\"0\" yOff=\"0\" xSize=\"%d\" ySize=\"%d\"/>"
+			                       "<DstRect xOff=\"%d\" yOff=\"%d\" xSize=\"%d\" ySize=\"%d\"/></SimpleSource>",
+			                       nTileXSize, nTileYSize, nXOff, nYOff, nTileXSize, nTileYSize);
+			CPLFree(pszName);
+			poBand->SetMetadataItem(CPLSPrintf("source_%d", nTile), osSource.c_str(), "new_vrt_sources");
+		}
+	}
+}
+
+/************************************************************************/
+/*                             loadColors()                             */
+/*                                                                      */
+/*      The colors and RAT from -c or -b, read once for all the         */
+/*      outputs. The caller deletes them; either may be NULL. They are  */
+/*      cut to the nValues bivariates of the scheme, so a small         */
+/*      scheme's Byte band doesn't get C-CAP's 626 entries, and a       */
+/*      sample's RAT loses any code columns, which -L puts back.        */
+/************************************************************************/
+
+static void loadColors(const char *psColorTable, const char *psRATBivarName, int nValues, int verbose,
+                       GDALColorTable **ppoColorTable, GDALRasterAttributeTable **ppoRAT)
+{
+	*ppoColorTable = NULL;
+	*ppoRAT = NULL;
 	if(psColorTable){
 		verbose && fprintf(stderr,"Assembling colortable from file %s\n",psColorTable);
-		GDALDefaultRasterAttributeTable *poRAT = NULL;
-		poRAT = new GDALDefaultRasterAttributeTable();
-		poColorTable = makeColorTable(psColorTable);
-			if(poColorTable != NULL){
+		GDALColorTable *poColorTable = makeColorTable(psColorTable);
+		if(poColorTable != NULL){
+			GDALDefaultRasterAttributeTable *poRAT = new GDALDefaultRasterAttributeTable();
 			poRAT->InitializeFromColorTable(poColorTable);
-			// add fields for histogram
-			poRAT->CreateColumn("Histogram", GFT_Integer, GFU_PixelCount);
-			poBandOut->SetColorTable(poColorTable);
-			poBandOut->SetDefaultRAT(poRAT);
+			// add fields for histogram. Real, since counts can pass 2^31
+			poRAT->CreateColumn("Histogram", GFT_Real, GFU_PixelCount);
+			*ppoColorTable = poColorTable;
+			*ppoRAT = poRAT;
 		}else{
 			fprintf(stderr, "Failed to make the color table from file!\n");
-			delete poRAT;
-			poRAT = NULL;
 		}
 	}else if(psRATBivarName){
 		verbose && fprintf(stderr,"Assembling RAT from sample file %s\n",psRATBivarName);
@@ -237,106 +1074,418 @@ int main(int argc, char **argv)
 			fprintf(stderr,"Failed to open %s to copy the Raster Attribute Table\n",psRATBivarName);
 			GDALExit(1);
 		}
-		GDALRasterAttributeTable *poRAT = poRATBivar->GetRasterBand(1)->GetDefaultRAT();
-		poBandOut->SetDefaultRAT(poRAT);
-		poColorTable = poRATBivar->GetRasterBand(1)->GetColorTable();
-		if(poColorTable == NULL){
+		GDALRasterBand *poSample = poRATBivar->GetRasterBand(1);
+		// a -L output's rows and colors are its codes', not bivariate values
+		CCAPBivariateLUT sSampleLUT;
+		if(CCAPGetBivariateLUT(poSample, &sSampleLUT)){
+			fprintf(stderr,"%s is coded with -L, use one written without -L as the sample\n",psRATBivarName);
+			GDALExit(1);
+		}
+		if(poSample->GetDefaultRAT() != NULL) *ppoRAT = CCAPCopyRATWithoutLUT(poSample->GetDefaultRAT());
+		if(poSample->GetColorTable() == NULL){
 			fprintf(stderr,"Sample bivariate missing color table ????\n");
 		}else{
-			poBandOut->SetColorInterpretation(GCI_PaletteIndex);
-			poBandOut->SetColorTable(poColorTable);
-			printColorTable(poColorTable);
+			*ppoColorTable = poSample->GetColorTable()->Clone();
+			printColorTable(*ppoColorTable);
 		}
-		
+		GDALClose((GDALDatasetH) poRATBivar);
 	}else{
 		fprintf(stderr,"No info for RAT or colormap. Gonna be a sad looking file\n");
 	}
 
-	// allocate space for the histogram.
-	GUIntBig *anHistogram = (GUIntBig *)CPLMalloc(sizeof(GUIntBig) * (CCAP_CLASSES * CCAP_CLASSES + 1));
-	for (int i = 0; i < CCAP_CLASSES * CCAP_CLASSES; i++){ anHistogram[i] = 0;}
+	if(*ppoColorTable != NULL && (*ppoColorTable)->GetColorEntryCount() > nValues){
+		GDALColorTable *poColorTable = new GDALColorTable();
+		for(int i = 0; i < nValues; i++){
+			poColorTable->SetColorEntry(i, (*ppoColorTable)->GetColorEntry(i));
+		}
+		delete *ppoColorTable;
+		*ppoColorTable = poColorTable;
+	}
+	if(*ppoRAT != NULL && (*ppoRAT)->GetRowCount() > nValues) (*ppoRAT)->SetRowCount(nValues);
+}
 
-	// loop over all the rows and output the bivariate.
-	// bivariate value = total_classes * (date1_class -1) + date2_class
-	// if either date entry is zero, the answer is zero.
-	for(int y = 0; y < nYSize; y++){
-		if(poBandStart->RasterIO( GF_Read, 0, y, nXSize, 1, pasScanlineStart, nXSize, 1, GDT_Byte, 0, 0 ) != CE_None){
-			fprintf(stderr,"Failed to read the start date data for row %d\n",y);
-			GDALExit(1);
+/************************************************************************/
+/*                             setColors()                              */
+/*                                                                      */
+/*      The same colors and RAT on every output; the band copies them.  */
+/************************************************************************/
+
+static void setColors(GDALRasterBand *poBandOut, GDALColorTable *poColorTable, GDALRasterAttributeTable *poRAT)
+{
+	if(poRAT != NULL) poBandOut->SetDefaultRAT(poRAT);
+	if(poColorTable != NULL){
+		poBandOut->SetColorInterpretation(GCI_PaletteIndex);
+		poBandOut->SetColorTable(poColorTable);
+	}
+}
+
+/************************************************************************/
+/*                         pipelineStripLines()                         */
+/*                                                                      */
+/*      Lines per strip: the tallest block of the bands, doubled up     */
+/*      to at least 16 lines, then halved until all the buffers, and    */
+/*      nExtraLineBytes a line of anything else sized by the strip, fit */
+/*      in nMaxBytes.                                                   */
+/************************************************************************/
+
+static int pipelineStripLines(GDALRasterBand **papoBands, int nBands, size_t nLineBytes, int nBuffers,
+                              size_t nExtraLineBytes, size_t nMaxBytes)
+{
+	int nStripLines = 1;
+	for(int i = 0; i < nBands; i++){
+		int nBlockXSize, nBlockYSize;
+		papoBands[i]->GetBlockSize(&nBlockXSize, &nBlockYSize);
+		nStripLines = nBlockYSize > nStripLines ? nBlockYSize : nStripLines;
+	}
+	while(nStripLines < 16) nStripLines *= 2;
+
+	double dfLineBytes = (double)nLineBytes * nBuffers + nExtraLineBytes;
+	while(nStripLines > 1 && dfLineBytes * nStripLines > nMaxBytes){
+		nStripLines /= 2;
+	}
+	return nStripLines;
+}
+
+/************************************************************************/
+/*                            runPipeline()                             */
+/*                                                                      */
+/*      Run the bivariates through a pipeline of strips, each a whole   */
+/*      number of block rows. Reader threads prefetch the strip of      */
+/*      every epoch, worker threads combine each pair and this thread   */
+/*      writes the results in order, with writer threads for the other  */
+/*      columns of a .vrt's tile files, so reading, combining and       */
+/*      writing all overlap. Each epoch is read once however many pairs */
+/*      it is in. With no bivariates to write only the histograms are   */
+/*      made.                                                           */
+/************************************************************************/
+
+static void runPipeline(BivarPipeline *poPipe, const std::vector<GDALRasterBand *> &apoEpochBands,
+                        const std::vector<BivarOutput> &aoOutputs, int nThreads, GIntBig nMemLimit,
+                        int verbose)
+{
+	int nReaders = nThreads > 2 ? 2 : 1;
+	int nBuffers = nReaders + nThreads + 2;
+	int nEpochs = (int)apoEpochBands.size();
+	int nOutputs = (int)aoOutputs.size();
+	int nXSize = poPipe->nXSize;
+
+	std::vector<GDALRasterBand *> apoBands(apoEpochBands);
+	for(int j = 0; j < nOutputs; j++){
+		apoBands.push_back(aoOutputs[j].apoTiles[0]->GetRasterBand( 1 ));
+	}
+
+	poPipe->bWrite = nOutputs > 0;
+	// the strip buffers are one pool; the block cache gets the rest of any limit
+	size_t nPipelineBytes = CCAPMemBudget(nMemLimit, 0, 1, CCAP_MAX_PIPELINE_BYTES, verbose);
+	// each epoch's bytes and a UInt16 output per pair being written
+	size_t nLineBytes = (size_t)nXSize * (nEpochs + sizeof(unsigned short) * nOutputs);
+	// with nothing to write each combine thread has its own UInt16 scratch strip instead
+	size_t nScratchLineBytes = nOutputs == 0 ? (size_t)nXSize * sizeof(unsigned short) * nThreads : 0;
+	poPipe->nStripLines = pipelineStripLines(&apoBands[0], (int)apoBands.size(), nLineBytes, nBuffers,
+	                                         nScratchLineBytes, nPipelineBytes);
+	poPipe->nStrips = (poPipe->nYSize + poPipe->nStripLines - 1) / poPipe->nStripLines;
+	poPipe->nStripPixels = (size_t)nXSize * poPipe->nStripLines;
+	poPipe->nNextStrip = 0;
+	poPipe->nReadersLeft = nReaders;
+	CCAPQueue<BivarStrip *> oFree(nBuffers);
+	CCAPQueue<BivarStrip *> oRead(nBuffers);
+	poPipe->poFree = &oFree;
+	poPipe->poRead = &oRead;
+
+	verbose && fprintf(stderr,"%d epochs, %d pairs, %d strips of %d lines, %d readers, %d combine threads (%s)\n",
+	                   nEpochs, (int)poPipe->aoPairs.size(), poPipe->nStrips, poPipe->nStripLines, nReaders, nThreads,
+	                   CCAPCombineKernelName());
+
+	std::vector<BivarStrip> aoStrips(nBuffers);
+	for(int i = 0; i < nBuffers; i++){
+		aoStrips[i].pabyEpochs = (unsigned char *)CPLMalloc(poPipe->nStripPixels * nEpochs);
+		aoStrips[i].panOut = nOutputs == 0 ? NULL :
+		                     (unsigned short *)CPLMalloc(sizeof(unsigned short) * poPipe->nStripPixels * nOutputs);
+		oFree.push(&aoStrips[i]);
+	}
+
+	/*
+	* A strip crossing a row of a VRT's tile files is written to up to
+	* nThreads of them at once, each writer taking every nThreads'th
+	* column, as they are separate files. This thread writes the first
+	* columns and the writer threads the rest.
+	*/
+	int nWriters = 1;
+	for(int j = 0; j < nOutputs; j++){
+		nWriters = MAX(nWriters, MIN(nThreads, aoOutputs[j].nTileCols));
+	}
+	CCAPQueue<BivarColumns> oColumns(nOutputs * nWriters + 1);
+	poPipe->poColumns = &oColumns;
+	poPipe->nColumnsLeft = 0;
+
+	std::vector<std::thread> aoThreads;
+	for(int i = 0; i < nReaders; i++){
+		aoThreads.push_back(std::thread(readerThread, poPipe));
+	}
+	for(int i = 0; i < nThreads; i++){
+		aoThreads.push_back(std::thread(combineThread, poPipe));
+	}
+	std::vector<std::thread> aoWriters;
+	for(int i = 1; i < nWriters; i++){
+		aoWriters.push_back(std::thread(writerThread, poPipe));
+	}
+
+	// the writer: take finished strips in order and hand the buffers back
+	std::vector<unsigned short> anOverview;
+	for(int nStrip = 0; nStrip < poPipe->nStrips; nStrip++){
+		BivarStrip *poStrip;
+		{
+			std::unique_lock<std::mutex> oLock(poPipe->oMutex);
+			poPipe->oDoneCond.wait(oLock, [&]{ return poPipe->oDone.count(nStrip) > 0; });
+			poStrip = poPipe->oDone[nStrip];
+			poPipe->oDone.erase(nStrip);
 		}
-		if(poBandEnd->RasterIO( GF_Read, 0, y, nXSize, 1, pasScanlineEnd, nXSize, 1, GDT_Byte, 0, 0 ) != CE_None){
-			fprintf(stderr,"Failed to read the end date data for row %d\n",y);
-			GDALExit(1);
+		for(int j = 0; j < nOutputs; j++){
+			BivarColumns sColumns;
+			sColumns.poOutput = &aoOutputs[j];
+			sColumns.panStrip = poStrip->panOut + j * poPipe->nStripPixels;
+			sColumns.nYOff = poStrip->nYOff;
+			sColumns.nLines = poStrip->nLines;
+			sColumns.nColStep = MIN(nWriters, aoOutputs[j].nTileCols);
+			{
+				std::lock_guard<std::mutex> oLock(poPipe->oMutex);
+				poPipe->nColumnsLeft += sColumns.nColStep - 1;
+			}
+			for(sColumns.nFirstCol = 1; sColumns.nFirstCol < sColumns.nColStep; sColumns.nFirstCol++){
+				oColumns.push(sColumns);
+			}
+			writeTiles(&aoOutputs[j], sColumns.panStrip, nXSize, poPipe->nYSize, poStrip->nYOff, poStrip->nLines,
+			           0, sColumns.nColStep, &anOverview);
 		}
-		// data read in. Now handle each pixel.
-		for(int x = 0; x < nXSize; x++){
-			unsigned short spix = pasScanlineStart[x];
-			unsigned short epix = pasScanlineEnd[x];
-			unsigned short nclass;
-			nclass = spix && epix ? nclass = CCAP_CLASSES * (spix - 1) + (epix) : 0;
-			pasScanlineOut[x] = nclass;
-			// if(nclass <= CCAP_CLASSES * CCAP_CLASSES)  anHistogram[nclass]++;
+		{
+			std::unique_lock<std::mutex> oLock(poPipe->oMutex);
+			poPipe->oColumnsCond.wait(oLock, [&]{ return poPipe->nColumnsLeft == 0; });
 		}
+		oFree.push(poStrip);
+	}
+	oColumns.finish();
+	for(size_t t = 0; t < aoWriters.size(); t++){
+		aoWriters[t].join();
+	}
+	for(size_t t = 0; t < aoThreads.size(); t++){
+		aoThreads[t].join();
+	}
+	for(int i = 0; i < nBuffers; i++){
+		CPLFree(aoStrips[i].pabyEpochs);
+		CPLFree(aoStrips[i].panOut);
+	}
+}
 
-		// write out the new line
-		if(poBandOut->RasterIO(GF_Write, 0,y,nXSize,1,pasScanlineOut,nXSize,1,GDT_UInt16, 0, 0) != CE_None){
-			fprintf(stderr,"Failed to write row %d to output\n",y);
+/************************************************************************/
+/*                            readerThread()                            */
+/*                                                                      */
+/*      Take a free buffer, claim the next strip and read the lines of  */
+/*      every epoch into it. Each reader has its own datasets since     */
+/*      GDAL band objects are not thread safe. A buffer is taken before */
+/*      the strip number so the strip the writer needs next always has  */
+/*      one.                                                            */
+/************************************************************************/
+
+static void readerThread(BivarPipeline *poPipe)
+{
+	int nEpochs = (int)poPipe->apszEpochNames.size();
+	std::vector<GDALDataset *> apoEpochs(nEpochs);
+	for(int e = 0; e < nEpochs; e++){
+		apoEpochs[e] = (GDALDataset *)GDALOpen( poPipe->apszEpochNames[e], GA_ReadOnly );
+		if(apoEpochs[e] == NULL){
+			fprintf(stderr,"Failed to reopen the C-CAP files for reading\n");
 			GDALExit(1);
 		}
 	}
 
-	// compute the histogram
-	int nBuckets = CCAP_CLASSES * CCAP_CLASSES + 1;
-	double dfMin = -0.5; // first bucket is from -0.5 to 0.5, so center on zero
-	double dfMax = CCAP_CLASSES * CCAP_CLASSES + 0.5;
-	poBandOut->GetHistogram(dfMin, dfMax, nBuckets, anHistogram, 0, 0, GDALDummyProgress, NULL);
+	BivarStrip *poStrip;
+	while(poPipe->poFree->pop(poStrip)){
+		{
+			std::lock_guard<std::mutex> oLock(poPipe->oMutex);
+			poStrip->nStrip = poPipe->nNextStrip < poPipe->nStrips ? poPipe->nNextStrip++ : -1;
+		}
+		if(poStrip->nStrip < 0){
+			poPipe->poFree->push(poStrip);
+			break;
+		}
+		poStrip->nYOff = poStrip->nStrip * poPipe->nStripLines;
+		poStrip->nLines = poPipe->nYSize - poStrip->nYOff < poPipe->nStripLines ?
+		                  poPipe->nYSize - poStrip->nYOff : poPipe->nStripLines;
 
-	// set the historgram values in the RAT. Note RAT is ints and we could overflow
-	/*if(poRAT != NULL){
-		int histcol = poRAT->GetColOfUsage(GFU_PixelCount);
-		for (int i = 0; i < CCAP_CLASSES * CCAP_CLASSES; i++){
-			//fprintf(stderr,"Histogram %d => %ld\n",i,anHistogram[i]);
-			poRAT->SetValue(i,histcol,(int)anHistogram[i]) ;
+		int nXSize = poPipe->nXSize;
+		for(int e = 0; e < nEpochs; e++){
+			if(apoEpochs[e]->GetRasterBand(1)->RasterIO( GF_Read, 0, poStrip->nYOff, nXSize, poStrip->nLines,
+			                                             poStrip->pabyEpochs + e * poPipe->nStripPixels,
+			                                             nXSize, poStrip->nLines, GDT_Byte, 0, 0 ) != CE_None){
+				fprintf(stderr,"Failed to read %s for rows %d to %d\n",poPipe->apszEpochNames[e],
+				        poStrip->nYOff, poStrip->nYOff + poStrip->nLines);
+				GDALExit(1);
+			}
+			// legend codes (NLCD's 11 to 95) to the classes they combine as
+			if(poPipe->sScheme.pabyCodes != NULL){
+				CCAPSchemeToClasses(poPipe->abyClasses, poStrip->pabyEpochs + e * poPipe->nStripPixels,
+				                    (size_t)nXSize * poStrip->nLines);
+			}
 		}
+		poPipe->poRead->push(poStrip);
+	}
 
-		poRAT->DumpReadable(NULL);
-		//if(! poRAT->ChangesAreWrittenToFile()) { poBandOut->SetDefaultRAT(poRAT); }
-	}*/
-	
-	// check the color table
-	/*GDALColorTable *poTestColor = poBandOut->GetColorTable();
-	//if (! poTestColor->IsSame(poColorTable)){
-		fprintf(stderr,"Color table comparison\n");
-		for(int i = 0; i < poTestColor->GetColorEntryCount(); i++){
-			fprintf(stderr,"%d: ", i);
-			printRGB(poTestColor->GetColorEntry(i));
-			fprintf(stderr," vs ");
-			printRGB(poColorTable->GetColorEntry(i));
-			fprintf(stderr,"\n");
-		}*/
-	//}
+	for(int e = 0; e < nEpochs; e++){
+		GDALClose((GDALDatasetH) apoEpochs[e]);
+	}
+
+	// the last reader out tells the workers nothing more is coming
+	std::lock_guard<std::mutex> oLock(poPipe->oMutex);
+	if(--poPipe->nReadersLeft == 0) poPipe->poRead->finish();
+}
 
+/************************************************************************/
+/*                           combineThread()                            */
+/*                                                                      */
+/*      Every pair of the strip, from the epochs already in memory.     */
+/*      Without outputs each pair is combined into one scratch strip    */
+/*      just long enough to be counted. With -L the values are turned   */
+/*      into the pair's codes once they are counted.                    */
+/************************************************************************/
 
-	GDALFlushCache( (GDALDatasetH)poBivariate );
+static void combineThread(BivarPipeline *poPipe)
+{
+	size_t nPairs = poPipe->aoPairs.size();
+	int nBuckets = poPipe->nBuckets;
+	std::vector<unsigned long long> anPartial(nBuckets * nPairs, 0);
+	std::vector<unsigned short> anScratch(poPipe->bWrite ? 0 : poPipe->nStripPixels);
 
-	// All done. Close properly
-	GDALClose((GDALDatasetH) poBivariate);
-	GDALClose((GDALDatasetH) poEndCCAP);
-	GDALClose((GDALDatasetH) poStartCCAP);
+	BivarStrip *poStrip;
+	while(poPipe->poRead->pop(poStrip)){
+		size_t nPixels = (size_t)poPipe->nXSize * poStrip->nLines;
+		for(size_t p = 0; p < nPairs; p++){
+			const unsigned char *pabyStart = poStrip->pabyEpochs + poPipe->aoPairs[p].first * poPipe->nStripPixels;
+			const unsigned char *pabyEnd = poStrip->pabyEpochs + poPipe->aoPairs[p].second * poPipe->nStripPixels;
+			unsigned short *panOut = poPipe->bWrite ? poStrip->panOut + p * poPipe->nStripPixels : &anScratch[0];
+			combineStrip(pabyStart, pabyEnd, panOut, nPixels, &poPipe->sScheme);
+			histogramStrip(panOut, nPixels, &anPartial[p * nBuckets], nBuckets);
+			if(!poPipe->aabyCodes.empty()){
+				CCAPEncodeBivariates(&poPipe->aabyCodes[p][0], nBuckets, panOut, nPixels);
+			}
+		}
 
+		std::lock_guard<std::mutex> oLock(poPipe->oMutex);
+		poPipe->oDone[poStrip->nStrip] = poStrip;
+		poPipe->oDoneCond.notify_all();
+	}
 
+	std::lock_guard<std::mutex> oLock(poPipe->oMutex);
+	for(size_t i = 0; i < anPartial.size(); i++){
+		poPipe->panHistogram[i] += anPartial[i];
+	}
+}
 
-	// and deallocate stuff
-	CPLFree(pasScanlineStart);
-	CPLFree(pasScanlineOut);
-	CPLFree(pasScanlineEnd);
-	CPLFree(anHistogram);
+/************************************************************************/
+/*                            writerThread()                            */
+/*                                                                      */
+/*      Write the columns of tiles handed over by the writer, with its  */
+/*      own overview buffer, until the run is over.                     */
+/************************************************************************/
 
-	GDALExit(0);
+static void writerThread(BivarPipeline *poPipe)
+{
+	std::vector<unsigned short> anOverview;
+	BivarColumns sColumns;
+	while(poPipe->poColumns->pop(sColumns)){
+		writeTiles(sColumns.poOutput, sColumns.panStrip, poPipe->nXSize, poPipe->nYSize, sColumns.nYOff,
+		           sColumns.nLines, sColumns.nFirstCol, sColumns.nColStep, &anOverview);
+		std::lock_guard<std::mutex> oLock(poPipe->oMutex);
+		if(--poPipe->nColumnsLeft == 0) poPipe->oColumnsCond.notify_all();
+	}
+}
 
+/************************************************************************/
+/*                            combineStrip()                            */
+/*                                                                      */
+/*      bivariate = total_classes * (date1_class - 1) + date2_class     */
+/*      if either date entry is zero, the answer is zero.               */
+/*      The SIMD kernel for this CPU does the work, see ccap_kernels.   */
+/*      A Byte output can't hold what a class past the scheme's last   */
+/*      gives (255 in a ccap8 file, say), so those pixels are made 0    */
+/*      and counted as the background, as the raster will have them.   */
+/************************************************************************/
+
+static void combineStrip(const unsigned char *pabyStart, const unsigned char *pabyEnd,
+                         unsigned short *panOut, size_t nPixels, const CCAPScheme *psScheme)
+{
+	int nClasses = psScheme->nClasses;
+	CCAPCombineBivariate(pabyStart, pabyEnd, panOut, nPixels, nClasses);
+	if(!CCAPSchemeByteBivariate(psScheme)) return;
+	for(size_t i = 0; i < nPixels; i++){
+		if(pabyStart[i] > nClasses || pabyEnd[i] > nClasses) panOut[i] = 0;
+	}
 }
 
-	
+/************************************************************************/
+/*                           histogramStrip()                           */
+/*                                                                      */
+/*      Count the combined values while they are still in cache.        */
+/*      Values past the last bucket (an input class over the scheme's   */
+/*      last) are left out, as GetHistogram() over -0.5 to 625.5 did    */
+/*      for C-CAP.                                                      */
+/************************************************************************/
+
+static void histogramStrip(const unsigned short *panOut, size_t nPixels, unsigned long long *panHistogram,
+                           int nBuckets)
+{
+	CCAPHistogram(panOut, nPixels, panHistogram, nBuckets - 1);
+}
+
+/************************************************************************/
+/*                          setRATHistogram()                           */
+/*                                                                      */
+/*      Put the counts in the "Histogram" column of the band's RAT.     */
+/*      RAT integers are only 32 bits and a national bivariate has      */
+/*      more pixels than that of some classes, so the column is Real,   */
+/*      which holds counts exactly up to 2^53. An existing Integer      */
+/*      Histogram column (say from a -b sample) can't change type, so   */
+/*      the table is copied with the column replaced.                   */
+/************************************************************************/
+
+static void setRATHistogram(GDALRasterBand *poBand, const GUIntBig *panHistogram, int nBuckets)
+{
+	const GDALRasterAttributeTable *poOld = poBand->GetDefaultRAT();
+	if(poOld == NULL) return;
+
+	GDALDefaultRasterAttributeTable oRAT;
+	std::vector<int> anCols; // columns of the old table carried over
+	for(int iCol = 0; iCol < poOld->GetColumnCount(); iCol++){
+		if(poOld->GetUsageOfCol(iCol) == GFU_PixelCount || EQUAL(poOld->GetNameOfCol(iCol),"Histogram")) continue;
+		oRAT.CreateColumn(poOld->GetNameOfCol(iCol), poOld->GetTypeOfCol(iCol), poOld->GetUsageOfCol(iCol));
+		anCols.push_back(iCol);
+	}
+	int nHistCol = (int)anCols.size();
+	oRAT.CreateColumn("Histogram", GFT_Real, GFU_PixelCount);
+
+	int nRows = poOld->GetRowCount() > nBuckets ? poOld->GetRowCount() : nBuckets;
+	oRAT.SetRowCount(nRows);
+	for(int iRow = 0; iRow < poOld->GetRowCount(); iRow++){
+		for(int i = 0; i < nHistCol; i++){
+			switch(poOld->GetTypeOfCol(anCols[i])){
+				case GFT_Integer:
+					oRAT.SetValue(iRow, i, poOld->GetValueAsInt(iRow, anCols[i]));
+					break;
+				case GFT_Real:
+					oRAT.SetValue(iRow, i, poOld->GetValueAsDouble(iRow, anCols[i]));
+					break;
+				default:
+					oRAT.SetValue(iRow, i, poOld->GetValueAsString(iRow, anCols[i]));
+					break;
+			}
+		}
+	}
+	for(int iRow = 0; iRow < nRows; iRow++){
+		oRAT.SetValue(iRow, nHistCol, iRow < nBuckets ? (double)panHistogram[iRow] : 0.0);
+	}
+
+	// the band keeps its own copy
+	poBand->SetDefaultRAT(&oRAT);
+}
 
 /************************************************************************/
 /*                               GDALExit()                             */
@@ -363,16 +1512,16 @@ static int GDALExit( int nCode )
   exit( nCode );
 }
 
-GDALColorTable * makeColorTable(char *psFilename)
+GDALColorTable * makeColorTable(const char *psFilename)
 {
 	FILE *fp;
 	GDALColorEntry color;
-	GDALColorTable *poColorTable = new GDALColorTable;
 	int index;
 	if((fp = fopen(psFilename,"r")) == NULL){
 		fprintf(stderr,"Failed to open colortable file %s\n",psFilename);
 		return NULL;
 	}
+	GDALColorTable *poColorTable = new GDALColorTable;
 	
 	while(fscanf(fp, "%d %hu %hu %hu",&index, &color.c1,&color.c2,&color.c3) == 4){
 		color.c4 = index ? 1 : 0; // index 0 should be transparent for CCAP bivariate.
@@ -411,10 +1560,30 @@ char **getHFAOptions()
 	 return papszOptions;
 }
 
-char **getTiffOptions()
+char **getTiffOptions(const TiffLayout *psLayout)
 {
 	char **papszOptions = NULL;
-	 papszOptions = CSLSetNameValue(papszOptions,"COMPRESS", "PACKBITS");
+	 papszOptions = CSLSetNameValue(papszOptions,"COMPRESS", psLayout->pszCompress);
+	 if(psLayout->nLevel > 0 && EQUAL(psLayout->pszCompress,"DEFLATE"))
+	 	papszOptions = CSLSetNameValue(papszOptions,"ZLEVEL", CPLSPrintf("%d",psLayout->nLevel));
+	 if(psLayout->nLevel > 0 && EQUAL(psLayout->pszCompress,"ZSTD"))
+	 	papszOptions = CSLSetNameValue(papszOptions,"ZSTD_LEVEL", CPLSPrintf("%d",psLayout->nLevel));
+	 if(psLayout->bPredictor)
+	 	papszOptions = CSLSetNameValue(papszOptions,"PREDICTOR", "2");
+	 if(psLayout->nTileSize > 0){
+	 	papszOptions = CSLSetNameValue(papszOptions,"TILED", "YES");
+	 	papszOptions = CSLSetNameValue(papszOptions,"BLOCKXSIZE", CPLSPrintf("%d",psLayout->nTileSize));
+	 	papszOptions = CSLSetNameValue(papszOptions,"BLOCKYSIZE", CPLSPrintf("%d",psLayout->nTileSize));
+	 }
+	 if(psLayout->nThreads > 1)
+	 	papszOptions = CSLSetNameValue(papszOptions,"NUM_THREADS", CPLSPrintf("%d",psLayout->nThreads));
+	 // -co last, so it can change any of the above
+	 for(int i = 0; psLayout->papszExtra != NULL && psLayout->papszExtra[i] != NULL; i++){
+	 	char *pszKey = NULL;
+	 	const char *pszValue = CPLParseNameValue(psLayout->papszExtra[i], &pszKey);
+	 	if(pszKey != NULL && pszValue != NULL) papszOptions = CSLSetNameValue(papszOptions, pszKey, pszValue);
+	 	CPLFree(pszKey);
+	 }
 
 	 return papszOptions;
 }
@@ -1,5 +1,8 @@
 #include <stdio.h>
+#include <getopt.h>
 #include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
 #include "gdal.h"
 #include "gdal_priv.h"
 #include "gdal_alg.h"
@@ -10,9 +13,101 @@
 #include "ogr_api.h"
 //#include "commonutils.h"
 #include <vector>
-#include <map>
+#include <thread>
+#include <mutex>
+#include "ccap_queue.h"
+#include "ccap_rasterize.h"
+#include "ccap_zones.h"
+#include "ccap_kernels.h"
+#include "ccap_order.h"
+#include "ccap_mem.h"
+#include "ccap_map.h"
+#include "ccap_spancache.h"
+#include "ccap_table.h"
+#include "ccap_features.h"
+#include "ccap_levels.h"
+#include "ccap_scheme.h"
+#include "ccap_lut.h"
 
-#define CCAP_CLASSES 625
+/*
+* The class scheme from -S. Tables have a cell per bivariate value of
+* it, and with -p the single date pixels are combined by it.
+*/
+static CCAPScheme sScheme;
+static int nBivariateMax;
+static unsigned char abyClasses[256]; // single date pixel value to class, for coded legends
+
+/* largest strip of raster read at once, unless a memory limit makes it smaller */
+#define CCAP_MAX_STRIP_BYTES (64*1024*1024)
+static size_t nMaxStripBytes = CCAP_MAX_STRIP_BYTES;
+
+/* long options; -m is also --mem-limit */
+static struct option aoLongOptions[] = {
+	{ "mem-limit", required_argument, NULL, 'm' },
+	{ NULL, 0, NULL, 0 }
+};
+
+/* features handed to a worker at once when they are sorted by location */
+#define CCAP_GROUP_FEATURES 16
+
+/*
+* Raster read counts, to compare block aligned window reads against
+* the one RasterIO per scanline they replace.
+*/
+typedef struct {
+	GIntBig nReads;      // RasterIO calls
+	GIntBig nBlocks;     // blocks covered by those calls
+	GIntBig nLineBlocks; // blocks a read per scanline would have covered
+	GIntBig nCacheHits;  // blocks already in the GDAL block cache (with -v)
+	GIntBig nMapped;     // strips counted in place from a file mapping instead
+} ReadStats;
+
+/* look up every block in the block cache before reading it, for -v */
+static int bCacheStats = 0;
+
+/* -e: weight pixels by the share of them inside the feature; tables are then in CCAP_COVER_SCALE units */
+static int bCoverage = 0;
+
+/*
+* One feature handed to a worker. table is the feature's entry in the
+* table map; the worker adds its private counts into it when done. When
+* the features are sorted only nFID is kept until the feature is read
+* again to be processed.
+*/
+typedef struct {
+	OGRFeature *poFeature;
+	GIntBig nFID;
+	const char *featureVal;
+	unsigned long long *table;
+} FeatureJob;
+
+/* features close together on the raster, done by one worker so they share its cached blocks */
+typedef std::vector<FeatureJob> FeatureGroup;
+
+/*
+* Per thread state. GDAL band objects are not thread safe, so every
+* worker has its own dataset handles, scanline and counters. With -p the
+* end date rasters are in papoEndDS, otherwise it is NULL.
+*/
+struct FeatureWorker {
+	int nRasters;
+	GDALDataset **papoDS;
+	GDALRasterBand **papoBand;
+	GDALDataset **papoEndDS;
+	GDALRasterBand **papoEndBand;
+	const CCAPMappedBand *pasMaps; // shared by all the workers
+	const CCAPBivariateLUT *pasLUTs; // shared too, nCodes 0 for uncoded rasters
+	CCAPSpanCache *paoCaches;      // shared too, NULL without -c
+	std::vector<unsigned short> anWindow;
+	char **papszTO;
+	ReadStats sStats;
+	CCAPRasterizer oRasterizer;
+	std::vector<CCAPSpan> aoSpans;
+	std::vector<unsigned long long> anCounts;
+};
+
+/* features waiting for a worker, bounded so only a few geometries are in memory */
+typedef CCAPQueue<FeatureGroup> FeatureQueue;
 
 
 static void
@@ -20,16 +115,64 @@ TransformCutlineToSource( GDALDataset * poDS, OGRFeature *poCutline,
 													OGRGeometry ** ppoMultiPolygon,
                            char **papszTO_In );
 static int GDALExit( int nCode );
+static void featureSpans( GDALDataset *poDS, OGRFeature *poFeature, char **papszTO, CCAPSpanCache *poCache,
+                          CCAPRasterizer &oRasterizer, std::vector<CCAPSpan> &aoSpans );
+static void featureEnvelope( GDALDataset *poDS, OGRFeature *poFeature, char **papszTO, CCAPSpanCache *poCache,
+                             CCAPEnvelope *psEnvelope );
+static int stripLines( GDALRasterBand *poBand );
+static int cachedBlocks( GDALRasterBand *poBand, int xmin, int xmax, int y0, int y1 );
+static int readStrip( GDALRasterBand *poBand, GDALRasterBand *poEndBand, const CCAPMappedBand *psMap,
+                      const CCAPBivariateLUT *psLUT,
+                      int xmin, int xmax, int y0, int y1, std::vector<unsigned short> &anStrip,
+                      const unsigned short **ppasStrip, int *pnXOff, size_t *pnStride,
+                      ReadStats *psStats );
+static int tabulateSpans( GDALRasterBand *poBand, GDALRasterBand *poEndBand, const CCAPMappedBand *psMap,
+                          const CCAPBivariateLUT *psLUT,
+                          const std::vector<CCAPSpan> &aoSpans,
+                          std::vector<unsigned short> &anWindow, unsigned long long *table,
+                          ReadStats *psStats );
+static int tabulateZones( GDALRasterBand *poBand, GDALRasterBand *poEndBand, const CCAPMappedBand *psMap,
+                          const CCAPBivariateLUT *psLUT,
+                          const CCAPZoneIndex &oZones,
+                          unsigned long long **papanTables, ReadStats *psStats, int verbose );
+static void processFeature( FeatureWorker *poWorker, const FeatureJob &oJob );
+static void processGroup( FeatureWorker *poWorker, const FeatureGroup &oGroup );
+static void featureWorkerThread( FeatureWorker *poWorker, FeatureQueue *poQueue );
+static std::string levelTableName( const char *pszTable, const char *pszLevel );
+static int writeTable( FILE *fp, CCAPFeatureTables &oTables, int nFormat, int year1, int year2,
+                       const char *pszLevel, int verbose );
 
 void usage(char *name){
 	fprintf(stderr,"%s - calculate table from bivariate CCAP file\n",name);
-	fprintf(stderr,"USAGE: %s -1 year1 -2 year2 -s shapefile -f fieldname [-t table] bivariate_file\n",name);
+	fprintf(stderr,"USAGE: %s -1 year1 -2 year2 -s shapefile -f fieldname [-t table] [-z] [-j threads] [-o order] [-m size] [-c cachedir] [-F format] [-e] [-S scheme] bivariate_file\n",name);
+	fprintf(stderr,"   or: %s -p -1 year1 -2 year2 -s shapefile -f fieldname [-t table] [-z] [-j threads] [-o order] [-m size] [-c cachedir] [-F format] [-e] [-S scheme] start_ccap end_ccap\n",name);
 	fprintf(stderr,"\tyear1 = early year of the bivariate file (eg 1996)\n");
 	fprintf(stderr,"\tyear2 = late year of the bivariate file (eg 2010)\n");
 	fprintf(stderr,"\tshapefile = vector file of features to tabulate by (eg counties)\n");
 	fprintf(stderr,"\tfieldname = field name in the vector attributes to outut for each feature (eg FIPS)\n");
+	fprintf(stderr,"\t            More, comma separated, also report the coarser geographies the features\n");
+	fprintf(stderr,"\t            nest in, summed from the first without reading the raster again.\n");
+	fprintf(stderr,"\t            FIELD:N uses the first N characters, so GEOID,GEOID:11,GEOID:5 on\n");
+	fprintf(stderr,"\t            block groups gives tracts and counties too. Each goes in a table named\n");
+	fprintf(stderr,"\t            after -t, eg out_GEOID_5.csv\n");
 	fprintf(stderr,"\ttable = output file for table [stdout]");
+	fprintf(stderr,"\t-z = zone mode: burn all features into a zone index, then read the raster once\n");
+	fprintf(stderr,"\tthreads = number of features to tabulate at once, without -z [1]\n");
+	fprintf(stderr,"\torder = order to tabulate features in, without -z: layer, zorder, hilbert\n");
+	fprintf(stderr,"\t        or str (groups of nearby features along a Hilbert curve) [str]\n");
+	fprintf(stderr,"\tsize = -m or --mem-limit, memory to stay under, eg 4G or 512M [no limit]\n");
+	fprintf(stderr,"\t       uncompressed files are read through the block cache then, not mapped\n");
+	fprintf(stderr,"\tcachedir = directory to keep the pixels each feature covers in, so later runs\n");
+	fprintf(stderr,"\t           on the same grid and shapefile skip the polygon work\n");
+	fprintf(stderr,"\tformat = table format: csv, or binary for a compact columnar file that\n");
+	fprintf(stderr,"\t         ccap_tbl2csv turns back into CSV [csv]\n");
+	fprintf(stderr,"\t-e = exact coverage: count the share of each pixel inside a feature instead of\n");
+	fprintf(stderr,"\t     whole pixels whose centers are inside; Pixels then has decimals\n");
+	fprintf(stderr,"\tscheme = -S, class scheme of the rasters: %s, or the number of classes [ccap]\n",
+	        CCAPSchemeNames());
 	fprintf(stderr,"\tbivariate_file = C-CAP bivariate file to analyze\n");
+	fprintf(stderr,"\t-p = inputs are pairs of single date C-CAP files; the bivariate is computed\n");
+	fprintf(stderr,"\t     as they are read and never written out\n");
 
 }
 int main(int argc, char **argv)
@@ -41,13 +184,22 @@ int main(int argc, char **argv)
 	int year1 = 0, year2 = 0;
 	char *shpname = NULL;
 	char *fieldname = NULL;
+	char *cachedir = NULL;
+	char *tablename = NULL;
 	FILE *tfp = stdout;
+	int nTableFormat = CCAP_TABLE_CSV;
 	int verbose = 0;
+	int zonemode = 0;
+	int pairmode = 0;
+	int nThreads = 1;
+	int nOrder = CCAP_ORDER_STR;
+	GIntBig nMemLimit = 0;
+	const char *pszScheme = "ccap";
 	GDALDataset *poVDS; // vector data set.
 	OGRDataSourceH hSrcDS; // vector data set.
 	char                **papszTO = NULL; /* options in OPTION=VALUE format, probably not used */
 	
-  std::map <char *, unsigned long long *> tablemap;
+  std::vector<FILE *> apoLevelFiles;
 
 
 	extern int optind;
@@ -57,8 +209,15 @@ int main(int argc, char **argv)
 	GDALAllRegister();
 	OGRRegisterAll();
 
-	while((c = getopt(argc,argv,"1:2:t:s:vf:h")) != -1){
+	while((c = getopt_long(argc,argv,"1:2:t:s:vf:hzj:po:m:c:F:eS:",aoLongOptions,NULL)) != -1){
 		switch(c){
+			case 'm':
+				if((nMemLimit = CCAPParseMemSize(optarg)) < 0){
+					fprintf(stderr,"Bad memory limit %s\n",optarg);
+					usage(argv[0]);
+					return 1;
+				}
+				break;
 			case '1':
 				year1 = atoi(optarg);
 				break;
@@ -69,8 +228,11 @@ int main(int argc, char **argv)
 				shpname = optarg;
 				break;
 			case 't':
-				if((tfp = fopen(optarg,"w")) == NULL){
-					fprintf(stderr,"Failed to open '%s' for output\n",optarg);
+				tablename = optarg;
+				break;
+			case 'F':
+				if((nTableFormat = CCAPTableFormatFromName(optarg)) < 0){
+					fprintf(stderr,"Unknown table format %s\n",optarg);
 					usage(argv[0]);
 					return 1;
 				}
@@ -81,6 +243,32 @@ int main(int argc, char **argv)
 			case 'v':
 				verbose++;
 				break;
+			case 'z':
+				zonemode = 1;
+				break;
+			case 'p':
+				pairmode = 1;
+				break;
+			case 'e':
+				bCoverage = 1;
+				break;
+			case 'S':
+				pszScheme = optarg;
+				break;
+			case 'j':
+				nThreads = atoi(optarg);
+				if(nThreads < 1) nThreads = 1;
+				break;
+			case 'c':
+				cachedir = optarg;
+				break;
+			case 'o':
+				if((nOrder = CCAPOrderFromName(optarg)) < 0){
+					fprintf(stderr,"Unknown feature order %s\n",optarg);
+					usage(argv[0]);
+					return 1;
+				}
+				break;
 			case 'h':
 				usage(argv[0]);
 				return 0;
@@ -97,6 +285,11 @@ int main(int argc, char **argv)
 		usage(argv[0]);
 		return 1;
 	}
+	if(pairmode && (argc - optind) % 2 != 0){
+		fprintf(stderr,"With -p the C-CAP files must come in start/end pairs\n");
+		usage(argv[0]);
+		return 1;
+	}
 	if(!year1 || !year2){
 		fprintf(stderr,"C'mon man, read the help. You've got to give me the start and end years\n");
 		usage(argv[0]);
@@ -107,6 +300,26 @@ int main(int argc, char **argv)
 		usage(argv[0]);
 		return 1;
 	}
+	if(!CCAPSchemeFromName(pszScheme, &sScheme)){
+		usage(argv[0]);
+		return 1;
+	}
+	nBivariateMax = CCAPSchemeBivariateMax(&sScheme);
+	CCAPSchemeClassTable(&sScheme, abyClasses);
+
+  // one table per feature value, so every feature with the same value (the parts of
+  // a county stored as separate features, say) adds into one, as gdalwarp -cwhere did.
+  // Coarser levels from -f are summed from those tables at the end.
+  CCAPLevels oLevels(CCAPSchemeCells(&sScheme));
+	if(!oLevels.parse(fieldname)){
+		usage(argv[0]);
+		return 1;
+	}
+	if(oLevels.count() > 1 && tablename == NULL){
+		fprintf(stderr,"Several levels need -t, the tables for the coarser ones are named after it\n");
+		usage(argv[0]);
+		return 1;
+	}
 	if(shpname == NULL){
 		fprintf(stderr,"Missing the shapefile\n");
 		usage(argv[0]);
@@ -133,28 +346,70 @@ int main(int argc, char **argv)
 		}
 	}
 
-	// print the table header
-	// Dump the table
-	fprintf(tfp,"Year1, Year2, FeatureID, classID, Pixels\n");
+	if(tablename != NULL && (tfp = fopen(tablename,"w")) == NULL){
+		fprintf(stderr,"Failed to open '%s' for output\n",tablename);
+		usage(argv[0]);
+		return 1;
+	}
+	for(i = 1; i < oLevels.count(); i++){
+		std::string osName = levelTableName(tablename, oLevels.name(i));
+		FILE *fp = fopen(osName.c_str(),"w");
+		if(fp == NULL){
+			fprintf(stderr,"Failed to open '%s' for the %s table\n",osName.c_str(),oLevels.name(i));
+			return 1;
+		}
+		apoLevelFiles.push_back(fp);
+	}
+	if(nTableFormat == CCAP_TABLE_BINARY && tfp == stdout && isatty(fileno(stdout))){
+		fprintf(stderr,"Not writing a binary table to a terminal, give -t table\n");
+		return 1;
+	}
 
-	// open all the raster datasets after allocating some space for them
-	int nrasters = argc-optind;
+	// open all the raster datasets after allocating some space for them.
+	// With -p each "raster" is a start date file plus an end date file.
+	int nstep = pairmode ? 2 : 1;
+	int nrasters = (argc-optind) / nstep;
 	GDALDataset ** poDataset = (GDALDataset **)CPLMalloc(sizeof(GDALDataset *) * nrasters);
 	GDALRasterBand ** poBand = (GDALRasterBand **)CPLMalloc(sizeof(GDALRasterBand *) * nrasters);
+	GDALDataset ** poEndDataset = (GDALDataset **)CPLCalloc(sizeof(GDALDataset *), nrasters);
+	GDALRasterBand ** poEndBand = (GDALRasterBand **)CPLCalloc(sizeof(GDALRasterBand *), nrasters);
+	char **papszRasterNames = NULL; // names of the rasters that opened, for the workers
+	char **papszEndNames = NULL;
 	int *nXSize = (int *)CPLMalloc(sizeof(int) * nrasters);
 	int *nYSize = (int *)CPLMalloc(sizeof(int) * nrasters);
+	CCAPMappedBand *pasMaps = (CCAPMappedBand *)CPLCalloc(sizeof(CCAPMappedBand), nrasters);
+	CCAPBivariateLUT *pasLUTs = (CCAPBivariateLUT *)CPLCalloc(sizeof(CCAPBivariateLUT), nrasters);
 
 	double        adfGeoTransform[6];
-	int maxX = 0;
-	for(i = 0, j=optind; i < nrasters; i++, j++){
+	for(i = 0, j=optind; i < nrasters; i++, j += nstep){
 		poDataset[i] = (GDALDataset *)GDALOpen( argv[j], GA_ReadOnly );
 		if( poDataset[i] == NULL ){
 	  	fprintf(stderr,"Failed to open file %s .. skipping\n", argv[j]);
 	  	i--;
 	  	nrasters--;
 	  	continue;
+	  }
+	  if(pairmode){
+	  	poEndDataset[i] = (GDALDataset *)GDALOpen( argv[j+1], GA_ReadOnly );
+	  	if( poEndDataset[i] == NULL
+	  	    || poEndDataset[i]->GetRasterXSize() != poDataset[i]->GetRasterXSize()
+	  	    || poEndDataset[i]->GetRasterYSize() != poDataset[i]->GetRasterYSize() ){
+	  		fprintf(stderr,"Failed to open %s or it is not the same size as %s .. skipping the pair\n",
+	  		        argv[j+1], argv[j]);
+	  		if(poEndDataset[i] != NULL) GDALClose((GDALDatasetH)poEndDataset[i]);
+	  		GDALClose((GDALDatasetH)poDataset[i]);
+	  		poEndDataset[i] = NULL;
+	  		i--;
+	  		nrasters--;
+	  		continue;
+	  	}
+	  	fprintf(stderr,"Working on files %s and %s\n",argv[j],argv[j+1]);
+	  	papszRasterNames = CSLAddString(papszRasterNames, argv[j]);
+	  	papszEndNames = CSLAddString(papszEndNames, argv[j+1]);
+	  	poEndBand[i] = poEndDataset[i]->GetRasterBand( 1 );
 	  }else{
 	  	fprintf(stderr,"Working on file %s\n",argv[j]);
+	  	papszRasterNames = CSLAddString(papszRasterNames, argv[j]);
 	  }
 
 	  if(verbose){
@@ -181,21 +436,48 @@ int main(int argc, char **argv)
     }
 
     poBand[i] = poDataset[i]->GetRasterBand( 1 );
+    // uncompressed bivariates are counted straight from the file's pages, but mapped
+    // pages count in the RSS, so under -m they go through the budgeted block cache
+    if(!pairmode && nMemLimit <= 0) CCAPMapBand(poBand[i], &pasMaps[i], verbose);
+    // Byte bivariates from ccap2bivar -L are decoded as they are read
+    if(!pairmode && CCAPGetBivariateLUT(poBand[i], &pasLUTs[i])){
+    	verbose && fprintf(stderr,"\tDecoding %d transitions from the RAT\n",pasLUTs[i].nCodes - 1);
+    }
     nXSize[i] =  poBand[i]->GetXSize();
   	nYSize[i] = poBand[i]->GetYSize();
-  	maxX = nXSize[i] > maxX ? nXSize[i] : maxX; 
   }
 
-  // space for the scanline
-	unsigned short *pasScanline;
-	pasScanline = (unsigned short *)CPLMalloc(sizeof(unsigned short)*maxX);
-
 
 	// open the vector layer and run through the features
 	// for each feature, we'll pull out the chuncks of raster needed
 	OGRLayer *poLayer;
 
 	poLayer = (OGRLayer *)OGR_DS_GetLayer(hSrcDS,0); // Get the first (only) layer
+	if(!oLevels.resolve(poLayer->GetLayerDefn())) return 1;
+
+	/*
+	* Fit the strip windows (one per worker, two with -p for the date
+	* bytes) and the block cache under any memory limit, counting a table
+	* and a sort entry for every feature.
+	*/
+	GIntBig nFeatures = poLayer->GetFeatureCount(FALSE);
+	GIntBig nFeatureBytes = nFeatures > 0 ? nFeatures * (CCAPSchemeCells(&sScheme) * sizeof(unsigned long long)
+	                                        + sizeof(FeatureJob) + sizeof(CCAPEnvelope)) : 0;
+	nMaxStripBytes = CCAPMemBudget(nMemLimit, nFeatureBytes, (zonemode ? 1 : nThreads) * (pairmode ? 2 : 1),
+	                               CCAP_MAX_STRIP_BYTES, verbose);
+
+	// feature spans saved by earlier runs on the same grids
+	CCAPSpanCache *paoCaches = NULL;
+	if(cachedir != NULL){
+		paoCaches = new CCAPSpanCache[nrasters];
+		for(i = 0; i < nrasters; i++){
+			if(!paoCaches[i].open(cachedir, shpname, poDataset[i], papszTO, bCoverage, verbose)){
+				delete[] paoCaches;
+				paoCaches = NULL;
+				break;
+			}
+		}
+	}
 
 
 	
@@ -204,117 +486,215 @@ int main(int argc, char **argv)
 	*/
 	
 	OGRFeature *poFeature;
-	OGRGeometry *poMultiPolygon;
-	OGREnvelope sEnvelope;
-	OGRPoint pPoint;
-	poLayer->ResetReading();
-	while((poFeature = poLayer->GetNextFeature()) != NULL){
-		/* get the value of our attibute, probably the county id or some such */
-		OGRFeatureDefn *poFDefn = poLayer->GetLayerDefn();
-		int iField = poFeature->GetFieldIndex(fieldname);
-		if(iField == -1){
-			fprintf(stderr,"Failed to find field %s\n",fieldname);
-			return 1;
+	CCAPRasterizer oRasterizer;
+	std::vector<CCAPSpan> aoSpans;
+	ReadStats sStats;
+	memset(&sStats, 0, sizeof(ReadStats));
+	bCacheStats = verbose;
+
+	if(zonemode){
+		/*
+		* Burn every feature into a zone index for each raster, then stream
+		* that raster once top to bottom counting into the zone's table.
+		* The raster is read once no matter how many features there are.
+		*/
+		std::vector<unsigned long long *> apanZoneTables;
+		CCAPZoneIndex oZones;
+		for(i = 0; i < nrasters; i++){
+			fprintf(stderr,"\tBuilding zone index for raster #%d\n",i);
+			oZones.clear();
+			int nZone = 0;
+			poLayer->ResetReading();
+			while((poFeature = poLayer->GetNextFeature()) != NULL){
+				const char *featureVal;
+				unsigned long long *table = oLevels.find(poFeature, &featureVal);
+				if(table == NULL){
+					OGRFeature::DestroyFeature(poFeature);
+					continue;
+				}
+				if(i == 0) apanZoneTables.push_back(table);
+				featureSpans(poDataset[i], poFeature, papszTO, paoCaches ? &paoCaches[i] : NULL, oRasterizer, aoSpans);
+				oZones.addSpans(nZone++, aoSpans);
+				OGRFeature::DestroyFeature(poFeature);
+			}
+			oZones.finish();
+			fprintf(stderr,"\t%d features burned as %lu spans\n",nZone,(unsigned long)oZones.size());
+			if(nZone && tabulateZones(poBand[i], poEndBand[i], &pasMaps[i], &pasLUTs[i], oZones, &apanZoneTables[0], &sStats, verbose) != 0){
+				GDALExit(1);
+			}
+		}
+	}else{
+		/*
+		* Set up the workers. The first one uses the datasets already open,
+		* the others open their own handles on the same files.
+		*/
+		std::vector<FeatureWorker> aoWorkers(nThreads);
+		for(int t = 0; t < nThreads; t++){
+			FeatureWorker &oWorker = aoWorkers[t];
+			oWorker.nRasters = nrasters;
+			oWorker.papszTO = papszTO;
+			oWorker.pasMaps = pasMaps;
+			oWorker.pasLUTs = pasLUTs;
+			oWorker.paoCaches = paoCaches;
+			oWorker.papoDS = (GDALDataset **)CPLMalloc(sizeof(GDALDataset *) * nrasters);
+			oWorker.papoBand = (GDALRasterBand **)CPLMalloc(sizeof(GDALRasterBand *) * nrasters);
+			oWorker.papoEndDS = (GDALDataset **)CPLCalloc(sizeof(GDALDataset *), nrasters);
+			oWorker.papoEndBand = (GDALRasterBand **)CPLCalloc(sizeof(GDALRasterBand *), nrasters);
+			memset(&oWorker.sStats, 0, sizeof(ReadStats));
+			for(i = 0; i < nrasters; i++){
+				oWorker.papoDS[i] = t == 0 ? poDataset[i] : (GDALDataset *)GDALOpen( papszRasterNames[i], GA_ReadOnly );
+				if(oWorker.papoDS[i] == NULL){
+					fprintf(stderr,"Failed to open file %s for thread %d\n",papszRasterNames[i],t);
+					GDALExit(1);
+				}
+				oWorker.papoBand[i] = oWorker.papoDS[i]->GetRasterBand( 1 );
+				if(!pairmode) continue;
+				oWorker.papoEndDS[i] = t == 0 ? poEndDataset[i] : (GDALDataset *)GDALOpen( papszEndNames[i], GA_ReadOnly );
+				if(oWorker.papoEndDS[i] == NULL){
+					fprintf(stderr,"Failed to open file %s for thread %d\n",papszEndNames[i],t);
+					GDALExit(1);
+				}
+				oWorker.papoEndBand[i] = oWorker.papoEndDS[i]->GetRasterBand( 1 );
+			}
 		}
-    const char *featureVal = (const char *)poFeature->GetFieldAsString(iField);
 
-    fprintf(stderr,"working on feature with field val %s\n",featureVal);
+		FeatureQueue oQueue(2 * nThreads);
+		std::vector<std::thread> aoThreads;
+		for(int t = 0; nThreads > 1 && t < nThreads; t++){
+			aoThreads.push_back(std::thread(featureWorkerThread, &aoWorkers[t], &oQueue));
+		}
 
-    unsigned long long *table = NULL;
-    if((table = tablemap.find(featureVal)) == tablemap.end()){
-      // not in the map yet
-      table = (unsigned long long *)calloc(sizeof(unsigned long long)*(CCAP_CLASSES+1), sizeof(unsigned long long));
-      tablemap(featureVal) = table;
-    }
-    /*
-		* To Do:
-		* For each raster:
-		*   Transform the feature such that it is in pixel/line coordinates
-		*   pull out subsets of the raster line by line that are in the feature
-		*   Test each point to see if in polygon. Operate on those that are
-		*/
-    for(i = 0; i < nrasters; i++){
-
-	    // read the band line by line
-
-	    /* -------------------------------------------------------------------- */
-			/*      If we have a cutline, transform it into the source              */
-			/*      pixel/line coordinate system and insert into warp options.      */
-			/*      This gives a WKT version of the feature in the papszWarpOptions */
-			/*      under the CUTLINE field                                         */
-			/* -------------------------------------------------------------------- */
-      fprintf(stderr,"\tTransforming for raster #%d\n",i);
-      TransformCutlineToSource( poDataset[i], poFeature,
-      													&poMultiPolygon, 
-                               
-                                papszTO );
-      
-
-      /*****************
-      /* options:
-      /* 1) make an image mask of the cut area with GDALWarpCutlineMasker
-      /* 2) extract area needed and then cut???
-      */
-	   
-      poMultiPolygon->getEnvelope(&sEnvelope);
-      int cMaxX = (int)ceil(sEnvelope.MaxX);
-      int fMinX = (int)floor(sEnvelope.MinX);
-      int cMaxY = (int)ceil(sEnvelope.MaxY);
-      int fMinY = (int)floor(sEnvelope.MinY);
-
-
-	    int x,y; // index for pixels
-	    int ystart = fMinY > 0 ? fMinY : 0;
-	    int yend = cMaxY >= nYSize[i] ? nYSize[i] : cMaxY + 1 ;
-	    int xmin = fMinX > 0 ? fMinX : 0;
-	    int xmax = cMaxX >= nXSize[i] ? nXSize[i] : cMaxX +1 ;
-	    int xwidth = xmax - xmin;
-	    fprintf(stderr,"\tStarting chunk from line %d to %d width %d\n",ystart,yend, xwidth);
-	    for(y = ystart; y < yend; y++){
-	    	//fprintf(stderr,"\t\tworking on line %d\n",y);
-	    	
-	    	poBand[i]->RasterIO( GF_Read, xmin, y, xwidth, 1, 
-	                          pasScanline, xwidth, 1, GDT_UInt16, 
-	                          0, 0 );
-	    	
-	    	// now we have a line of data. Run through it and split into pieces
-	    	
-	    	for(x = 0; x < xwidth; x++){
-	    		pPoint.setX(x+xmin+.5);
-	    		pPoint.setY(y+.5);
-
-	    		if(pPoint.Within(poMultiPolygon) && pasScanline[x] > 0 && pasScanline[x] <= CCAP_CLASSES){
-	    			table[pasScanline[x]]++;
-	    		}
-
-	    		
-	    	}
-	    	
-
-	    }
+		if(nOrder != CCAP_ORDER_LAYER && !poLayer->TestCapability(OLCRandomRead)){
+			fprintf(stderr,"Layer can't read features by FID, tabulating them in layer order\n");
+			nOrder = CCAP_ORDER_LAYER;
 		}
+		// no raster opened, so there is none to sort by; the table just comes out empty
+		if(nrasters == 0) nOrder = CCAP_ORDER_LAYER;
+
+		if(nOrder == CCAP_ORDER_LAYER){
+			poLayer->ResetReading();
+			while((poFeature = poLayer->GetNextFeature()) != NULL){
+				/* get the value of our attibute, probably the county id or some such */
+				FeatureGroup oGroup(1);
+				FeatureJob &oJob = oGroup[0];
+				oJob.poFeature = poFeature;
+				oJob.nFID = poFeature->GetFID();
+				oJob.table = oLevels.find(poFeature, &oJob.featureVal);
+				if(oJob.table == NULL){
+					OGRFeature::DestroyFeature(poFeature);
+					continue;
+				}
 
-/*
-		// have finished a feature, can dump it out
-		for(i = 0; i <= CCAP_CLASSES; i++){
-      if(table[i] > 0){
-        fprintf(tfp,"%d, %d, %s, %d, %llu\n",year1, year2, featureVal, i, table[i]);
-        table[i] = 0; // clear for the next feature
-      }
+				if(nThreads > 1){
+					oQueue.push(oGroup);
+				}else{
+					processGroup(&aoWorkers[0], oGroup);
+				}
+			}
+		}else{
+			/*
+			* Find where every feature lands on the first raster, then read
+			* them again in an order that walks the raster instead of jumping
+			* around it, so the blocks one feature needs are mostly still
+			* cached from the last. The tables are made in this first pass so
+			* the output stays in layer order.
+			*/
+			std::vector<FeatureJob> aoJobs;
+			std::vector<CCAPEnvelope> aoEnvelopes;
+			poLayer->ResetReading();
+			while((poFeature = poLayer->GetNextFeature()) != NULL){
+				FeatureJob oJob;
+				oJob.poFeature = NULL;
+				oJob.nFID = poFeature->GetFID();
+				oJob.table = oLevels.find(poFeature, &oJob.featureVal);
+				if(oJob.table != NULL){
+					CCAPEnvelope sEnvelope;
+					featureEnvelope(poDataset[0], poFeature, papszTO, paoCaches, &sEnvelope);
+					aoJobs.push_back(oJob);
+					aoEnvelopes.push_back(sEnvelope);
+				}
+				OGRFeature::DestroyFeature(poFeature);
+			}
+
+			int nBlockXSize, nBlockYSize;
+			std::vector<int> anOrder;
+			std::vector<size_t> anGroups;
+			poBand[0]->GetBlockSize(&nBlockXSize, &nBlockYSize);
+			CCAPOrderEnvelopes(aoEnvelopes, nOrder, nBlockXSize, nBlockYSize, CCAP_GROUP_FEATURES,
+			                   anOrder, anGroups);
+			verbose && fprintf(stderr,"%lu features in %lu groups, %s order\n",(unsigned long)aoJobs.size(),
+			                   (unsigned long)anGroups.size() - 1, CCAPOrderName(nOrder));
+
+			for(size_t g = 0; g + 1 < anGroups.size(); g++){
+				FeatureGroup oGroup;
+				for(size_t k = anGroups[g]; k < anGroups[g+1]; k++){
+					FeatureJob oJob = aoJobs[anOrder[k]];
+					if((oJob.poFeature = poLayer->GetFeature(oJob.nFID)) == NULL){
+						fprintf(stderr,"Failed to read feature %lld again\n",(long long)oJob.nFID);
+						GDALExit(1);
+					}
+					oGroup.push_back(oJob);
+				}
+				if(nThreads > 1){
+					oQueue.push(oGroup);
+				}else{
+					processGroup(&aoWorkers[0], oGroup);
+				}
+			}
+		}
+		oQueue.finish();
+		for(size_t t = 0; t < aoThreads.size(); t++){
+			aoThreads[t].join();
+		}
+
+		for(int t = 0; t < nThreads; t++){
+			for(i = 0; t > 0 && i < nrasters; i++){
+				GDALClose((GDALDatasetH)aoWorkers[t].papoDS[i]);
+				if(aoWorkers[t].papoEndDS[i] != NULL) GDALClose((GDALDatasetH)aoWorkers[t].papoEndDS[i]);
+			}
+			sStats.nReads += aoWorkers[t].sStats.nReads;
+			sStats.nBlocks += aoWorkers[t].sStats.nBlocks;
+			sStats.nLineBlocks += aoWorkers[t].sStats.nLineBlocks;
+			sStats.nCacheHits += aoWorkers[t].sStats.nCacheHits;
+			sStats.nMapped += aoWorkers[t].sStats.nMapped;
+			CPLFree(aoWorkers[t].papoDS);
+			CPLFree(aoWorkers[t].papoBand);
+			CPLFree(aoWorkers[t].papoEndDS);
+			CPLFree(aoWorkers[t].papoEndBand);
 		}
-  */
 	}
 
-  // Done with all features. Can dump the data
-  for( map<char *,unsigned long long>::iterator ii=tablemap.begin(); ii!=tablemap.end(); ++ii) {
-    unsigned long long *table = (*ii).second;
-		for(i = 0; i <= CCAP_CLASSES; i++){
-      if(table[i] > 0){
-        fprintf(tfp,"%d, %d, %s, %d, %llu\n",year1, year2, (*ii).first, i, table[i]);
-      }
+	if(verbose){
+		fprintf(stderr,"%lld raster reads covering %lld blocks",sStats.nReads,sStats.nBlocks);
+		if(!zonemode) fprintf(stderr," (%lld blocks reading a line at a time)",sStats.nLineBlocks);
+		fprintf(stderr,"\n");
+		fprintf(stderr,"%lld of those blocks were already in the block cache (%.1f%% hit rate, cache is %lld MB)\n",
+		        sStats.nCacheHits, sStats.nBlocks ? 100.0 * sStats.nCacheHits / sStats.nBlocks : 0.0,
+		        GDALGetCacheMax64() / (1024*1024));
+		if(sStats.nMapped) fprintf(stderr,"%lld strips counted in place from mapped files\n",sStats.nMapped);
+	}
+
+	if(paoCaches != NULL){
+		for(i = 0; i < nrasters; i++){
+			verbose && fprintf(stderr,"Raster #%d: %lld span lookups answered from the cache, %lld worked out\n",
+			                   i, paoCaches[i].hits(), paoCaches[i].misses());
+			paoCaches[i].save(verbose);
 		}
-    free(table);
+		delete[] paoCaches;
+	}
 
+  // Done with all features. Can dump the data
+  // in the order the features were read so threaded runs match serial ones
+  if(writeTable(tfp, oLevels.tables(0), nTableFormat, year1, year2, oLevels.name(0), verbose) != 0) GDALExit(1);
+  if(tfp != stdout) fclose(tfp);
+
+  // then the coarser levels, from the finest tables
+  oLevels.aggregate(verbose);
+  for(i = 1; i < oLevels.count(); i++){
+    if(writeTable(apoLevelFiles[i-1], oLevels.tables(i), nTableFormat, year1, year2, oLevels.name(i), verbose) != 0){
+      GDALExit(1);
+    }
+    fclose(apoLevelFiles[i-1]);
   }
 
 
@@ -323,21 +703,452 @@ int main(int argc, char **argv)
 
 	// Don't forget to close things and free space
   for(i = 0; i < nrasters; i++){
+  	CCAPUnmapBand(&pasMaps[i]);
   	GDALClose((GDALDatasetH)poDataset[i]);
+  	if(poEndDataset[i] != NULL) GDALClose((GDALDatasetH)poEndDataset[i]);
   	//poDataset[i]->GDALClose(); // GDAL 2.0 version
   }
   CPLFree(poDataset);
-  CPLFree(pasScanline);
   CPLFree(poBand);
+  CPLFree(poEndDataset);
+  CPLFree(poEndBand);
+  CSLDestroy(papszRasterNames);
+  CSLDestroy(papszEndNames);
   CPLFree(nXSize);
   CPLFree(nYSize);
-  free(table);
+  CPLFree(pasMaps);
+  CPLFree(pasLUTs);
+
+	if(verbose || nMemLimit > 0) CCAPReportPeakRSS(nMemLimit);
 
 	
 	
 	
 
 
+}
+
+/************************************************************************/
+/*                           levelTableName()                           */
+/*                                                                      */
+/*      The table for a coarser level is named after the main one, so   */
+/*      -t out.csv with GEOID,GEOID:5 also writes out_GEOID_5.csv.      */
+/************************************************************************/
+
+static std::string levelTableName( const char *pszTable, const char *pszLevel )
+{
+	std::string osLevel = pszLevel;
+	for(size_t k = 0; k < osLevel.size(); k++){
+		if(!isalnum((unsigned char)osLevel[k])) osLevel[k] = '_';
+	}
+	std::string osPath = CPLGetPath(pszTable);
+	std::string osBase = CPLGetBasename(pszTable);
+	std::string osExtension = CPLGetExtension(pszTable);
+	osBase += "_" + osLevel;
+	return CPLFormFilename(osPath.c_str(), osBase.c_str(), osExtension.empty() ? NULL : osExtension.c_str());
+}
+
+/************************************************************************/
+/*                             writeTable()                             */
+/************************************************************************/
+
+static int writeTable( FILE *fp, CCAPFeatureTables &oTables, int nFormat, int year1, int year2,
+                       const char *pszLevel, int verbose )
+{
+	CCAPTableWriter oTable(fp, nFormat, year1, year2, CCAPSchemeCells(&sScheme), bCoverage ? CCAP_COVER_SCALE : 1);
+	for(size_t f = 0; f < oTables.size(); f++){
+		oTable.write(oTables.id(f), oTables.row(f));
+	}
+	if(!oTable.close()){
+		fprintf(stderr,"Error writing the %s table\n",pszLevel);
+		return 1;
+	}
+	verbose && fprintf(stderr,"%llu table rows for %d %s values\n",oTable.rows(),(int)oTables.size(),pszLevel);
+	return 0;
+}
+
+/************************************************************************/
+/*                            featureSpans()                            */
+/*                                                                      */
+/*      Transform a feature into the pixel/line space of a raster and   */
+/*      scan convert it into the spans of pixels it covers, unless the  */
+/*      span cache already has them.                                    */
+/************************************************************************/
+
+static void featureSpans( GDALDataset *poDS, OGRFeature *poFeature, char **papszTO, CCAPSpanCache *poCache,
+                          CCAPRasterizer &oRasterizer, std::vector<CCAPSpan> &aoSpans )
+{
+	OGRGeometry *poMultiPolygon = NULL;
+	GIntBig nFID = poFeature->GetFID();
+	if(nFID < 0) poCache = NULL; // nothing to find it by next time
+
+	if(poCache != NULL && poCache->get(nFID, aoSpans)) return;
+
+	aoSpans.clear();
+	if(poFeature->GetGeometryRef() != NULL){
+		TransformCutlineToSource( poDS, poFeature, &poMultiPolygon, papszTO );
+
+		oRasterizer.clear();
+		oRasterizer.addGeometry(poMultiPolygon);
+		if(bCoverage){
+			oRasterizer.getCoverage(0, 0, poDS->GetRasterXSize(), poDS->GetRasterYSize(), aoSpans);
+		}else{
+			oRasterizer.getSpans(0, 0, poDS->GetRasterXSize(), poDS->GetRasterYSize(), aoSpans);
+		}
+		delete poMultiPolygon;
+	}
+	if(poCache != NULL) poCache->put(nFID, aoSpans);
+}
+
+/************************************************************************/
+/*                           featureEnvelope()                          */
+/*                                                                      */
+/*      Bounding box of a feature in the pixel/line space of a raster.  */
+/*      Features without a geometry get an empty box at the origin.     */
+/*      With a span cache the box is that of the spans instead, which   */
+/*      are worked out (and cached) now if they aren't there yet.       */
+/************************************************************************/
+
+static void featureEnvelope( GDALDataset *poDS, OGRFeature *poFeature, char **papszTO, CCAPSpanCache *poCache,
+                             CCAPEnvelope *psEnvelope )
+{
+	OGRGeometry *poMultiPolygon = NULL;
+	OGREnvelope oEnvelope;
+
+	memset(psEnvelope, 0, sizeof(CCAPEnvelope));
+	if(poCache != NULL){
+		// only the main thread sorts, so these can be reused from feature to feature
+		static CCAPRasterizer oRasterizer;
+		static std::vector<CCAPSpan> aoSpans;
+		featureSpans(poDS, poFeature, papszTO, poCache, oRasterizer, aoSpans);
+		for(size_t s = 0; s < aoSpans.size(); s++){
+			if(s == 0 || aoSpans[s].nXStart < psEnvelope->dfXMin) psEnvelope->dfXMin = aoSpans[s].nXStart;
+			if(s == 0 || aoSpans[s].nXEnd > psEnvelope->dfXMax) psEnvelope->dfXMax = aoSpans[s].nXEnd;
+		}
+		if(!aoSpans.empty()){
+			psEnvelope->dfYMin = aoSpans.front().nLine;
+			psEnvelope->dfYMax = aoSpans.back().nLine + 1;
+		}
+		return;
+	}
+	if(poFeature->GetGeometryRef() == NULL) return;
+
+	TransformCutlineToSource( poDS, poFeature, &poMultiPolygon, papszTO );
+	poMultiPolygon->getEnvelope(&oEnvelope);
+	psEnvelope->dfXMin = oEnvelope.MinX;
+	psEnvelope->dfYMin = oEnvelope.MinY;
+	psEnvelope->dfXMax = oEnvelope.MaxX;
+	psEnvelope->dfYMax = oEnvelope.MaxY;
+	delete poMultiPolygon;
+}
+
+/************************************************************************/
+/*                             stripLines()                             */
+/*                                                                      */
+/*      Lines to read at once: one row of blocks, unless a full width   */
+/*      row of blocks gets bigger than nMaxStripBytes.                  */
+/************************************************************************/
+
+static int stripLines( GDALRasterBand *poBand )
+{
+	int nBlockXSize, nBlockYSize;
+	int nXSize = poBand->GetXSize();
+	poBand->GetBlockSize(&nBlockXSize, &nBlockYSize);
+
+	int nStripLines = nBlockYSize > 0 ? nBlockYSize : 1;
+	if((double)nStripLines * nXSize * sizeof(unsigned short) > nMaxStripBytes){
+		nStripLines = nMaxStripBytes / (nXSize * sizeof(unsigned short));
+		if(nStripLines < 1) nStripLines = 1;
+	}
+	return nStripLines;
+}
+
+/************************************************************************/
+/*                            cachedBlocks()                            */
+/*                                                                      */
+/*      How many of the blocks under a window are in the block cache    */
+/*      already, so reading it won't have to decompress them.           */
+/************************************************************************/
+
+static int cachedBlocks( GDALRasterBand *poBand, int xmin, int xmax, int y0, int y1 )
+{
+	int nBlockXSize, nBlockYSize, nCached = 0;
+	poBand->GetBlockSize(&nBlockXSize, &nBlockYSize);
+	if(nBlockXSize < 1) nBlockXSize = 1;
+	if(nBlockYSize < 1) nBlockYSize = 1;
+
+	for(int by = y0 / nBlockYSize; by <= (y1 - 1) / nBlockYSize; by++){
+		for(int bx = xmin / nBlockXSize; bx <= (xmax - 1) / nBlockXSize; bx++){
+			GDALRasterBlock *poBlock = poBand->TryGetLockedBlockRef(bx, by);
+			if(poBlock != NULL){
+				nCached++;
+				poBlock->DropLock();
+			}
+		}
+	}
+	return nCached;
+}
+
+/************************************************************************/
+/*                             readStrip()                              */
+/*                                                                      */
+/*      Read lines y0 to y1 of columns xmin to xmax, widened out to     */
+/*      whole blocks, into anStrip. *ppasStrip is set to line y0 of     */
+/*      the window, column *pnXOff, with *pnStride values per line.     */
+/*      With an end date band (-p) poBand is the start date and the     */
+/*      two are combined into bivariate values here, so no bivariate    */
+/*      file is ever needed. A mapped band isn't read at all: the       */
+/*      window points into the mapping. Coded bivariates (-L) are       */
+/*      turned back into bivariate values as they are read.             */
+/************************************************************************/
+
+static int readStrip( GDALRasterBand *poBand, GDALRasterBand *poEndBand, const CCAPMappedBand *psMap,
+                      const CCAPBivariateLUT *psLUT,
+                      int xmin, int xmax, int y0, int y1, std::vector<unsigned short> &anStrip,
+                      const unsigned short **ppasStrip, int *pnXOff, size_t *pnStride,
+                      ReadStats *psStats )
+{
+	if(psMap->psVMem != NULL){
+		*ppasStrip = CCAPMappedLine(psMap, y0);
+		*pnXOff = 0;
+		*pnStride = psMap->nLineSpace / sizeof(unsigned short);
+		psStats->nMapped++;
+		return 0;
+	}
+
+	int nBlockXSize, nBlockYSize;
+	int nXSize = poBand->GetXSize();
+	poBand->GetBlockSize(&nBlockXSize, &nBlockYSize);
+	if(nBlockXSize < 1) nBlockXSize = 1;
+	if(nBlockYSize < 1) nBlockYSize = 1;
+
+	xmin -= xmin % nBlockXSize;
+	xmax = ((xmax + nBlockXSize - 1) / nBlockXSize) * nBlockXSize;
+	if(xmax > nXSize) xmax = nXSize;
+
+	int nWidth = xmax - xmin;
+	int nLines = y1 - y0;
+	size_t nPixels = (size_t)nWidth * nLines;
+	anStrip.resize(nPixels);
+
+	if(bCacheStats){
+		psStats->nCacheHits += cachedBlocks(poBand, xmin, xmax, y0, y1);
+		if(poEndBand != NULL) psStats->nCacheHits += cachedBlocks(poEndBand, xmin, xmax, y0, y1);
+	}
+
+	if(poEndBand == NULL){
+		if(poBand->RasterIO( GF_Read, xmin, y0, nWidth, nLines,
+		                     &anStrip[0], nWidth, nLines, GDT_UInt16, 0, 0 ) != CE_None){
+			fprintf(stderr,"Failed to read lines %d to %d\n",y0,y1);
+			return 1;
+		}
+		if(psLUT->nCodes > 0) CCAPDecodeBivariates(psLUT, &anStrip[0], nPixels);
+	}else{
+		// start date bytes then end date bytes, one buffer per thread
+		static thread_local std::vector<unsigned char> abyDates;
+		abyDates.resize(2 * nPixels);
+		if(poBand->RasterIO( GF_Read, xmin, y0, nWidth, nLines,
+		                     &abyDates[0], nWidth, nLines, GDT_Byte, 0, 0 ) != CE_None
+		   || poEndBand->RasterIO( GF_Read, xmin, y0, nWidth, nLines,
+		                           &abyDates[nPixels], nWidth, nLines, GDT_Byte, 0, 0 ) != CE_None){
+			fprintf(stderr,"Failed to read lines %d to %d of the start or end date\n",y0,y1);
+			return 1;
+		}
+		if(sScheme.pabyCodes != NULL) CCAPSchemeToClasses(abyClasses, &abyDates[0], 2 * nPixels);
+		CCAPCombineBivariate(&abyDates[0], &abyDates[nPixels], &anStrip[0], nPixels, sScheme.nClasses);
+	}
+
+	int nBands = poEndBand == NULL ? 1 : 2;
+	psStats->nReads += nBands;
+	psStats->nBlocks += (GIntBig)nBands * ((xmax - 1) / nBlockXSize - xmin / nBlockXSize + 1)
+	                    * ((y1 - 1) / nBlockYSize - y0 / nBlockYSize + 1);
+	*ppasStrip = &anStrip[0];
+	*pnXOff = xmin;
+	*pnStride = nWidth;
+	return 0;
+}
+
+/************************************************************************/
+/*                           tabulateSpans()                            */
+/*                                                                      */
+/*      Count the classes under one feature's spans. The covered part   */
+/*      of each row of blocks is read in one window and the spans are   */
+/*      walked in memory, so a block is decompressed once per feature   */
+/*      rather than once per scanline.                                  */
+/************************************************************************/
+
+static int tabulateSpans( GDALRasterBand *poBand, GDALRasterBand *poEndBand, const CCAPMappedBand *psMap,
+                          const CCAPBivariateLUT *psLUT,
+                          const std::vector<CCAPSpan> &aoSpans,
+                          std::vector<unsigned short> &anWindow, unsigned long long *table,
+                          ReadStats *psStats )
+{
+	int nBlockXSize, nBlockYSize;
+	int nYSize = poBand->GetYSize();
+	int nStripLines = stripLines(poBand);
+	poBand->GetBlockSize(&nBlockXSize, &nBlockYSize);
+	if(nBlockXSize < 1) nBlockXSize = 1;
+
+	size_t s = 0;
+	while(s < aoSpans.size()){
+		int y0 = aoSpans[s].nLine - aoSpans[s].nLine % nStripLines;
+		int y1 = y0 + nStripLines < nYSize ? y0 + nStripLines : nYSize;
+
+		// x extent of the spans in this strip, and what reading them a line
+		// at a time would have cost
+		size_t sEnd = s;
+		int xmin = poBand->GetXSize(), xmax = 0;
+		while(sEnd < aoSpans.size() && aoSpans[sEnd].nLine < y1){
+			size_t sLine = sEnd;
+			while(sEnd < aoSpans.size() && aoSpans[sEnd].nLine == aoSpans[sLine].nLine) sEnd++;
+			int xfirst = aoSpans[sLine].nXStart;
+			int xlast = aoSpans[sEnd-1].nXEnd;
+			xmin = xfirst < xmin ? xfirst : xmin;
+			xmax = xlast > xmax ? xlast : xmax;
+			psStats->nLineBlocks += (poEndBand == NULL ? 1 : 2) * ((xlast - 1) / nBlockXSize - xfirst / nBlockXSize + 1);
+		}
+
+		const unsigned short *pasStrip;
+		int xoff;
+		size_t nStride;
+		if(readStrip(poBand, poEndBand, psMap, psLUT, xmin, xmax, y0, y1, anWindow,
+		             &pasStrip, &xoff, &nStride, psStats) != 0){
+			return 1;
+		}
+
+		for(; s < sEnd; s++){
+			const unsigned short *pasLine = pasStrip + (size_t)(aoSpans[s].nLine - y0) * nStride;
+			unsigned long long nWeight = bCoverage ? aoSpans[s].nCover : 1;
+			for(int x = aoSpans[s].nXStart - xoff; x < aoSpans[s].nXEnd - xoff; x++){
+				if(pasLine[x] > 0 && pasLine[x] <= nBivariateMax){
+					table[pasLine[x]] += nWeight;
+				}
+			}
+		}
+	}
+	return 0;
+}
+
+/************************************************************************/
+/*                           processFeature()                           */
+/*                                                                      */
+/*      Tabulate one feature over every raster into the worker's own    */
+/*      counters, then add them to the feature's table.                 */
+/************************************************************************/
+
+static std::mutex oTableMutex;
+
+static void processFeature( FeatureWorker *poWorker, const FeatureJob &oJob )
+{
+	poWorker->anCounts.assign(CCAPSchemeCells(&sScheme), 0);
+
+	for(int i = 0; i < poWorker->nRasters; i++){
+		fprintf(stderr,"\tTransforming for raster #%d\n",i);
+		featureSpans(poWorker->papoDS[i], oJob.poFeature, poWorker->papszTO,
+		             poWorker->paoCaches ? &poWorker->paoCaches[i] : NULL,
+		             poWorker->oRasterizer, poWorker->aoSpans);
+
+		if(poWorker->aoSpans.empty()){
+			fprintf(stderr,"\tFeature does not cover any pixel centers\n");
+			continue;
+		}
+		fprintf(stderr,"\tStarting chunk from line %d to %d, %d spans\n",
+		        poWorker->aoSpans.front().nLine, poWorker->aoSpans.back().nLine + 1,
+		        (int)poWorker->aoSpans.size());
+
+		if(tabulateSpans(poWorker->papoBand[i], poWorker->papoEndBand[i], &poWorker->pasMaps[i],
+		                 &poWorker->pasLUTs[i], poWorker->aoSpans,
+		                 poWorker->anWindow, &poWorker->anCounts[0], &poWorker->sStats) != 0){
+			GDALExit(1);
+		}
+	}
+
+	// several features can share a table, so merge under a lock
+	std::lock_guard<std::mutex> oLock(oTableMutex);
+	for(int k = 0; k <= nBivariateMax; k++){
+		oJob.table[k] += poWorker->anCounts[k];
+	}
+}
+
+/************************************************************************/
+/*                            processGroup()                            */
+/************************************************************************/
+
+static void processGroup( FeatureWorker *poWorker, const FeatureGroup &oGroup )
+{
+	for(size_t k = 0; k < oGroup.size(); k++){
+		fprintf(stderr,"working on feature with field val %s\n",oGroup[k].featureVal);
+		processFeature(poWorker, oGroup[k]);
+		OGRFeature::DestroyFeature(oGroup[k].poFeature);
+	}
+}
+
+/************************************************************************/
+/*                        featureWorkerThread()                         */
+/************************************************************************/
+
+static void featureWorkerThread( FeatureWorker *poWorker, FeatureQueue *poQueue )
+{
+	FeatureGroup oGroup;
+	while(poQueue->pop(oGroup)){
+		processGroup(poWorker, oGroup);
+	}
+}
+
+/************************************************************************/
+/*                           tabulateZones()                            */
+/*                                                                      */
+/*      Stream a raster once, a block row at a time, counting every     */
+/*      span of the zone index into its zone's table. Only the blocks   */
+/*      covered by some zone in the strip are read.                     */
+/************************************************************************/
+
+static int tabulateZones( GDALRasterBand *poBand, GDALRasterBand *poEndBand, const CCAPMappedBand *psMap,
+                          const CCAPBivariateLUT *psLUT,
+                          const CCAPZoneIndex &oZones,
+                          unsigned long long **papanTables, ReadStats *psStats, int verbose )
+{
+	int nYSize = poBand->GetYSize();
+	int nStripLines = stripLines(poBand);
+	verbose && fprintf(stderr,"\tStreaming raster in strips of %d lines\n", nStripLines);
+
+	std::vector<unsigned short> anStrip;
+	size_t s = 0;
+	while(s < oZones.size()){
+		int y0 = oZones[s].nLine - oZones[s].nLine % nStripLines;
+		int y1 = y0 + nStripLines < nYSize ? y0 + nStripLines : nYSize;
+
+		// x extent of everything in this strip
+		size_t sEnd = s;
+		int xmin = poBand->GetXSize(), xmax = 0;
+		while(sEnd < oZones.size() && oZones[sEnd].nLine < y1){
+			xmin = oZones[sEnd].nXStart < xmin ? oZones[sEnd].nXStart : xmin;
+			xmax = oZones[sEnd].nXEnd > xmax ? oZones[sEnd].nXEnd : xmax;
+			sEnd++;
+		}
+
+		const unsigned short *pasStrip;
+		int xoff;
+		size_t nStride;
+		if(readStrip(poBand, poEndBand, psMap, psLUT, xmin, xmax, y0, y1, anStrip,
+		             &pasStrip, &xoff, &nStride, psStats) != 0){
+			return 1;
+		}
+
+		for(; s < sEnd; s++){
+			const CCAPZoneSpan &oSpan = oZones[s];
+			const unsigned short *pasLine = pasStrip + (size_t)(oSpan.nLine - y0) * nStride;
+			unsigned long long *table = papanTables[oSpan.nZone];
+			unsigned long long nWeight = bCoverage ? oSpan.nCover : 1;
+			for(int x = oSpan.nXStart - xoff; x < oSpan.nXEnd - xoff; x++){
+				if(pasLine[x] > 0 && pasLine[x] <= nBivariateMax){
+					table[pasLine[x]] += nWeight;
+				}
+			}
+		}
+	}
+
+	return 0;
 }
 
 /************************************************************************/
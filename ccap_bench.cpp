@@ -0,0 +1,217 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include "ccap_kernels.h"
+
+/*
+* Micro-benchmarks for the ccap kernels. Every SIMD kernel is checked
+* bit for bit against the scalar one before it is timed, and the run
+* fails if any of them disagree.
+*/
+
+static const char *apszKernels[] = { "scalar", "sse2", "avx2", NULL };
+static const char *apszHistKernels[] = { "scalar", "multi", "sse2", "avx2", NULL };
+
+/* largest bivariate class, as in ccap_summarize */
+#define CCAP_BIVAR_MAX 625
+
+void usage(char *name){
+	fprintf(stderr,"%s - time the ccap inner loops\n",name);
+	fprintf(stderr,"USAGE: %s [-n megapixels] [-r repeats]\n",name);
+	fprintf(stderr,"\tmegapixels = pixels per timed pass, in millions [16]\n");
+	fprintf(stderr,"\trepeats = timed passes per kernel, best one is reported [5]\n");
+}
+
+static double seconds(std::chrono::steady_clock::time_point t0)
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+}
+
+/************************************************************************/
+/*                           checkCombine()                             */
+/*                                                                      */
+/*      Every start/end byte pair, against the scalar kernel.           */
+/************************************************************************/
+
+static int checkCombine(const char *pszName, CCAPCombineFunc pfnCombine)
+{
+	std::vector<unsigned char> abyStart(256*256), abyEnd(256*256);
+	std::vector<unsigned short> anExpect(256*256), anGot(256*256);
+	for(int s = 0; s < 256; s++){
+		for(int e = 0; e < 256; e++){
+			abyStart[s*256+e] = s;
+			abyEnd[s*256+e] = e;
+		}
+	}
+
+	CCAPCombineFunc pfnScalar = CCAPGetCombineKernel("scalar");
+	int anClasses[] = { 25, 8, 16, 255 };
+	for(int c = 0; c < 4; c++){
+		pfnScalar(&abyStart[0], &abyEnd[0], &anExpect[0], anExpect.size(), anClasses[c]);
+		// odd offsets and lengths exercise the unaligned loads and the tails
+		for(int nOff = 0; nOff < 3; nOff++){
+			size_t n = anGot.size() - nOff;
+			memset(&anGot[0], 0xff, anGot.size() * sizeof(unsigned short));
+			pfnCombine(&abyStart[nOff], &abyEnd[nOff], &anGot[nOff], n, anClasses[c]);
+			if(memcmp(&anGot[nOff], &anExpect[nOff], n * sizeof(unsigned short)) != 0){
+				fprintf(stderr,"combine/%s does not match scalar for %d classes\n",pszName,anClasses[c]);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/************************************************************************/
+/*                           benchCombine()                             */
+/************************************************************************/
+
+static int benchCombine(size_t nPixels, int nRepeats)
+{
+	std::vector<unsigned char> abyStart(nPixels), abyEnd(nPixels);
+	std::vector<unsigned short> anOut(nPixels);
+	srand(1);
+	for(size_t i = 0; i < nPixels; i++){
+		abyStart[i] = rand() % 26;
+		abyEnd[i] = rand() % 10 ? abyStart[i] : rand() % 26; // mostly no change, like real data
+	}
+
+	for(int k = 0; apszKernels[k] != NULL; k++){
+		CCAPCombineFunc pfnCombine = CCAPGetCombineKernel(apszKernels[k]);
+		if(pfnCombine == NULL){
+			printf("combine/%-8s not available\n",apszKernels[k]);
+			continue;
+		}
+		if(checkCombine(apszKernels[k], pfnCombine) != 0) return 1;
+
+		double dfBest = 1e30;
+		for(int r = 0; r < nRepeats; r++){
+			std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+			pfnCombine(&abyStart[0], &abyEnd[0], &anOut[0], nPixels, 25);
+			double dfTime = seconds(t0);
+			dfBest = dfTime < dfBest ? dfTime : dfBest;
+		}
+		printf("combine/%-8s %10.1f Mpix/s  bit-exact%s\n",apszKernels[k], nPixels / dfBest / 1e6,
+		       pfnCombine == CCAPGetCombineKernel(NULL) ? "  (in use)" : "");
+	}
+	return 0;
+}
+
+/************************************************************************/
+/*                            fillHistData()                            */
+/*                                                                      */
+/*      uniform: every pixel the same class, the worst case for one     */
+/*               table since every increment hits the same counter      */
+/*      random:  any value 0 to 625 plus a few out of range             */
+/*      ccap:    like a real bivariate; background zero and runs of     */
+/*               mostly unchanged classes, a few changes mixed in       */
+/************************************************************************/
+
+static void fillHistData(const char *pszDist, std::vector<unsigned short> &anData)
+{
+	size_t n = anData.size();
+	srand(2);
+	if(strcmp(pszDist, "uniform") == 0){
+		for(size_t i = 0; i < n; i++) anData[i] = 25 * 11 + 12;
+	}else if(strcmp(pszDist, "random") == 0){
+		for(size_t i = 0; i < n; i++) anData[i] = rand() % 100 ? rand() % (CCAP_BIVAR_MAX + 1) : 60000;
+	}else{
+		size_t i = 0;
+		while(i < n){
+			unsigned short nValue;
+			int nClass = 1 + rand() % 25;
+			int nRun;
+			if(rand() % 3 == 0){
+				nValue = 0; // outside the coastal zone
+				nRun = 1 + rand() % 2000;
+			}else if(rand() % 20 == 0){
+				nValue = 25 * (nClass - 1) + 1 + rand() % 25; // a change
+				nRun = 1 + rand() % 8;
+			}else{
+				nValue = 25 * (nClass - 1) + nClass; // no change
+				nRun = 1 + rand() % 60;
+			}
+			for(; nRun > 0 && i < n; nRun--) anData[i++] = nValue;
+		}
+	}
+}
+
+/************************************************************************/
+/*                          benchHistogram()                            */
+/************************************************************************/
+
+static int benchHistogram(size_t nPixels, int nRepeats)
+{
+	const char *apszDists[] = { "uniform", "random", "ccap", NULL };
+	std::vector<unsigned short> anData(nPixels);
+	std::vector<unsigned long long> anExpect(CCAP_BIVAR_MAX + 1), anGot(CCAP_BIVAR_MAX + 1);
+
+	for(int d = 0; apszDists[d] != NULL; d++){
+		fillHistData(apszDists[d], anData);
+		std::fill(anExpect.begin(), anExpect.end(), 0);
+		CCAPGetHistogramKernel("scalar")(&anData[0], nPixels, &anExpect[0], CCAP_BIVAR_MAX);
+
+		for(int k = 0; apszHistKernels[k] != NULL; k++){
+			CCAPHistogramFunc pfnHistogram = CCAPGetHistogramKernel(apszHistKernels[k]);
+			if(pfnHistogram == NULL){
+				printf("histogram/%-8s not available\n",apszHistKernels[k]);
+				continue;
+			}
+
+			double dfBest = 1e30;
+			for(int r = 0; r < nRepeats; r++){
+				std::fill(anGot.begin(), anGot.end(), 0);
+				std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+				pfnHistogram(&anData[0], nPixels, &anGot[0], CCAP_BIVAR_MAX);
+				double dfTime = seconds(t0);
+				dfBest = dfTime < dfBest ? dfTime : dfBest;
+				if(anGot != anExpect){
+					fprintf(stderr,"histogram/%s does not match scalar on %s data\n",apszHistKernels[k],apszDists[d]);
+					return 1;
+				}
+			}
+			printf("histogram/%-8s %-8s %10.1f Mpix/s  exact%s\n",apszHistKernels[k], apszDists[d],
+			       nPixels / dfBest / 1e6,
+			       pfnHistogram == CCAPGetHistogramKernel(NULL) ? "  (in use)" : "");
+		}
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	double dfMegapixels = 16;
+	int nRepeats = 5;
+
+	while((c = getopt(argc,argv,"n:r:h")) != -1){
+		switch(c){
+			case 'n':
+				dfMegapixels = atof(optarg);
+				break;
+			case 'r':
+				nRepeats = atoi(optarg);
+				break;
+			case 'h':
+				usage(argv[0]);
+				return 0;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	size_t nPixels = (size_t)(dfMegapixels * 1e6);
+	if(nPixels < 1 || nRepeats < 1){
+		usage(argv[0]);
+		return 1;
+	}
+
+	if(benchCombine(nPixels, nRepeats) != 0) return 1;
+	if(benchHistogram(nPixels, nRepeats) != 0) return 1;
+
+	return 0;
+}
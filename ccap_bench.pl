@@ -0,0 +1,220 @@
+#!/usr/bin/perl
+
+# Times the ccap tools end to end on synthetic data from ccap_synth, and
+# prints each one's rate in millions of raster pixels a second. The data
+# is made once per size, feature count and seed and kept in the data
+# directory. The last run's rates are kept there too, and each rate is
+# printed with its change from the last run, so a slowdown shows up
+# before it gets committed. Run from the directory the tools are built in
+# (make bench does).
+#
+# After the tools, ccap2bivar's GeoTIFF codecs are compared: the time to
+# write each one, the size of the file, and the time ccap_summarize takes
+# to read it back. -start and -end give real C-CAP tiles for this instead
+# of the synthetic data, and then only the codecs are compared.
+
+use strict;
+use Getopt::Long qw(:config no_ignore_case );
+use Time::HiRes qw(time);
+
+my $dir = "bench_data";
+my $size = 4096;
+my $features = 1000;
+my $seed = 1;
+my $threads = 4;
+my $repeats = 3;
+my $start = "";
+my $end = "";
+my $help = 0;
+
+GetOptions (
+	"d|dir=s" => \$dir,
+	"x|size=i" => \$size,
+	"n|features=i" => \$features,
+	"s|seed=i" => \$seed,
+	"j|threads=i" => \$threads,
+	"r|repeats=i" => \$repeats,
+	"start=s" => \$start,
+	"end=s" => \$end,
+	"h|help" => \$help,
+	);
+
+if ($help){
+	usage();
+	exit 0;
+}
+if ($size < 1 || $features < 1 || $threads < 1 || $repeats < 1){
+	usage();
+	exit 1;
+}
+if (($start eq "") != ($end eq "")){
+	print STDERR "-start and -end go together\n";
+	exit 1;
+}
+
+# GeoTIFF layouts for ccap2bivar to compare, the first as it was before tiles
+my @codecs = (
+	[ "strips PACKBITS", "-compress", "PACKBITS", "-tile", "0" ],
+	[ "LZW", "-compress", "LZW" ],
+	[ "LZW predictor", "-compress", "LZW", "-predictor" ],
+	[ "DEFLATE", "-compress", "DEFLATE" ],
+	[ "DEFLATE predictor", "-compress", "DEFLATE", "-predictor" ],
+	[ "DEFLATE 9 predictor", "-compress", "DEFLATE", "-level", "9", "-predictor" ],
+	[ "ZSTD", "-compress", "ZSTD" ],
+	[ "ZSTD predictor", "-compress", "ZSTD", "-predictor" ],
+	[ "ZSTD -j $threads", "-compress", "ZSTD", "-j", $threads ],
+	[ "DEFLATE -L", "-compress", "DEFLATE", "-L" ],
+	[ "DEFLATE -cog", "-compress", "DEFLATE", "-cog" ],
+	);
+
+if ($start ne ""){
+	mkdir($dir) if (! -d $dir);
+	compare_codecs($start, $end);
+	exit 0;
+}
+
+my $mpix = $size * $size / 1e6;
+
+# make the data, unless it is already there from the same options
+my $params = "$size $features $seed";
+mkdir($dir) if (! -d $dir);
+my $stamp = "$dir/params.txt";
+my $made = "";
+if (open(my $fh, "<", $stamp)){
+	$made = <$fh>;
+	close($fh);
+}
+if ($made ne "$params\n"){
+	unlink($stamp);
+	my $t0 = time();
+	run("./ccap_synth", "-x", $size, "-y", $size, "-n", $features, "-s", $seed, "-d", $dir);
+	open(my $fh, ">", $stamp) || die "Failed to write $stamp: $!\n";
+	print $fh "$params\n";
+	close($fh);
+	printf("ccap_synth: %dx%d, %d features in %.1f seconds\n", $size, $size, $features, time() - $t0);
+}
+
+my @tbl = ("./ccap2tbl", "-1", "1996", "-2", "2010", "-s", "$dir/features.shp", "-f", "FIPS", "-t", "$dir/out.csv");
+my @benches = (
+	[ "ccap2bivar", "./ccap2bivar", "-s", "$dir/start.tif", "-e", "$dir/end.tif", "-o", "$dir/out_bivar.tif" ],
+	[ "ccap2bivar -j $threads", "./ccap2bivar", "-j", $threads, "-s", "$dir/start.tif", "-e", "$dir/end.tif", "-o", "$dir/out_bivar.tif" ],
+	[ "ccap_summarize", "./ccap_summarize", "$dir/bivar.tif" ],
+	[ "ccap_summarize -j $threads", "./ccap_summarize", "-j", $threads, "$dir/bivar.tif" ],
+	[ "ccap2tbl", @tbl, "$dir/bivar.tif" ],
+	[ "ccap2tbl -j $threads", @tbl, "-j", $threads, "$dir/bivar.tif" ],
+	[ "ccap2tbl -z", @tbl, "-z", "$dir/bivar.tif" ],
+	[ "ccap2tbl -e", @tbl, "-e", "$dir/bivar.tif" ],
+	[ "ccap2tbl -p", @tbl, "-p", "$dir/start.tif", "$dir/end.tif" ],
+	[ "ccap2tbl -f FIPS,FIPS:2", @tbl, "-f", "FIPS,FIPS:2", "$dir/bivar.tif" ],
+	);
+
+# rates from the run before, by name
+my %last;
+my $lastfile = "$dir/last_${size}_${features}.txt";
+if (open(my $fh, "<", $lastfile)){
+	while (<$fh>){
+		chomp;
+		my ($rate, $name) = split(/\t/);
+		$last{$name} = $rate;
+	}
+	close($fh);
+}
+
+my %now;
+printf("%-28s %9s %10s\n", "", "seconds", "Mpix/s");
+for my $bench (@benches){
+	my ($name, @cmd) = @$bench;
+	my $best;
+	for (my $r = 0; $r < $repeats; $r++){
+		my $t0 = time();
+		run(@cmd);
+		my $t = time() - $t0;
+		$best = $t if (!defined $best || $t < $best);
+	}
+	my $rate = $mpix / $best;
+	$now{$name} = $rate;
+	my $change = "";
+	if (defined $last{$name} && $last{$name} > 0){
+		$change = sprintf("  %+.1f%%", 100 * ($rate - $last{$name}) / $last{$name});
+	}
+	printf("%-28s %9.2f %10.1f%s\n", $name, $best, $rate, $change);
+}
+
+open(my $fh, ">", $lastfile) || die "Failed to write $lastfile: $!\n";
+for my $name (sort keys %now){
+	printf $fh "%.3f\t%s\n", $now{$name}, $name;
+}
+close($fh);
+
+compare_codecs("$dir/start.tif", "$dir/end.tif");
+
+# times ccap2bivar writing each of @codecs, and ccap_summarize reading it
+# back, with the size of each file and its size against the first's
+sub compare_codecs {
+	my ($start, $end) = @_;
+	my $out = "$dir/out_codec.tif";
+	my $first;
+	printf("\n%-28s %9s %9s %9s %7s\n", "ccap2bivar output", "write s", "read s", "MB", "size");
+	for my $codec (@codecs){
+		my ($name, @opts) = @$codec;
+		my @cmd = ("./ccap2bivar", @opts, "-s", $start, "-e", $end, "-o", $out);
+		my ($write, $read);
+		for (my $r = 0; $r < $repeats; $r++){
+			unlink($out);
+			my $t0 = time();
+			last if (!try_run(@cmd));
+			my $t = time() - $t0;
+			$write = $t if (!defined $write || $t < $write);
+		}
+		# ZSTD, say, if this GDAL wasn't built with it
+		if (!defined $write){
+			printf("%-28s %9s\n", $name, "failed");
+			next;
+		}
+		my $bytes = -s $out;
+		for (my $r = 0; $r < $repeats; $r++){
+			my $t0 = time();
+			run("./ccap_summarize", $out);
+			my $t = time() - $t0;
+			$read = $t if (!defined $read || $t < $read);
+		}
+		$first = $bytes if (!defined $first);
+		printf("%-28s %9.2f %9.2f %9.1f %6.0f%%\n", $name, $write, $read, $bytes / 1e6, 100 * $bytes / $first);
+	}
+	unlink($out);
+}
+
+# runs a tool with its output thrown away, TRUE if it worked
+sub try_run {
+	my @cmd = @_;
+	my $pid = fork();
+	die "Failed to fork: $!\n" if (!defined $pid);
+	if ($pid == 0){
+		open(STDOUT, ">", "/dev/null");
+		open(STDERR, ">", "/dev/null");
+		exec(@cmd) || exit 127;
+	}
+	waitpid($pid, 0);
+	return $? == 0;
+}
+
+# runs a tool, and stops if it fails
+sub run {
+	my @cmd = @_;
+	try_run(@cmd) || die "@cmd failed, run it by hand to see why\n";
+}
+
+sub usage {
+	print STDERR "$0 - time the ccap tools on synthetic data\n";
+	print STDERR "USAGE: $0 [-d|-dir dir] [-x|-size size] [-n|-features features] [-s|-seed seed] [-j|-threads threads] [-r|-repeats repeats] [-start start_ccap -end end_ccap]\n";
+	print STDERR "\tdir = where the synthetic data and the last run's rates are kept [bench_data]\n";
+	print STDERR "\tsize = width and height of the synthetic rasters in pixels [4096]\n";
+	print STDERR "\tfeatures = number of polygons to tabulate by [1000]\n";
+	print STDERR "\tseed = seed for ccap_synth [1]\n";
+	print STDERR "\tthreads = threads for the -j runs [4]\n";
+	print STDERR "\trepeats = runs of each tool, the fastest is reported [3]\n";
+	print STDERR "\tstart_ccap, end_ccap = real C-CAP tiles to compare ccap2bivar's GeoTIFF codecs on, instead of timing the tools\n";
+	print STDERR "Each tool is timed on its own, start to finish, and reported in millions of raster pixels a second.\n";
+	print STDERR "The change from the last run with the same size and features is printed after the rate.\n";
+	print STDERR "Then ccap2bivar's GeoTIFF codecs are compared by write time, ccap_summarize read time and file size.\n";
+}
@@ -0,0 +1,112 @@
+#!/usr/bin/perl
+
+# Checks that ccap2tbl merges the rows of a feature. ccap_synth -u makes
+# polygons where every few share the FIPS of the one before, as a county
+# in two parts is two rows in census files, and names each row by its
+# FIPS and part. ccap2tbl by FIPS then has to give, for every county and
+# class, the sum of its rows from ccap2tbl by NAME. This is done for the
+# feature at a time, -j and -z paths. Run from the directory the tools
+# are built in (make check does).
+
+use strict;
+use Getopt::Long qw(:config no_ignore_case );
+
+my $dir = "check_data";
+my $threads = 3;
+my $help = 0;
+
+GetOptions (
+	"d|dir=s" => \$dir,
+	"j|threads=i" => \$threads,
+	"h|help" => \$help,
+	);
+
+if ($help){
+	usage();
+	exit 0;
+}
+if ($threads < 1){
+	usage();
+	exit 1;
+}
+
+run("./ccap_synth", "-x", 600, "-y", 400, "-n", 40, "-u", 3, "-s", 7, "-d", $dir);
+
+my @tbl = ("./ccap2tbl", "-1", "1996", "-2", "2010", "-s", "$dir/features.shp");
+my @modes = (
+	[ "ccap2tbl" ],
+	[ "ccap2tbl -j $threads", "-j", $threads ],
+	[ "ccap2tbl -z", "-z" ],
+	);
+
+my $failed = 0;
+for my $mode (@modes){
+	my ($name, @opts) = @$mode;
+	run(@tbl, @opts, "-f", "NAME", "-t", "$dir/rows.csv", "$dir/bivar.tif");
+	run(@tbl, @opts, "-f", "FIPS", "-t", "$dir/fips.csv", "$dir/bivar.tif");
+
+	# the rows, summed by the FIPS their names start with
+	my %want;
+	my $parts = 0;
+	for my $row (read_table("$dir/rows.csv")){
+		my ($feature, $class, $pixels) = @$row;
+		my ($fips, $part) = ($feature =~ /^(\S+) part (\d+)$/) or die "Unexpected NAME $feature in $dir/rows.csv\n";
+		$want{"$fips,$class"} += $pixels;
+		$parts = $part if ($part > $parts);
+	}
+	die "No county has more than one row, ccap_synth -u didn't work\n" if ($parts < 2);
+
+	my %got;
+	for my $row (read_table("$dir/fips.csv")){
+		my ($feature, $class, $pixels) = @$row;
+		die "$name: $feature class $class is in the table twice\n" if (exists $got{"$feature,$class"});
+		$got{"$feature,$class"} = $pixels;
+	}
+
+	my $bad = 0;
+	for my $key (sort keys %want){
+		$bad++ if (!exists $got{$key} || $got{$key} != $want{$key});
+	}
+	for my $key (keys %got){
+		$bad++ if (!exists $want{$key});
+	}
+	printf("%-24s %s\n", $name, $bad == 0 ? "ok" : "$bad counts differ from the rows' sums");
+	$failed++ if ($bad > 0);
+}
+exit($failed > 0 ? 1 : 0);
+
+# feature, class and pixels of each line of a ccap2tbl CSV table
+sub read_table {
+	my ($file) = @_;
+	my @rows;
+	open(my $fh, "<", $file) || die "Failed to read $file: $!\n";
+	<$fh>;
+	while (<$fh>){
+		chomp;
+		my ($year1, $year2, $feature, $class, $pixels) = split(/\s*,\s*/);
+		push(@rows, [ $feature, $class, $pixels ]);
+	}
+	close($fh);
+	return @rows;
+}
+
+# runs a tool with its output thrown away, and stops if it fails
+sub run {
+	my @cmd = @_;
+	my $pid = fork();
+	die "Failed to fork: $!\n" if (!defined $pid);
+	if ($pid == 0){
+		open(STDOUT, ">", "/dev/null");
+		open(STDERR, ">", "/dev/null");
+		exec(@cmd) || exit 127;
+	}
+	waitpid($pid, 0);
+	die "@cmd failed, run it by hand to see why\n" if ($? != 0);
+}
+
+sub usage {
+	print STDERR "$0 - check ccap2tbl merges features that are more than one row\n";
+	print STDERR "USAGE: $0 [-d|-dir dir] [-j|-threads threads]\n";
+	print STDERR "\tdir = where the synthetic data and tables are written [check_data]\n";
+	print STDERR "\tthreads = threads for the -j run [3]\n";
+}
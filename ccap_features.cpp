@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <string.h>
+#include "cpl_conv.h"
+#include "ccap_features.h"
+
+/* slots in the hash table to start with; always a power of two */
+#define CCAP_FEATURES_MIN_SLOTS 1024
+
+/************************************************************************/
+/*                              hashID()                                */
+/************************************************************************/
+
+static unsigned int hashID(const char *pszID, size_t nLength)
+{
+	unsigned int nHash = 2166136261U; // 32 bit FNV-1a
+	for(size_t i = 0; i < nLength; i++){
+		nHash ^= (unsigned char)pszID[i];
+		nHash *= 16777619U;
+	}
+	return nHash;
+}
+
+/************************************************************************/
+/*                         CCAPFeatureTables()                          */
+/************************************************************************/
+
+CCAPFeatureTables::CCAPFeatureTables(int nCellsIn)
+	: nCells(nCellsIn), nTextFree(0), anSlots(CCAP_FEATURES_MIN_SLOTS, 0)
+{
+}
+
+CCAPFeatureTables::~CCAPFeatureTables()
+{
+	for(size_t i = 0; i < apanSlabs.size(); i++) CPLFree(apanSlabs[i]);
+	for(size_t i = 0; i < apszText.size(); i++) CPLFree(apszText[i]);
+}
+
+/************************************************************************/
+/*                              intern()                                */
+/************************************************************************/
+
+const char *CCAPFeatureTables::intern(const char *pszID, size_t nLength)
+{
+	char *pszCopy;
+
+	if(nLength + 1 > CCAP_FEATURES_TEXT_BYTES / 4){
+		// a long one gets a block to itself, so it doesn't waste the rest of the current block
+		pszCopy = (char *)CPLMalloc(nLength + 1);
+		apszText.insert(apszText.end() - (apszText.empty() ? 0 : 1), pszCopy);
+	}else{
+		if(nLength + 1 > nTextFree){
+			apszText.push_back((char *)CPLMalloc(CCAP_FEATURES_TEXT_BYTES));
+			nTextFree = CCAP_FEATURES_TEXT_BYTES;
+		}
+		pszCopy = apszText.back() + CCAP_FEATURES_TEXT_BYTES - nTextFree;
+		nTextFree -= nLength + 1;
+	}
+	memcpy(pszCopy, pszID, nLength + 1);
+	return pszCopy;
+}
+
+/************************************************************************/
+/*                               grow()                                 */
+/*                                                                      */
+/*      Doubles the hash table, which is kept at most half full so      */
+/*      the linear probes stay short.                                   */
+/************************************************************************/
+
+void CCAPFeatureTables::grow()
+{
+	std::vector<size_t> anNew(anSlots.size() * 2, 0);
+	size_t nMask = anNew.size() - 1;
+	for(size_t i = 0; i < apszIDs.size(); i++){
+		size_t iSlot = anHashes[i] & nMask;
+		while(anNew[iSlot] != 0) iSlot = (iSlot + 1) & nMask;
+		anNew[iSlot] = i + 1;
+	}
+	anSlots.swap(anNew);
+}
+
+/************************************************************************/
+/*                               find()                                 */
+/************************************************************************/
+
+unsigned long long *CCAPFeatureTables::find(const char *pszID, const char **ppszID, size_t *piRow)
+{
+	size_t nLength = strlen(pszID);
+	unsigned int nHash = hashID(pszID, nLength);
+	size_t nMask = anSlots.size() - 1;
+	size_t iSlot = nHash & nMask;
+
+	for(; anSlots[iSlot] != 0; iSlot = (iSlot + 1) & nMask){
+		size_t iRow = anSlots[iSlot] - 1;
+		if(anHashes[iRow] == nHash && strcmp(apszIDs[iRow], pszID) == 0){
+			if(ppszID != NULL) *ppszID = apszIDs[iRow];
+			if(piRow != NULL) *piRow = iRow;
+			return row(iRow);
+		}
+	}
+
+	// not seen yet
+	size_t iRow = apszIDs.size();
+	if(iRow % CCAP_FEATURES_SLAB_ROWS == 0){
+		apanSlabs.push_back((unsigned long long *)CPLCalloc((size_t)CCAP_FEATURES_SLAB_ROWS * nCells,
+		                                                   sizeof(unsigned long long)));
+	}
+	apszIDs.push_back(intern(pszID, nLength));
+	anHashes.push_back(nHash);
+	anSlots[iSlot] = iRow + 1;
+	if(2 * apszIDs.size() > anSlots.size()) grow();
+
+	if(ppszID != NULL) *ppszID = apszIDs[iRow];
+	if(piRow != NULL) *piRow = iRow;
+	return row(iRow);
+}
@@ -0,0 +1,60 @@
+#ifndef CCAP_FEATURES_H
+#define CCAP_FEATURES_H
+
+#include <stddef.h>
+#include <vector>
+
+/* counter rows allocated at once; a slab never moves once it is made */
+#define CCAP_FEATURES_SLAB_ROWS 256
+
+/* bytes of feature IDs allocated at once */
+#define CCAP_FEATURES_TEXT_BYTES (64*1024)
+
+/*
+* The table of counts for each distinct feature value. A value seen on
+* several features (the parts of a county stored as separate records,
+* say) gets one row they all add into.
+*
+* IDs are copied once into a text arena and looked up through an open
+* addressing hash table of row numbers. Rows of nCells counters are cut
+* from slabs of CCAP_FEATURES_SLAB_ROWS rows, so they sit next to each
+* other in the order the values were first seen and a row's address
+* stays good while more are added. Workers may add into rows they were
+* handed while the main thread adds rows; finding and adding rows is
+* for one thread only.
+*/
+class CCAPFeatureTables
+{
+public:
+	explicit CCAPFeatureTables(int nCells);
+	~CCAPFeatureTables();
+
+	// the row for pszID, made and zeroed if it's new; *ppszID gets the kept
+	// copy of pszID and *piRow its row number, where they aren't NULL
+	unsigned long long *find(const char *pszID, const char **ppszID, size_t *piRow = NULL);
+
+	// rows in the order their values were first seen
+	size_t size() const { return apszIDs.size(); }
+	const char *id(size_t i) const { return apszIDs[i]; }
+	unsigned long long *row(size_t i) const
+	{
+		return apanSlabs[i / CCAP_FEATURES_SLAB_ROWS] + (i % CCAP_FEATURES_SLAB_ROWS) * nCells;
+	}
+
+private:
+	CCAPFeatureTables(const CCAPFeatureTables &);
+	CCAPFeatureTables &operator=(const CCAPFeatureTables &);
+
+	const char *intern(const char *pszID, size_t nLength);
+	void grow();
+
+	int nCells;
+	std::vector<unsigned long long *> apanSlabs;
+	std::vector<char *> apszText;      // text arena blocks
+	size_t nTextFree;                  // bytes left in the last block
+	std::vector<const char *> apszIDs; // row number to its ID
+	std::vector<unsigned int> anHashes;// row number to its ID's hash
+	std::vector<size_t> anSlots;       // hash table of row number + 1, 0 where empty
+};
+
+#endif
@@ -0,0 +1,343 @@
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include "ccap_kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CCAP_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/************************************************************************/
+/*                          combineScalar()                             */
+/************************************************************************/
+
+static void combineScalar(const unsigned char *pabyStart, const unsigned char *pabyEnd,
+                          unsigned short *panOut, size_t nPixels, int nClasses)
+{
+	for(size_t x = 0; x < nPixels; x++){
+		unsigned short spix = pabyStart[x];
+		unsigned short epix = pabyEnd[x];
+		panOut[x] = spix && epix ? nClasses * (spix - 1) + epix : 0;
+	}
+}
+
+#ifdef CCAP_HAVE_X86_SIMD
+
+/************************************************************************/
+/*                           combineSSE2()                              */
+/*                                                                      */
+/*      16 pixels at a time: widen both bytes to 16 bits, compute       */
+/*      nClasses*start + end - nClasses and clear the lanes where       */
+/*      either input was 0. All of it wraps the same as the scalar      */
+/*      unsigned short arithmetic.                                      */
+/************************************************************************/
+
+__attribute__((target("sse2")))
+static void combineSSE2(const unsigned char *pabyStart, const unsigned char *pabyEnd,
+                        unsigned short *panOut, size_t nPixels, int nClasses)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i k = _mm_set1_epi16((short)nClasses);
+	size_t x = 0;
+
+	for(; x + 16 <= nPixels; x += 16){
+		__m128i s = _mm_loadu_si128((const __m128i *)(pabyStart + x));
+		__m128i e = _mm_loadu_si128((const __m128i *)(pabyEnd + x));
+		__m128i zmask = _mm_or_si128(_mm_cmpeq_epi8(s, zero), _mm_cmpeq_epi8(e, zero));
+
+		__m128i slo = _mm_unpacklo_epi8(s, zero);
+		__m128i shi = _mm_unpackhi_epi8(s, zero);
+		__m128i elo = _mm_unpacklo_epi8(e, zero);
+		__m128i ehi = _mm_unpackhi_epi8(e, zero);
+
+		__m128i lo = _mm_sub_epi16(_mm_add_epi16(_mm_mullo_epi16(slo, k), elo), k);
+		__m128i hi = _mm_sub_epi16(_mm_add_epi16(_mm_mullo_epi16(shi, k), ehi), k);
+
+		lo = _mm_andnot_si128(_mm_unpacklo_epi8(zmask, zmask), lo);
+		hi = _mm_andnot_si128(_mm_unpackhi_epi8(zmask, zmask), hi);
+
+		_mm_storeu_si128((__m128i *)(panOut + x), lo);
+		_mm_storeu_si128((__m128i *)(panOut + x + 8), hi);
+	}
+	combineScalar(pabyStart + x, pabyEnd + x, panOut + x, nPixels - x, nClasses);
+}
+
+/************************************************************************/
+/*                           combineAVX2()                              */
+/*                                                                      */
+/*      Same as SSE2, 32 pixels at a time. The bytes are widened with   */
+/*      vpmovzxbw on each 16 byte half, which avoids AVX2's in-lane     */
+/*      unpack shuffling.                                               */
+/************************************************************************/
+
+__attribute__((target("avx2")))
+static void combineAVX2(const unsigned char *pabyStart, const unsigned char *pabyEnd,
+                        unsigned short *panOut, size_t nPixels, int nClasses)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i k = _mm256_set1_epi16((short)nClasses);
+	size_t x = 0;
+
+	for(; x + 32 <= nPixels; x += 32){
+		for(int h = 0; h < 32; h += 16){
+			__m256i s = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(pabyStart + x + h)));
+			__m256i e = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(pabyEnd + x + h)));
+			__m256i zmask = _mm256_or_si256(_mm256_cmpeq_epi16(s, zero), _mm256_cmpeq_epi16(e, zero));
+			__m256i v = _mm256_sub_epi16(_mm256_add_epi16(_mm256_mullo_epi16(s, k), e), k);
+			_mm256_storeu_si256((__m256i *)(panOut + x + h), _mm256_andnot_si256(zmask, v));
+		}
+	}
+	combineScalar(pabyStart + x, pabyEnd + x, panOut + x, nPixels - x, nClasses);
+}
+
+#endif /* CCAP_HAVE_X86_SIMD */
+
+/*
+* The histogram kernels spread neighbouring pixels over CCAP_HIST_WAYS
+* sub-tables. Land cover comes in long runs of one class, and with one
+* table every increment of a run waits on the store of the one before
+* it. Sub-table counters are 32 bits and are added into the caller's
+* 64 bit table every CCAP_HIST_CHUNK pixels, well before they can wrap.
+* Each sub-table has one extra counter at nMax+1 that values over nMax
+* are dumped in, which saves a branch per pixel.
+*/
+#define CCAP_HIST_WAYS 4
+#define CCAP_HIST_CHUNK ((size_t)1 << 30)
+
+static inline unsigned int histBin(unsigned short v, unsigned int nOver)
+{
+	return v < nOver ? v : nOver;
+}
+
+static unsigned int *histSubTables(int nMax)
+{
+	static thread_local std::vector<unsigned int> anSub;
+	anSub.assign((size_t)CCAP_HIST_WAYS * (nMax + 2), 0);
+	return &anSub[0];
+}
+
+static void histFlush(unsigned int *panSub, unsigned long long *panTable, int nMax)
+{
+	size_t nStride = nMax + 2;
+	for(int v = 0; v <= nMax; v++){
+		panTable[v] += (unsigned long long)panSub[v] + panSub[nStride + v]
+		               + panSub[2 * nStride + v] + panSub[3 * nStride + v];
+	}
+	memset(panSub, 0, sizeof(unsigned int) * CCAP_HIST_WAYS * nStride);
+}
+
+static inline void histCount(const unsigned short *p, size_t n, unsigned int *panSub,
+                             size_t nStride, unsigned int nOver)
+{
+	unsigned int *t0 = panSub, *t1 = t0 + nStride, *t2 = t1 + nStride, *t3 = t2 + nStride;
+	size_t x = 0;
+	for(; x + 4 <= n; x += 4){
+		t0[histBin(p[x], nOver)]++;
+		t1[histBin(p[x+1], nOver)]++;
+		t2[histBin(p[x+2], nOver)]++;
+		t3[histBin(p[x+3], nOver)]++;
+	}
+	for(; x < n; x++){
+		t0[histBin(p[x], nOver)]++;
+	}
+}
+
+/************************************************************************/
+/*                          histogramScalar()                           */
+/*                                                                      */
+/*      The plain loop, kept for comparison.                            */
+/************************************************************************/
+
+static void histogramScalar(const unsigned short *panData, size_t nPixels,
+                            unsigned long long *panTable, int nMax)
+{
+	for(size_t x = 0; x < nPixels; x++){
+		if(panData[x] <= nMax) panTable[panData[x]]++;
+	}
+}
+
+/************************************************************************/
+/*                          histogramMulti()                            */
+/************************************************************************/
+
+static void histogramMulti(const unsigned short *panData, size_t nPixels,
+                           unsigned long long *panTable, int nMax)
+{
+	unsigned int *panSub = histSubTables(nMax);
+	for(size_t nDone = 0; nDone < nPixels; nDone += CCAP_HIST_CHUNK){
+		size_t n = nPixels - nDone < CCAP_HIST_CHUNK ? nPixels - nDone : CCAP_HIST_CHUNK;
+		histCount(panData + nDone, n, panSub, nMax + 2, nMax + 1);
+		histFlush(panSub, panTable, nMax);
+	}
+}
+
+#ifdef CCAP_HAVE_X86_SIMD
+
+/************************************************************************/
+/*                          histogramSSE2()                             */
+/*                                                                      */
+/*      Sub-tables plus a run check: when 16 pixels in a row are all    */
+/*      the same value, which is most of a land cover raster, they are  */
+/*      counted with a single add.                                      */
+/************************************************************************/
+
+__attribute__((target("sse2")))
+static void histogramSSE2(const unsigned short *panData, size_t nPixels,
+                          unsigned long long *panTable, int nMax)
+{
+	unsigned int *panSub = histSubTables(nMax);
+	size_t nStride = nMax + 2;
+	unsigned int nOver = nMax + 1;
+
+	for(size_t nDone = 0; nDone < nPixels; nDone += CCAP_HIST_CHUNK){
+		size_t n = nPixels - nDone < CCAP_HIST_CHUNK ? nPixels - nDone : CCAP_HIST_CHUNK;
+		const unsigned short *p = panData + nDone;
+		size_t x = 0;
+		for(; x + 16 <= n; x += 16){
+			__m128i v = _mm_set1_epi16((short)p[x]);
+			__m128i eq = _mm_and_si128(_mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(p + x)), v),
+			                           _mm_cmpeq_epi16(_mm_loadu_si128((const __m128i *)(p + x + 8)), v));
+			if(_mm_movemask_epi8(eq) == 0xffff){
+				panSub[histBin(p[x], nOver)] += 16;
+			}else{
+				histCount(p + x, 16, panSub, nStride, nOver);
+			}
+		}
+		histCount(p + x, n - x, panSub, nStride, nOver);
+		histFlush(panSub, panTable, nMax);
+	}
+}
+
+/************************************************************************/
+/*                          histogramAVX2()                             */
+/************************************************************************/
+
+__attribute__((target("avx2")))
+static void histogramAVX2(const unsigned short *panData, size_t nPixels,
+                          unsigned long long *panTable, int nMax)
+{
+	unsigned int *panSub = histSubTables(nMax);
+	size_t nStride = nMax + 2;
+	unsigned int nOver = nMax + 1;
+
+	for(size_t nDone = 0; nDone < nPixels; nDone += CCAP_HIST_CHUNK){
+		size_t n = nPixels - nDone < CCAP_HIST_CHUNK ? nPixels - nDone : CCAP_HIST_CHUNK;
+		const unsigned short *p = panData + nDone;
+		size_t x = 0;
+		for(; x + 16 <= n; x += 16){
+			__m256i eq = _mm256_cmpeq_epi16(_mm256_loadu_si256((const __m256i *)(p + x)),
+			                                _mm256_set1_epi16((short)p[x]));
+			if(_mm256_movemask_epi8(eq) == -1){
+				panSub[histBin(p[x], nOver)] += 16;
+			}else{
+				histCount(p + x, 16, panSub, nStride, nOver);
+			}
+		}
+		histCount(p + x, n - x, panSub, nStride, nOver);
+		histFlush(panSub, panTable, nMax);
+	}
+}
+
+#endif /* CCAP_HAVE_X86_SIMD */
+
+/************************************************************************/
+/*                           simdLevel()                                */
+/*                                                                      */
+/*      The widest instruction set this CPU has.                        */
+/************************************************************************/
+
+static const char *simdLevel()
+{
+#ifdef CCAP_HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) return "avx2";
+	if(__builtin_cpu_supports("sse2")) return "sse2";
+#endif
+	return "scalar";
+}
+
+/************************************************************************/
+/*                        CCAPGetCombineKernel()                        */
+/************************************************************************/
+
+static const char *bestKernelName()
+{
+	const char *pszForce = getenv("CCAP_SIMD");
+	if(pszForce != NULL && CCAPGetCombineKernel(pszForce) != NULL) return pszForce;
+	return simdLevel();
+}
+
+CCAPCombineFunc CCAPGetCombineKernel(const char *pszName)
+{
+	if(pszName == NULL) pszName = CCAPCombineKernelName();
+
+	if(strcmp(pszName, "scalar") == 0) return combineScalar;
+#ifdef CCAP_HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if(strcmp(pszName, "sse2") == 0 && __builtin_cpu_supports("sse2")) return combineSSE2;
+	if(strcmp(pszName, "avx2") == 0 && __builtin_cpu_supports("avx2")) return combineAVX2;
+#endif
+	return NULL;
+}
+
+const char *CCAPCombineKernelName()
+{
+	// function statics are initialized once even with threads
+	static const char *pszName = bestKernelName();
+	return pszName;
+}
+
+/************************************************************************/
+/*                        CCAPCombineBivariate()                        */
+/************************************************************************/
+
+void CCAPCombineBivariate(const unsigned char *pabyStart, const unsigned char *pabyEnd,
+                          unsigned short *panOut, size_t nPixels, int nClasses)
+{
+	static CCAPCombineFunc pfnCombine = CCAPGetCombineKernel(NULL);
+	pfnCombine(pabyStart, pabyEnd, panOut, nPixels, nClasses);
+}
+
+/************************************************************************/
+/*                       CCAPGetHistogramKernel()                       */
+/************************************************************************/
+
+static const char *bestHistogramName()
+{
+	const char *pszForce = getenv("CCAP_SIMD");
+	if(pszForce != NULL && CCAPGetHistogramKernel(pszForce) != NULL) return pszForce;
+	const char *pszLevel = simdLevel();
+	return strcmp(pszLevel, "scalar") == 0 ? "multi" : pszLevel;
+}
+
+CCAPHistogramFunc CCAPGetHistogramKernel(const char *pszName)
+{
+	if(pszName == NULL) pszName = CCAPHistogramKernelName();
+
+	if(strcmp(pszName, "scalar") == 0) return histogramScalar;
+	if(strcmp(pszName, "multi") == 0) return histogramMulti;
+#ifdef CCAP_HAVE_X86_SIMD
+	__builtin_cpu_init();
+	if(strcmp(pszName, "sse2") == 0 && __builtin_cpu_supports("sse2")) return histogramSSE2;
+	if(strcmp(pszName, "avx2") == 0 && __builtin_cpu_supports("avx2")) return histogramAVX2;
+#endif
+	return NULL;
+}
+
+const char *CCAPHistogramKernelName()
+{
+	static const char *pszName = bestHistogramName();
+	return pszName;
+}
+
+/************************************************************************/
+/*                           CCAPHistogram()                            */
+/************************************************************************/
+
+void CCAPHistogram(const unsigned short *panData, size_t nPixels,
+                   unsigned long long *panTable, int nMax)
+{
+	static CCAPHistogramFunc pfnHistogram = CCAPGetHistogramKernel(NULL);
+	pfnHistogram(panData, nPixels, panTable, nMax);
+}
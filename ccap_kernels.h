@@ -0,0 +1,42 @@
+#ifndef CCAP_KERNELS_H
+#define CCAP_KERNELS_H
+
+#include <stddef.h>
+
+/*
+* Inner loops shared by the ccap tools, with SSE2/AVX2 versions picked
+* at run time from what the CPU supports. Setting the environment
+* variable CCAP_SIMD to scalar, sse2 or avx2 (or multi, histogram only)
+* forces a particular one.
+*/
+
+/*
+* bivariate = nClasses * (start - 1) + end, or 0 where either is 0.
+* nClasses * 256 must fit in 16 bits.
+*/
+typedef void (*CCAPCombineFunc)(const unsigned char *pabyStart, const unsigned char *pabyEnd,
+                                unsigned short *panOut, size_t nPixels, int nClasses);
+
+void CCAPCombineBivariate(const unsigned char *pabyStart, const unsigned char *pabyEnd,
+                          unsigned short *panOut, size_t nPixels, int nClasses);
+
+// a particular implementation ("scalar", "sse2", "avx2"), or NULL if this
+// CPU or build doesn't have it. NULL name gives the one in use.
+CCAPCombineFunc CCAPGetCombineKernel(const char *pszName);
+const char *CCAPCombineKernelName();
+
+/*
+* panTable[v] += number of pixels equal to v, for every v <= nMax. Larger
+* values are not counted. panTable has nMax+1 entries.
+*/
+typedef void (*CCAPHistogramFunc)(const unsigned short *panData, size_t nPixels,
+                                  unsigned long long *panTable, int nMax);
+
+void CCAPHistogram(const unsigned short *panData, size_t nPixels,
+                   unsigned long long *panTable, int nMax);
+
+// as for the combine kernels; "multi" is the portable sub-table version
+CCAPHistogramFunc CCAPGetHistogramKernel(const char *pszName);
+const char *CCAPHistogramKernelName();
+
+#endif
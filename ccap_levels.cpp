@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ogrsf_frmts.h"
+#include "cpl_string.h"
+#include "ccap_levels.h"
+
+/* anParent of a finest value whose features have no value at that level */
+#define CCAP_NO_PARENT ((size_t)-1)
+
+/************************************************************************/
+/*                             CCAPLevels()                             */
+/************************************************************************/
+
+CCAPLevels::CCAPLevels(int nCellsIn) : nCells(nCellsIn), nConflicts(0)
+{
+}
+
+CCAPLevels::~CCAPLevels()
+{
+	for(size_t i = 0; i < aoLevels.size(); i++) delete aoLevels[i].poTables;
+}
+
+/************************************************************************/
+/*                               parse()                                */
+/************************************************************************/
+
+int CCAPLevels::parse(const char *pszSpecs)
+{
+	char **papszSpecs = CSLTokenizeString2(pszSpecs, ",", CSLT_STRIPLEADSPACES | CSLT_STRIPENDSPACES);
+	int bOK = CSLCount(papszSpecs) > 0;
+
+	for(int i = 0; bOK && papszSpecs[i] != NULL; i++){
+		Level oLevel;
+		oLevel.osName = papszSpecs[i];
+		oLevel.osField = papszSpecs[i];
+		oLevel.nPrefix = 0;
+		oLevel.iField = -1;
+		oLevel.poTables = NULL;
+
+		size_t nColon = oLevel.osField.find(':');
+		if(nColon != std::string::npos){
+			char *pszEnd = NULL;
+			oLevel.nPrefix = (int)strtol(oLevel.osField.c_str() + nColon + 1, &pszEnd, 10);
+			oLevel.osField.resize(nColon);
+			if(*pszEnd != '\0' || oLevel.nPrefix < 1) bOK = FALSE;
+		}
+		if(oLevel.osField.empty()) bOK = FALSE;
+		if(!bOK){
+			fprintf(stderr,"Bad field %s, expected FIELD or FIELD:characters\n",papszSpecs[i]);
+			break;
+		}
+		oLevel.poTables = new CCAPFeatureTables(nCells);
+		aoLevels.push_back(oLevel);
+	}
+	CSLDestroy(papszSpecs);
+	return bOK;
+}
+
+/************************************************************************/
+/*                              resolve()                               */
+/************************************************************************/
+
+int CCAPLevels::resolve(OGRFeatureDefn *poDefn)
+{
+	for(size_t i = 0; i < aoLevels.size(); i++){
+		aoLevels[i].iField = poDefn->GetFieldIndex(aoLevels[i].osField.c_str());
+		if(aoLevels[i].iField == -1){
+			fprintf(stderr,"Failed to find field %s\n",aoLevels[i].osField.c_str());
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/************************************************************************/
+/*                               value()                                */
+/*                                                                      */
+/*      A feature's value at one level, or NULL if it has none. Used    */
+/*      straight away; the next call may overwrite it.                  */
+/************************************************************************/
+
+const char *CCAPLevels::value(OGRFeature *poFeature, int iLevel, std::string &osBuf) const
+{
+	const Level &oLevel = aoLevels[iLevel];
+	if(!poFeature->IsFieldSet(oLevel.iField)) return NULL;
+
+	const char *pszValue = poFeature->GetFieldAsString(oLevel.iField);
+	if(*pszValue == '\0') return NULL;
+	if(oLevel.nPrefix > 0 && strlen(pszValue) > (size_t)oLevel.nPrefix){
+		osBuf.assign(pszValue, oLevel.nPrefix);
+		return osBuf.c_str();
+	}
+	return pszValue;
+}
+
+/************************************************************************/
+/*                                find()                                */
+/*                                                                      */
+/*      A finest value takes the coarser values of the first feature    */
+/*      seen with it. Later features with the same value but other      */
+/*      parents (a block group split across a county line by a bad      */
+/*      join, say) are counted there too, with a warning.               */
+/************************************************************************/
+
+unsigned long long *CCAPLevels::find(OGRFeature *poFeature, const char **ppszID)
+{
+	std::string osBuf;
+	const char *pszID = value(poFeature, 0, osBuf);
+	if(pszID == NULL){
+		fprintf(stderr,"Skipping feature %lld, it has no value to report it by\n",(long long)poFeature->GetFID());
+		return NULL;
+	}
+
+	size_t nRows = aoLevels[0].poTables->size();
+	size_t iRow;
+	unsigned long long *panTable = aoLevels[0].poTables->find(pszID, ppszID, &iRow);
+
+	for(size_t l = 1; l < aoLevels.size(); l++){
+		Level &oLevel = aoLevels[l];
+		const char *pszParent = value(poFeature, l, osBuf);
+		size_t iParent = CCAP_NO_PARENT;
+		if(pszParent != NULL) oLevel.poTables->find(pszParent, NULL, &iParent);
+
+		if(iRow == nRows){
+			oLevel.anParent.push_back(iParent);
+		}else if(oLevel.anParent[iRow] != iParent){
+			if(nConflicts++ == 0){
+				fprintf(stderr,"Warning: features with %s %s are in more than one %s, counting them in the first\n",
+				        name(0), aoLevels[0].poTables->id(iRow), oLevel.osName.c_str());
+			}
+		}
+	}
+	return panTable;
+}
+
+/************************************************************************/
+/*                             aggregate()                              */
+/************************************************************************/
+
+void CCAPLevels::aggregate(int verbose)
+{
+	CCAPFeatureTables &oFinest = *aoLevels[0].poTables;
+
+	if(nConflicts > 1) fprintf(stderr,"Warning: %lld features in all disagreed with earlier ones about their coarser values\n",nConflicts);
+
+	for(size_t l = 1; l < aoLevels.size(); l++){
+		Level &oLevel = aoLevels[l];
+		size_t nOrphans = 0;
+		for(size_t r = 0; r < oFinest.size(); r++){
+			if(oLevel.anParent[r] == CCAP_NO_PARENT){
+				nOrphans++;
+				continue;
+			}
+			const unsigned long long *panChild = oFinest.row(r);
+			unsigned long long *panParent = oLevel.poTables->row(oLevel.anParent[r]);
+			for(int k = 0; k < nCells; k++) panParent[k] += panChild[k];
+		}
+		if(nOrphans){
+			fprintf(stderr,"Warning: %lu %s values have no %s, they are left out of that level\n",
+			        (unsigned long)nOrphans, name(0), oLevel.osName.c_str());
+		}
+		verbose && fprintf(stderr,"%lu %s values summed into %lu %s values\n",(unsigned long)oFinest.size(),
+		                   name(0), (unsigned long)oLevel.poTables->size(), oLevel.osName.c_str());
+	}
+}
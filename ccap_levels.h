@@ -0,0 +1,71 @@
+#ifndef CCAP_LEVELS_H
+#define CCAP_LEVELS_H
+
+#include <string>
+#include <vector>
+#include "cpl_port.h"
+#include "ccap_features.h"
+
+class OGRFeature;
+class OGRFeatureDefn;
+
+/************************************************************************/
+/*                              CCAPLevels                              */
+/*                                                                      */
+/*      The geographies to report, finest first, from ccap2tbl -f.      */
+/*      Each is a field of the layer, FIELD, or the first N characters  */
+/*      of one, FIELD:N, so GEOID,GEOID:11,GEOID:5 gives block groups,  */
+/*      their tracts and their counties from a block group layer.       */
+/*                                                                      */
+/*      Only the finest level is tabulated from the raster. As each     */
+/*      feature is read the coarser values it carries are noted, and    */
+/*      aggregate() sums every finest table into the tables of the      */
+/*      values it sits in, so the other levels cost no raster reads.    */
+/************************************************************************/
+
+class CCAPLevels
+{
+public:
+	explicit CCAPLevels(int nCells);
+	~CCAPLevels();
+
+	// parse a comma separated list of field specs; FALSE with a message if one is bad
+	int parse(const char *pszSpecs);
+
+	// find the fields in the layer; FALSE with a message if one isn't there
+	int resolve(OGRFeatureDefn *poDefn);
+
+	int count() const { return (int)aoLevels.size(); }
+	const char *name(int iLevel) const { return aoLevels[iLevel].osName.c_str(); }
+	CCAPFeatureTables &tables(int iLevel) { return *aoLevels[iLevel].poTables; }
+
+	/*
+	* The finest level's table for poFeature, made the first time its
+	* value is seen, with *ppszID set to the value. Features with no value
+	* can't be reported and get NULL. Main thread only.
+	*/
+	unsigned long long *find(OGRFeature *poFeature, const char **ppszID);
+
+	// add the finest tables into the coarser ones; call once, after the counting is done
+	void aggregate(int verbose);
+
+private:
+	CCAPLevels(const CCAPLevels &);
+	CCAPLevels &operator=(const CCAPLevels &);
+
+	const char *value(OGRFeature *poFeature, int iLevel, std::string &osBuf) const;
+
+	struct Level {
+		std::string osName;           // the spec, as given
+		std::string osField;
+		int nPrefix;                  // characters of the field to use, 0 for all of it
+		int iField;
+		CCAPFeatureTables *poTables;
+		std::vector<size_t> anParent; // finest row to the row of its value here, CCAP_NO_PARENT if it has none
+	};
+	std::vector<Level> aoLevels;
+	int nCells;
+	GIntBig nConflicts;              // features put in a different parent than their value was before
+};
+
+#endif
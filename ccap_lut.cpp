@@ -0,0 +1,160 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "cpl_conv.h"
+#include "cpl_string.h"
+#include "gdal_rat.h"
+#include "ccap_lut.h"
+
+/************************************************************************/
+/*                        CCAPBuildBivariateLUT()                       */
+/*                                                                      */
+/*      Code 0 is always value 0, the background, whether or not it     */
+/*      has a count, so a coded band has the same nodata as before.     */
+/************************************************************************/
+
+int CCAPBuildBivariateLUT(const GUIntBig *panHistogram, int nBuckets, CCAPBivariateLUT *psLUT)
+{
+	memset(psLUT->anValues, 0, sizeof(psLUT->anValues));
+	psLUT->nCodes = 1;
+	for(int v = 1; v < nBuckets; v++){
+		if(panHistogram[v] == 0) continue;
+		if(psLUT->nCodes == 256) return FALSE;
+		psLUT->anValues[psLUT->nCodes++] = (unsigned short)v;
+	}
+	return TRUE;
+}
+
+/************************************************************************/
+/*                         CCAPBivariateCodes()                         */
+/************************************************************************/
+
+void CCAPBivariateCodes(const CCAPBivariateLUT *psLUT, int nValues, unsigned char *pabyCodes)
+{
+	memset(pabyCodes, 0, nValues);
+	for(int c = 1; c < psLUT->nCodes; c++){
+		if(psLUT->anValues[c] < nValues) pabyCodes[psLUT->anValues[c]] = (unsigned char)c;
+	}
+}
+
+/************************************************************************/
+/*                         CCAPSetBivariateLUT()                        */
+/*                                                                      */
+/*      A RAT from -c or -b has a row per bivariate value, and row v    */
+/*      becomes row code(v) here so the class names and colors stay     */
+/*      with their transitions. Values without a code are dropped.      */
+/************************************************************************/
+
+void CCAPSetBivariateLUT(GDALRasterBand *poBand, const CCAPBivariateLUT *psLUT, int nClasses)
+{
+	const GDALRasterAttributeTable *poOld = poBand->GetDefaultRAT();
+
+	GDALDefaultRasterAttributeTable oRAT;
+	std::vector<int> anCols; // columns of the old table carried over
+	for(int iCol = 0; poOld != NULL && iCol < poOld->GetColumnCount(); iCol++){
+		const char *pszName = poOld->GetNameOfCol(iCol);
+		if(EQUAL(pszName,CCAP_LUT_COLUMN) || EQUAL(pszName,"Start") || EQUAL(pszName,"End")) continue;
+		oRAT.CreateColumn(pszName, poOld->GetTypeOfCol(iCol), poOld->GetUsageOfCol(iCol));
+		anCols.push_back(iCol);
+	}
+	int nLUTCol = (int)anCols.size();
+	oRAT.CreateColumn(CCAP_LUT_COLUMN, GFT_Integer, GFU_Generic);
+	oRAT.CreateColumn("Start", GFT_Integer, GFU_Generic);
+	oRAT.CreateColumn("End", GFT_Integer, GFU_Generic);
+
+	oRAT.SetRowCount(psLUT->nCodes);
+	for(int c = 0; c < psLUT->nCodes; c++){
+		int v = psLUT->anValues[c];
+		for(int i = 0; i < nLUTCol && v < poOld->GetRowCount(); i++){
+			switch(poOld->GetTypeOfCol(anCols[i])){
+				case GFT_Integer:
+					oRAT.SetValue(c, i, poOld->GetValueAsInt(v, anCols[i]));
+					break;
+				case GFT_Real:
+					oRAT.SetValue(c, i, poOld->GetValueAsDouble(v, anCols[i]));
+					break;
+				default:
+					oRAT.SetValue(c, i, poOld->GetValueAsString(v, anCols[i]));
+					break;
+			}
+		}
+		oRAT.SetValue(c, nLUTCol, v);
+		oRAT.SetValue(c, nLUTCol + 1, v > 0 ? (v - 1) / nClasses + 1 : 0);
+		oRAT.SetValue(c, nLUTCol + 2, v > 0 ? (v - 1) % nClasses + 1 : 0);
+	}
+	poBand->SetDefaultRAT(&oRAT);
+
+	GDALColorTable *poOldColors = poBand->GetColorTable();
+	if(poOldColors != NULL){
+		GDALColorTable oColors;
+		for(int c = 0; c < psLUT->nCodes; c++){
+			const GDALColorEntry *psEntry = poOldColors->GetColorEntry(psLUT->anValues[c]);
+			if(psEntry != NULL) oColors.SetColorEntry(c, psEntry);
+		}
+		poBand->SetColorTable(&oColors);
+	}
+	poBand->SetMetadataItem(CCAP_CODED_ITEM, "YES");
+}
+
+/************************************************************************/
+/*                         CCAPGetBivariateLUT()                        */
+/************************************************************************/
+
+int CCAPGetBivariateLUT(GDALRasterBand *poBand, CCAPBivariateLUT *psLUT)
+{
+	memset(psLUT->anValues, 0, sizeof(psLUT->anValues));
+	psLUT->nCodes = 0;
+	if(poBand->GetRasterDataType() != GDT_Byte) return FALSE;
+	const char *pszCoded = poBand->GetMetadataItem(CCAP_CODED_ITEM);
+	if(pszCoded == NULL || !CSLTestBoolean(pszCoded)) return FALSE;
+
+	const GDALRasterAttributeTable *poRAT = poBand->GetDefaultRAT();
+	if(poRAT == NULL) return FALSE;
+	int iCol;
+	for(iCol = 0; iCol < poRAT->GetColumnCount(); iCol++){
+		if(EQUAL(poRAT->GetNameOfCol(iCol),CCAP_LUT_COLUMN)) break;
+	}
+	if(iCol == poRAT->GetColumnCount()) return FALSE;
+
+	int nRows = poRAT->GetRowCount() < 256 ? poRAT->GetRowCount() : 256;
+	for(int c = 0; c < nRows; c++){
+		int v = poRAT->GetValueAsInt(c, iCol);
+		psLUT->anValues[c] = v > 0 && v <= 65535 ? (unsigned short)v : 0;
+	}
+	psLUT->nCodes = nRows;
+	return nRows > 0;
+}
+
+/************************************************************************/
+/*                        CCAPCopyRATWithoutLUT()                       */
+/************************************************************************/
+
+GDALRasterAttributeTable *CCAPCopyRATWithoutLUT(const GDALRasterAttributeTable *poRAT)
+{
+	GDALDefaultRasterAttributeTable *poCopy = new GDALDefaultRasterAttributeTable();
+	std::vector<int> anCols; // columns carried over
+	for(int iCol = 0; iCol < poRAT->GetColumnCount(); iCol++){
+		const char *pszName = poRAT->GetNameOfCol(iCol);
+		if(EQUAL(pszName,CCAP_LUT_COLUMN) || EQUAL(pszName,"Start") || EQUAL(pszName,"End")) continue;
+		poCopy->CreateColumn(pszName, poRAT->GetTypeOfCol(iCol), poRAT->GetUsageOfCol(iCol));
+		anCols.push_back(iCol);
+	}
+
+	poCopy->SetRowCount(poRAT->GetRowCount());
+	for(int iRow = 0; iRow < poRAT->GetRowCount(); iRow++){
+		for(int i = 0; i < (int)anCols.size(); i++){
+			switch(poRAT->GetTypeOfCol(anCols[i])){
+				case GFT_Integer:
+					poCopy->SetValue(iRow, i, poRAT->GetValueAsInt(iRow, anCols[i]));
+					break;
+				case GFT_Real:
+					poCopy->SetValue(iRow, i, poRAT->GetValueAsDouble(iRow, anCols[i]));
+					break;
+				default:
+					poCopy->SetValue(iRow, i, poRAT->GetValueAsString(iRow, anCols[i]));
+					break;
+			}
+		}
+	}
+	return poCopy;
+}
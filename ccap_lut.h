@@ -0,0 +1,67 @@
+#ifndef CCAP_LUT_H
+#define CCAP_LUT_H
+
+#include <stddef.h>
+#include "gdal_priv.h"
+
+/* RAT column holding the bivariate value of each code of a coded band */
+#define CCAP_LUT_COLUMN "Bivariate"
+
+/* band metadata item set to YES on a coded band */
+#define CCAP_CODED_ITEM "CCAP_CODED"
+
+/*
+* A bivariate written by ccap2bivar -L: a Byte band whose pixels are
+* codes for the transitions that actually happen, numbered from 1 in
+* bivariate order, with 0 still the background. The RAT has a row per
+* code with its bivariate value in the Bivariate column (and the start
+* and end classes for people reading it), so the readers can turn the
+* codes back into bivariate values as the strips come in. The band is
+* marked CCAP_CODED=YES, so a Byte band that merely has a Bivariate
+* column in its RAT isn't taken for one.
+*/
+typedef struct {
+	int nCodes;                    // codes in use, 0 when the band holds bivariate values
+	unsigned short anValues[256];  // bivariate value of each code, 0 past nCodes
+} CCAPBivariateLUT;
+
+/*
+* Codes for every value with a count in a histogram of nBuckets values,
+* in value order. FALSE if they don't fit in a byte.
+*/
+int CCAPBuildBivariateLUT(const GUIntBig *panHistogram, int nBuckets, CCAPBivariateLUT *psLUT);
+
+// code of each value 0 to nValues-1 (0 for values without one), for CCAPEncodeBivariates()
+void CCAPBivariateCodes(const CCAPBivariateLUT *psLUT, int nValues, unsigned char *pabyCodes);
+
+/*
+* Put the codes in the band's RAT, moving the rows of any RAT and the
+* entries of any color table already on it from values to codes.
+* nClasses is the scheme's, for the start and end class columns.
+*/
+void CCAPSetBivariateLUT(GDALRasterBand *poBand, const CCAPBivariateLUT *psLUT, int nClasses);
+
+// the band's codes; FALSE, with psLUT->nCodes 0, if it holds plain bivariate values
+int CCAPGetBivariateLUT(GDALRasterBand *poBand, CCAPBivariateLUT *psLUT);
+
+// a copy of a RAT without the columns CCAPSetBivariateLUT() adds, to go on an uncoded band
+GDALRasterAttributeTable *CCAPCopyRATWithoutLUT(const GDALRasterAttributeTable *poRAT);
+
+// values past the code table, from input classes beyond the scheme, become 0 as they are uncounted anyway
+static inline void CCAPEncodeBivariates(const unsigned char *pabyCodes, int nValues,
+                                        unsigned short *panPixels, size_t nPixels)
+{
+	for(size_t i = 0; i < nPixels; i++){
+		panPixels[i] = panPixels[i] < nValues ? pabyCodes[panPixels[i]] : 0;
+	}
+}
+
+// codes read from a Byte band back to bivariate values, in place
+static inline void CCAPDecodeBivariates(const CCAPBivariateLUT *psLUT, unsigned short *panPixels, size_t nPixels)
+{
+	for(size_t i = 0; i < nPixels; i++){
+		panPixels[i] = psLUT->anValues[panPixels[i] & 0xff];
+	}
+}
+
+#endif
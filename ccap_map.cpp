@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include "cpl_conv.h"
+#include "cpl_string.h"
+#include "ccap_map.h"
+
+/************************************************************************/
+/*                            CCAPMapBand()                             */
+/*                                                                      */
+/*      USE_DEFAULT_IMPLEMENTATION=NO stops GDAL handing back its       */
+/*      generic mapping, which fills the pages through RasterIO and     */
+/*      would only add page faults to the copy we are trying to skip.   */
+/************************************************************************/
+
+int CCAPMapBand(GDALRasterBand *poBand, CCAPMappedBand *psMap, int verbose)
+{
+	psMap->psVMem = NULL;
+	psMap->pabyData = NULL;
+	psMap->nLineSpace = 0;
+
+#if GDAL_VERSION_NUM >= 1110000
+	if(!CSLTestBoolean(CPLGetConfigOption("CCAP_MMAP", "YES"))) return FALSE;
+	if(poBand->GetRasterDataType() != GDT_UInt16 || !CPLIsVirtualMemFileMapAvailable()) return FALSE;
+
+	int nPixelSpace = 0;
+	GIntBig nLineSpace = 0;
+	char **papszOptions = CSLSetNameValue(NULL, "USE_DEFAULT_IMPLEMENTATION", "NO");
+	CPLVirtualMem *psVMem = poBand->GetVirtualMemAuto(GF_Read, &nPixelSpace, &nLineSpace, papszOptions);
+	CSLDestroy(papszOptions);
+	if(psVMem == NULL){
+		verbose && fprintf(stderr,"\tBand can't be mapped, reading it with RasterIO\n");
+		return FALSE;
+	}
+
+	// the counting loops walk lines of packed, aligned values
+	if(nPixelSpace != sizeof(unsigned short) || nLineSpace % sizeof(unsigned short) != 0){
+		verbose && fprintf(stderr,"\tMapped band has %d byte pixel spacing, reading it with RasterIO\n",nPixelSpace);
+		CPLVirtualMemFree(psVMem);
+		return FALSE;
+	}
+
+	psMap->psVMem = psVMem;
+	psMap->pabyData = (const GByte *)CPLVirtualMemGetAddr(psVMem);
+	psMap->nLineSpace = nLineSpace;
+	verbose && fprintf(stderr,"\tReading band straight from the file mapping\n");
+	return TRUE;
+#else
+	return FALSE;
+#endif
+}
+
+/************************************************************************/
+/*                           CCAPUnmapBand()                            */
+/************************************************************************/
+
+void CCAPUnmapBand(CCAPMappedBand *psMap)
+{
+	if(psMap->psVMem != NULL) CPLVirtualMemFree(psMap->psVMem);
+	psMap->psVMem = NULL;
+	psMap->pabyData = NULL;
+}
@@ -0,0 +1,34 @@
+#ifndef CCAP_MAP_H
+#define CCAP_MAP_H
+
+#include "gdal_priv.h"
+#include "cpl_virtualmem.h"
+
+/*
+* A UInt16 band read straight out of the file's pages instead of being
+* copied out by RasterIO. psVMem is NULL when the band isn't mapped.
+* The mapping can be read from any thread, but must be freed with
+* CCAPUnmapBand() before the dataset is closed.
+*/
+typedef struct {
+	CPLVirtualMem *psVMem;
+	const GByte *pabyData;
+	GIntBig nLineSpace; // bytes from one line to the next
+} CCAPMappedBand;
+
+/*
+* Map a band if its layout allows it: the raw formats (ENVI, EHdr, ...)
+* and uncompressed GeoTIFF, stored as UInt16 in this machine's byte
+* order with the pixels of a line next to each other. Anything else,
+* or CCAP_MMAP=NO in the environment, leaves psMap empty and returns
+* FALSE so the caller falls back to RasterIO.
+*/
+int CCAPMapBand(GDALRasterBand *poBand, CCAPMappedBand *psMap, int verbose);
+void CCAPUnmapBand(CCAPMappedBand *psMap);
+
+static inline const unsigned short *CCAPMappedLine(const CCAPMappedBand *psMap, int nLine)
+{
+	return (const unsigned short *)(psMap->pabyData + nLine * psMap->nLineSpace);
+}
+
+#endif
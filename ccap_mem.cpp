@@ -0,0 +1,91 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include "gdal.h"
+#include "ccap_mem.h"
+
+/* held back from a limit for the heap, geometries, GDAL's own state and the code */
+#define CCAP_MEM_RESERVE_MIN (32*1024*1024)
+
+/* the block cache gets at least this, or the block rows read repeatedly thrash */
+#define CCAP_MEM_CACHE_MIN (16*1024*1024)
+
+/************************************************************************/
+/*                          CCAPParseMemSize()                          */
+/************************************************************************/
+
+GIntBig CCAPParseMemSize(const char *pszSize)
+{
+	char *pszEnd = NULL;
+	double dfSize = strtod(pszSize, &pszEnd);
+	if(pszEnd == pszSize || dfSize <= 0) return -1;
+
+	switch(*pszEnd){
+		case 'k': case 'K': dfSize *= 1024; pszEnd++; break;
+		case '\0':
+		case 'm': case 'M': dfSize *= 1024*1024; if(*pszEnd) pszEnd++; break;
+		case 'g': case 'G': dfSize *= 1024.0*1024*1024; pszEnd++; break;
+		default: return -1;
+	}
+	if(*pszEnd == 'b' || *pszEnd == 'B') pszEnd++;
+	return *pszEnd == '\0' ? (GIntBig)dfSize : -1;
+}
+
+/************************************************************************/
+/*                           CCAPMemBudget()                            */
+/*                                                                      */
+/*      An eighth of the limit (at least CCAP_MEM_RESERVE_MIN) is kept  */
+/*      back. Of what is left after nFixedBytes, the buffers may have   */
+/*      half and the block cache gets the rest, so a tool that reads    */
+/*      a strip through the cache has room for both copies.             */
+/************************************************************************/
+
+size_t CCAPMemBudget(GIntBig nLimit, GIntBig nFixedBytes, int nBuffers,
+                     size_t nMaxBufferBytes, int verbose)
+{
+	if(nLimit <= 0) return nMaxBufferBytes;
+	if(nBuffers < 1) nBuffers = 1;
+
+	GIntBig nReserve = nLimit / 8 > CCAP_MEM_RESERVE_MIN ? nLimit / 8 : CCAP_MEM_RESERVE_MIN;
+	GIntBig nFree = nLimit - nReserve - nFixedBytes;
+	if(nFree < 2 * CCAP_MEM_CACHE_MIN){
+		fprintf(stderr,"Warning: a memory limit of %lld MB is too small to work in, using the smallest buffers and a %d MB cache\n",
+		        nLimit / (1024*1024), CCAP_MEM_CACHE_MIN / (1024*1024));
+		nFree = 2 * CCAP_MEM_CACHE_MIN;
+	}
+
+	GIntBig nBufferBytes = nFree / 2 / nBuffers;
+	if(nBufferBytes > (GIntBig)nMaxBufferBytes) nBufferBytes = nMaxBufferBytes;
+	GIntBig nCache = nFree - nBufferBytes * nBuffers;
+
+	GDALSetCacheMax64(nCache);
+	verbose && fprintf(stderr,"Memory limit %lld MB: block cache %lld MB, %d buffers of %lld MB, %lld MB for tables\n",
+	                   nLimit / (1024*1024), nCache / (1024*1024), nBuffers,
+	                   nBufferBytes / (1024*1024), nFixedBytes / (1024*1024));
+	return (size_t)nBufferBytes;
+}
+
+/************************************************************************/
+/*                            CCAPPeakRSS()                             */
+/************************************************************************/
+
+GIntBig CCAPPeakRSS()
+{
+	struct rusage sUsage;
+	if(getrusage(RUSAGE_SELF, &sUsage) != 0) return 0;
+	return (GIntBig)sUsage.ru_maxrss * 1024; // kilobytes on Linux
+}
+
+/************************************************************************/
+/*                          CCAPReportPeakRSS()                         */
+/************************************************************************/
+
+void CCAPReportPeakRSS(GIntBig nLimit)
+{
+	GIntBig nPeak = CCAPPeakRSS();
+	fprintf(stderr,"Peak memory use (RSS) %lld MB",nPeak / (1024*1024));
+	if(nLimit > 0){
+		fprintf(stderr," of a %lld MB limit%s",nLimit / (1024*1024), nPeak > nLimit ? ", OVER THE LIMIT" : "");
+	}
+	fprintf(stderr,"\n");
+}
@@ -0,0 +1,33 @@
+#ifndef CCAP_MEM_H
+#define CCAP_MEM_H
+
+#include <stddef.h>
+#include "cpl_port.h"
+
+/*
+* Memory ceiling for the ccap tools (-m / --mem-limit). The limit is
+* split between the GDAL block cache and the tool's own strip buffers,
+* after setting aside what the tool already knows it needs (tables) and
+* some room for everything else.
+*/
+
+// bytes in a size like 2048 (megabytes), 512M, 8G or 64K. -1 if it doesn't parse
+GIntBig CCAPParseMemSize(const char *pszSize);
+
+/*
+* Size the block cache and the buffers for a limit of nLimit bytes, of
+* which nFixedBytes are already spoken for. The tool will hold nBuffers
+* buffers at once, each of at most nMaxBufferBytes; the size each one may
+* be is returned. With no limit (nLimit <= 0) the cache is left alone
+* and nMaxBufferBytes comes back.
+*/
+size_t CCAPMemBudget(GIntBig nLimit, GIntBig nFixedBytes, int nBuffers,
+                     size_t nMaxBufferBytes, int verbose);
+
+// peak resident set size of the process so far, in bytes
+GIntBig CCAPPeakRSS();
+
+// print the peak RSS to stderr, and say so if it went over nLimit
+void CCAPReportPeakRSS(GIntBig nLimit);
+
+#endif
@@ -0,0 +1,190 @@
+#include <math.h>
+#include <strings.h>
+#include <algorithm>
+#include "ccap_order.h"
+
+/* keys are taken on a 2^16 by 2^16 grid of cells */
+#define CCAP_ORDER_BITS 16
+
+static const char *apszOrderNames[] = { "layer", "zorder", "hilbert", "str" };
+
+/************************************************************************/
+/*                         CCAPOrderFromName()                          */
+/************************************************************************/
+
+int CCAPOrderFromName(const char *pszName)
+{
+	for(int i = 0; i < (int)(sizeof(apszOrderNames) / sizeof(apszOrderNames[0])); i++){
+		if(strcasecmp(pszName, apszOrderNames[i]) == 0) return i;
+	}
+	return -1;
+}
+
+const char *CCAPOrderName(int nOrder)
+{
+	return apszOrderNames[nOrder];
+}
+
+/************************************************************************/
+/*                              cellOf()                                */
+/*                                                                      */
+/*      Grid cell of the center of an envelope, clamped to the grid.    */
+/************************************************************************/
+
+static void cellOf(const CCAPEnvelope &oEnv, double dfCellXSize, double dfCellYSize,
+                   unsigned *pnX, unsigned *pnY)
+{
+	double dfX = floor((oEnv.dfXMin + oEnv.dfXMax) / 2 / dfCellXSize);
+	double dfY = floor((oEnv.dfYMin + oEnv.dfYMax) / 2 / dfCellYSize);
+	double dfMax = (1 << CCAP_ORDER_BITS) - 1;
+
+	*pnX = (unsigned)(dfX < 0 ? 0 : dfX > dfMax ? dfMax : dfX);
+	*pnY = (unsigned)(dfY < 0 ? 0 : dfY > dfMax ? dfMax : dfY);
+}
+
+/************************************************************************/
+/*                              zorderKey()                             */
+/************************************************************************/
+
+static unsigned long long zorderKey(unsigned x, unsigned y)
+{
+	unsigned long long nKey = 0;
+	for(int b = CCAP_ORDER_BITS - 1; b >= 0; b--){
+		nKey = (nKey << 2) | (((y >> b) & 1) << 1) | ((x >> b) & 1);
+	}
+	return nKey;
+}
+
+/************************************************************************/
+/*                             hilbertKey()                             */
+/*                                                                      */
+/*      Distance along the Hilbert curve filling the grid. Unlike       */
+/*      Z-order the curve never jumps, so consecutive keys are always   */
+/*      adjacent cells.                                                 */
+/************************************************************************/
+
+static unsigned long long hilbertKey(unsigned x, unsigned y)
+{
+	unsigned n = 1u << CCAP_ORDER_BITS;
+	unsigned long long nKey = 0;
+	for(unsigned s = n / 2; s > 0; s /= 2){
+		unsigned rx = (x & s) > 0;
+		unsigned ry = (y & s) > 0;
+		nKey += (unsigned long long)s * s * ((3 * rx) ^ ry);
+		// rotate the quadrant so the sub-curve is in the standard orientation
+		if(ry == 0){
+			if(rx == 1){
+				x = n - 1 - x;
+				y = n - 1 - y;
+			}
+			unsigned t = x;
+			x = y;
+			y = t;
+		}
+	}
+	return nKey;
+}
+
+/************************************************************************/
+/*                          CCAPOrderEnvelopes()                        */
+/************************************************************************/
+
+typedef struct {
+	unsigned long long nKey;
+	double dfX, dfY; // envelope center
+	int nIndex;
+} OrderItem;
+
+static bool keyLess(const OrderItem &a, const OrderItem &b) { return a.nKey < b.nKey; }
+static bool xLess(const OrderItem &a, const OrderItem &b) { return a.dfX < b.dfX; }
+static bool yLess(const OrderItem &a, const OrderItem &b) { return a.dfY < b.dfY; }
+
+/* an STR leaf: items nStart to nEnd of the sorted list */
+typedef struct {
+	unsigned long long nKey;
+	size_t nStart, nEnd;
+} OrderLeaf;
+
+static bool leafLess(const OrderLeaf &a, const OrderLeaf &b) { return a.nKey < b.nKey; }
+
+void CCAPOrderEnvelopes(const std::vector<CCAPEnvelope> &aoEnvelopes, int nOrder,
+                        double dfCellXSize, double dfCellYSize, int nGroupSize,
+                        std::vector<int> &anOrder, std::vector<size_t> &anGroups)
+{
+	size_t nItems = aoEnvelopes.size();
+	size_t nGroup = nOrder == CCAP_ORDER_LAYER || nGroupSize < 1 ? 1 : nGroupSize;
+	if(dfCellXSize < 1) dfCellXSize = 1;
+	if(dfCellYSize < 1) dfCellYSize = 1;
+
+	std::vector<OrderItem> aoItems(nItems);
+	for(size_t i = 0; i < nItems; i++){
+		unsigned x, y;
+		cellOf(aoEnvelopes[i], dfCellXSize, dfCellYSize, &x, &y);
+		aoItems[i].nKey = nOrder == CCAP_ORDER_ZORDER ? zorderKey(x, y) : hilbertKey(x, y);
+		aoItems[i].dfX = (aoEnvelopes[i].dfXMin + aoEnvelopes[i].dfXMax) / 2;
+		aoItems[i].dfY = (aoEnvelopes[i].dfYMin + aoEnvelopes[i].dfYMax) / 2;
+		aoItems[i].nIndex = (int)i;
+	}
+
+	anGroups.clear();
+	if(nOrder == CCAP_ORDER_STR){
+		/*
+		* Sort-Tile-Recursive packing: cut the features into vertical slices
+		* by x, each slice into leaves of nGroup by y. A leaf is a tight
+		* cluster of features, and the leaves are visited along the Hilbert
+		* curve by the center of their bounding box.
+		*/
+		size_t nLeaves = (nItems + nGroup - 1) / nGroup;
+		size_t nSliceItems = (size_t)ceil(sqrt((double)nLeaves)) * nGroup;
+		std::stable_sort(aoItems.begin(), aoItems.end(), xLess);
+
+		std::vector<OrderLeaf> aoLeaves;
+		for(size_t s = 0; s < nItems; s += nSliceItems){
+			size_t sEnd = std::min(s + nSliceItems, nItems);
+			std::stable_sort(aoItems.begin() + s, aoItems.begin() + sEnd, yLess);
+			for(size_t l = s; l < sEnd; l += nGroup){
+				size_t lEnd = std::min(l + nGroup, sEnd);
+				CCAPEnvelope oLeaf = aoEnvelopes[aoItems[l].nIndex];
+				for(size_t k = l + 1; k < lEnd; k++){
+					const CCAPEnvelope &oEnv = aoEnvelopes[aoItems[k].nIndex];
+					oLeaf.dfXMin = std::min(oLeaf.dfXMin, oEnv.dfXMin);
+					oLeaf.dfYMin = std::min(oLeaf.dfYMin, oEnv.dfYMin);
+					oLeaf.dfXMax = std::max(oLeaf.dfXMax, oEnv.dfXMax);
+					oLeaf.dfYMax = std::max(oLeaf.dfYMax, oEnv.dfYMax);
+				}
+				// inside the leaf, walk the features along the curve too
+				std::stable_sort(aoItems.begin() + l, aoItems.begin() + lEnd, keyLess);
+
+				OrderLeaf oLeafItem;
+				unsigned x, y;
+				cellOf(oLeaf, dfCellXSize, dfCellYSize, &x, &y);
+				oLeafItem.nKey = hilbertKey(x, y);
+				oLeafItem.nStart = l;
+				oLeafItem.nEnd = lEnd;
+				aoLeaves.push_back(oLeafItem);
+			}
+		}
+		std::stable_sort(aoLeaves.begin(), aoLeaves.end(), leafLess);
+
+		anOrder.clear();
+		for(size_t l = 0; l < aoLeaves.size(); l++){
+			anGroups.push_back(anOrder.size());
+			for(size_t k = aoLeaves[l].nStart; k < aoLeaves[l].nEnd; k++){
+				anOrder.push_back(aoItems[k].nIndex);
+			}
+		}
+		anGroups.push_back(anOrder.size());
+		return;
+	}
+
+	// ties keep the layer order
+	if(nOrder != CCAP_ORDER_LAYER){
+		std::stable_sort(aoItems.begin(), aoItems.end(), keyLess);
+	}
+	anOrder.resize(nItems);
+	for(size_t i = 0; i < nItems; i++){
+		anOrder[i] = aoItems[i].nIndex;
+		if(i % nGroup == 0) anGroups.push_back(i);
+	}
+	anGroups.push_back(nItems);
+}
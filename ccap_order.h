@@ -0,0 +1,46 @@
+#ifndef CCAP_ORDER_H
+#define CCAP_ORDER_H
+
+#include <vector>
+
+/*
+* Bounding box of a feature in raster pixel/line space.
+*/
+typedef struct {
+	double dfXMin;
+	double dfYMin;
+	double dfXMax;
+	double dfYMax;
+} CCAPEnvelope;
+
+/* orders for CCAPOrderEnvelopes() */
+enum {
+	CCAP_ORDER_LAYER,   // as read from the layer, one feature per group
+	CCAP_ORDER_ZORDER,  // Z-order (Morton) key of the envelope center
+	CCAP_ORDER_HILBERT, // Hilbert key of the envelope center
+	CCAP_ORDER_STR      // Sort-Tile-Recursive R-tree leaves, in Hilbert order
+};
+
+// -1 for an unknown name
+int CCAPOrderFromName(const char *pszName);
+const char *CCAPOrderName(int nOrder);
+
+/************************************************************************/
+/*                         CCAPOrderEnvelopes()                         */
+/*                                                                      */
+/*      Put features in an order where neighbours in the list are       */
+/*      neighbours on the raster, so the blocks one feature reads are   */
+/*      still in the block cache for the next. Keys are taken on a grid */
+/*      of dfCellXSize by dfCellYSize pixels (the raster's blocks).     */
+/*                                                                      */
+/*      anOrder gets the envelope indexes in processing order. The      */
+/*      features are also cut into groups of about nGroupSize that      */
+/*      share blocks, to be handed to one worker together: group g is   */
+/*      anOrder[anGroups[g]] up to anOrder[anGroups[g+1]].              */
+/************************************************************************/
+
+void CCAPOrderEnvelopes(const std::vector<CCAPEnvelope> &aoEnvelopes, int nOrder,
+                        double dfCellXSize, double dfCellYSize, int nGroupSize,
+                        std::vector<int> &anOrder, std::vector<size_t> &anGroups);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef CCAP_QUEUE_H
+#define CCAP_QUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+/************************************************************************/
+/*                              CCAPQueue                               */
+/*                                                                      */
+/*      Bounded blocking queue for handing work between threads.        */
+/*      push() waits while the queue is full; pop() waits for an item   */
+/*      and returns false once finish() was called and it is drained.   */
+/************************************************************************/
+
+template <class T>
+class CCAPQueue
+{
+public:
+	CCAPQueue(size_t nMax) : nMax(nMax), bDone(false) {}
+
+	void push(const T &oItem){
+		std::unique_lock<std::mutex> oLock(oMutex);
+		oNotFull.wait(oLock, [this]{ return aoItems.size() < nMax; });
+		aoItems.push_back(oItem);
+		oNotEmpty.notify_one();
+	}
+	bool pop(T &oItem){
+		std::unique_lock<std::mutex> oLock(oMutex);
+		oNotEmpty.wait(oLock, [this]{ return bDone || !aoItems.empty(); });
+		if(aoItems.empty()) return false;
+		oItem = aoItems.front();
+		aoItems.pop_front();
+		oNotFull.notify_one();
+		return true;
+	}
+	void finish(){
+		std::unique_lock<std::mutex> oLock(oMutex);
+		bDone = true;
+		oNotEmpty.notify_all();
+	}
+
+private:
+	size_t nMax;
+	bool bDone;
+	std::deque<T> aoItems;
+	std::mutex oMutex;
+	std::condition_variable oNotFull, oNotEmpty;
+};
+
+#endif
@@ -0,0 +1,438 @@
+#include <math.h>
+#include <algorithm>
+#include "ogrsf_frmts.h"
+#include "ccap_rasterize.h"
+
+/************************************************************************/
+/*                               clear()                                */
+/************************************************************************/
+
+void CCAPRasterizer::clear()
+{
+	aoEdges.clear();
+	aoTies.clear();
+	dfMinX = dfMinY = HUGE_VAL;
+	dfMaxX = dfMaxY = -HUGE_VAL;
+}
+
+/************************************************************************/
+/*                              addRing()                               */
+/*                                                                      */
+/*      Add one ring in pixel/line coordinates. The ring is closed      */
+/*      automatically if the last point is not the first.               */
+/************************************************************************/
+
+void CCAPRasterizer::addRing(const double *padfX, const double *padfY, int nPoints, int nOrient)
+{
+	if(nPoints < 2) return;
+
+	// twice the signed area, to see which way the ring winds
+	int nFlip = 1;
+	if(nOrient != 0){
+		double dfArea = 0;
+		for(int i = 0; i < nPoints; i++){
+			int iNext = (i + 1) % nPoints;
+			dfArea += padfX[i] * padfY[iNext] - padfX[iNext] * padfY[i];
+		}
+		if((dfArea < 0 && nOrient > 0) || (dfArea > 0 && nOrient < 0)) nFlip = -1;
+	}
+
+	for(int i = 0; i < nPoints; i++){
+		int iNext = (i + 1) % nPoints;
+		double x0 = padfX[i], y0 = padfY[i];
+		double x1 = padfX[iNext], y1 = padfY[iNext];
+
+		dfMinX = x0 < dfMinX ? x0 : dfMinX;
+		dfMaxX = x0 > dfMaxX ? x0 : dfMaxX;
+		dfMinY = y0 < dfMinY ? y0 : dfMinY;
+		dfMaxY = y0 > dfMaxY ? y0 : dfMaxY;
+
+		// A pixel center sitting exactly on the boundary is not Within() the
+		// polygon. The crossing test handles that for sloped edges; vertices
+		// and horizontal edges on a center line have to be remembered.
+		if(y0 - 0.5 == floor(y0 - 0.5)){
+			Tie oTie;
+			oTie.dfY = y0;
+			oTie.dfXMin = (y1 == y0 && x1 < x0) ? x1 : x0;
+			oTie.dfXMax = (y1 == y0 && x1 > x0) ? x1 : x0;
+			aoTies.push_back(oTie);
+		}
+
+		if(y0 == y1) continue; // horizontal edges never cross a scanline
+
+		Edge oEdge;
+		if(y0 < y1){
+			oEdge.dfX0 = x0; oEdge.dfY0 = y0;
+			oEdge.dfX1 = x1; oEdge.dfY1 = y1;
+			oEdge.nDir = nFlip;
+		}else{
+			oEdge.dfX0 = x1; oEdge.dfY0 = y1;
+			oEdge.dfX1 = x0; oEdge.dfY1 = y0;
+			oEdge.nDir = -nFlip;
+		}
+		aoEdges.push_back(oEdge);
+	}
+}
+
+/************************************************************************/
+/*                            addGeometry()                             */
+/*                                                                      */
+/*      Add all the rings of a polygon, multipolygon or collection.     */
+/*      Points and lines have no area and are ignored. Exterior rings   */
+/*      are turned one way and holes the other for getCoverage().       */
+/************************************************************************/
+
+void CCAPRasterizer::addGeometry(OGRGeometry *poGeom)
+{
+	if(poGeom == NULL) return;
+
+	switch(wkbFlatten(poGeom->getGeometryType())){
+		case wkbPolygon:
+		{
+			OGRPolygon *poPoly = (OGRPolygon *)poGeom;
+			std::vector<double> adfX, adfY;
+			for(int iRing = -1; iRing < poPoly->getNumInteriorRings(); iRing++){
+				OGRLinearRing *poRing = iRing < 0 ? poPoly->getExteriorRing() : poPoly->getInteriorRing(iRing);
+				if(poRing == NULL) continue;
+				int nPoints = poRing->getNumPoints();
+				adfX.resize(nPoints);
+				adfY.resize(nPoints);
+				for(int i = 0; i < nPoints; i++){
+					adfX[i] = poRing->getX(i);
+					adfY[i] = poRing->getY(i);
+				}
+				addRing(adfX.size() ? &adfX[0] : NULL, adfY.size() ? &adfY[0] : NULL, nPoints, iRing < 0 ? 1 : -1);
+			}
+			break;
+		}
+		case wkbMultiPolygon:
+		case wkbGeometryCollection:
+		{
+			OGRGeometryCollection *poColl = (OGRGeometryCollection *)poGeom;
+			for(int i = 0; i < poColl->getNumGeometries(); i++){
+				addGeometry(poColl->getGeometryRef(i));
+			}
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+/************************************************************************/
+/*                             getBounds()                              */
+/************************************************************************/
+
+void CCAPRasterizer::getBounds(double *pdfMinX, double *pdfMinY, double *pdfMaxX, double *pdfMaxY) const
+{
+	*pdfMinX = dfMinX;
+	*pdfMinY = dfMinY;
+	*pdfMaxX = dfMaxX;
+	*pdfMaxY = dfMaxY;
+}
+
+/************************************************************************/
+/*                              getSpans()                              */
+/*                                                                      */
+/*      Walk the window a line at a time keeping an active edge list.   */
+/*      The crossings of the active edges with the line of pixel        */
+/*      centers y+.5 are sorted and paired up; each pair is one span.   */
+/************************************************************************/
+
+void CCAPRasterizer::getSpans(int nXMin, int nYMin, int nXMax, int nYMax,
+															std::vector<CCAPSpan> &aoSpans) const
+{
+	if(aoEdges.empty() || nXMin >= nXMax || nYMin >= nYMax) return;
+
+	// edges sorted by their low end so they can be activated in order
+	std::vector<Edge> aoSorted(aoEdges);
+	std::sort(aoSorted.begin(), aoSorted.end(),
+						[](const Edge &a, const Edge &b) { return a.dfY0 < b.dfY0; });
+
+	std::vector<const Edge *> apoActive;
+	std::vector<double> adfCross;
+	std::vector<CCAPSpan> aoLine;
+
+	// no need to look at lines the polygon can't reach
+	int nYStart = nYMin;
+	if(dfMinY - 0.5 > nYStart) nYStart = (int)floor(dfMinY - 0.5);
+	int nYEnd = nYMax;
+	if(dfMaxY + 0.5 < nYEnd) nYEnd = (int)ceil(dfMaxY + 0.5);
+
+	size_t iNext = 0;
+	for(int y = nYStart; y < nYEnd; y++){
+		double yc = y + 0.5;
+
+		// activate edges starting at or above this line, drop the finished ones.
+		// An edge covers yc when y0 <= yc < y1, so shared vertices count once.
+		while(iNext < aoSorted.size() && aoSorted[iNext].dfY0 <= yc){
+			apoActive.push_back(&aoSorted[iNext++]);
+		}
+		size_t nKeep = 0;
+		for(size_t i = 0; i < apoActive.size(); i++){
+			if(apoActive[i]->dfY1 > yc) apoActive[nKeep++] = apoActive[i];
+		}
+		apoActive.resize(nKeep);
+		if(apoActive.empty()) continue;
+
+		adfCross.clear();
+		for(size_t i = 0; i < apoActive.size(); i++){
+			const Edge *e = apoActive[i];
+			adfCross.push_back(e->dfX0 + (yc - e->dfY0) * (e->dfX1 - e->dfX0) / (e->dfY1 - e->dfY0));
+		}
+		std::sort(adfCross.begin(), adfCross.end());
+
+		// fill between pairs. The pixel center x+.5 has to be strictly between
+		// the crossings, so xa < x+.5 < xb.
+		aoLine.clear();
+		for(size_t i = 0; i + 1 < adfCross.size(); i += 2){
+			double dfStart = floor(adfCross[i] - 0.5) + 1;
+			double dfEnd = ceil(adfCross[i+1] - 0.5);
+			if(dfStart < nXMin) dfStart = nXMin;
+			if(dfEnd > nXMax) dfEnd = nXMax;
+			if(dfStart >= dfEnd) continue;
+			CCAPSpan oSpan;
+			oSpan.nLine = y;
+			oSpan.nXStart = (int)dfStart;
+			oSpan.nXEnd = (int)dfEnd;
+			oSpan.nCover = CCAP_COVER_SCALE;
+			aoLine.push_back(oSpan);
+		}
+
+		// knock out pixel centers that sit on a vertex or horizontal edge
+		for(size_t t = 0; t < aoTies.size() && !aoLine.empty(); t++){
+			if(aoTies[t].dfY != yc) continue;
+			double dfA = ceil(aoTies[t].dfXMin - 0.5);
+			double dfB = floor(aoTies[t].dfXMax - 0.5) + 1; // exclusive
+			std::vector<CCAPSpan> aoCut;
+			for(size_t s = 0; s < aoLine.size(); s++){
+				CCAPSpan oSpan = aoLine[s];
+				if(dfB <= oSpan.nXStart || dfA >= oSpan.nXEnd){
+					aoCut.push_back(oSpan);
+					continue;
+				}
+				if(dfA > oSpan.nXStart){
+					CCAPSpan oLeft = oSpan;
+					oLeft.nXEnd = (int)dfA;
+					aoCut.push_back(oLeft);
+				}
+				if(dfB < oSpan.nXEnd){
+					CCAPSpan oRight = oSpan;
+					oRight.nXStart = (int)dfB;
+					aoCut.push_back(oRight);
+				}
+			}
+			aoLine.swap(aoCut);
+		}
+
+		aoSpans.insert(aoSpans.end(), aoLine.begin(), aoLine.end());
+	}
+}
+
+/************************************************************************/
+/*                             CoverCell                                */
+/*                                                                      */
+/*      What the boundary inside one pixel adds to the coverage. The    */
+/*      edges crossing the pixel cover dfArea of it, and dfCover of     */
+/*      every pixel to its right on the same line.                      */
+/************************************************************************/
+
+struct CoverCell {
+	int nLine;
+	int nX;
+	double dfArea;
+	double dfCover;
+};
+
+static bool coverCellLess(const CoverCell &a, const CoverCell &b)
+{
+	if(a.nLine != b.nLine) return a.nLine < b.nLine;
+	return a.nX < b.nX;
+}
+
+/*
+* Add the piece of an edge running from (xa, ya) to (xb, yb) inside pixel
+* (x, y), where dfDir is +1 or -1 for the way its ring winds. The part of
+* the pixel to the right of the piece is dy (1 - its mean x in the pixel).
+* Everything left of the window is folded into one cell at nXMin - 1,
+* which only carries cover; pieces right of it change nothing inside.
+*/
+static void addCoverPiece(std::vector<CoverCell> &aoCells, int y, int x, int nXMin, int nXMax,
+                          double xa, double ya, double xb, double yb, double dfDir)
+{
+	double dy = (yb - ya) * dfDir;
+	if(dy == 0 || x >= nXMax) return;
+
+	CoverCell oCell;
+	oCell.nLine = y;
+	oCell.dfCover = dy;
+	if(x < nXMin){
+		oCell.nX = nXMin - 1;
+		oCell.dfArea = 0;
+	}else{
+		oCell.nX = x;
+		oCell.dfArea = dy * (1 - ((xa + xb) * 0.5 - x));
+	}
+	aoCells.push_back(oCell);
+}
+
+/*
+* The summed cover as nCover. Overlapping parts of a multipolygon count
+* once, though where they overlap on a boundary pixel it is only capped.
+*/
+static unsigned int coverOf(double dfSum)
+{
+	dfSum = fabs(dfSum);
+	return dfSum >= 1 ? CCAP_COVER_SCALE : (unsigned int)(dfSum * CCAP_COVER_SCALE + 0.5);
+}
+
+/*
+* Append pixels x0 up to x1 on line y, running whole pixels on from the
+* span before when they meet it.
+*/
+static void appendCover(std::vector<CCAPSpan> &aoSpans, int y, int x0, int x1, unsigned int nCover)
+{
+	if(nCover == 0) return;
+	if(!aoSpans.empty() && nCover == CCAP_COVER_SCALE){
+		CCAPSpan &oLast = aoSpans.back();
+		if(oLast.nLine == y && oLast.nXEnd == x0 && oLast.nCover == CCAP_COVER_SCALE){
+			oLast.nXEnd = x1;
+			return;
+		}
+	}
+	CCAPSpan oSpan;
+	oSpan.nLine = y;
+	oSpan.nXStart = x0;
+	oSpan.nXEnd = x1;
+	oSpan.nCover = nCover;
+	aoSpans.push_back(oSpan);
+}
+
+/************************************************************************/
+/*                            getCoverage()                             */
+/*                                                                      */
+/*      Each edge is split at every pixel boundary it crosses, and the  */
+/*      pieces leave their area and cover in the pixels they pass       */
+/*      through, much as font rasterizers anti-alias. Walking a line    */
+/*      left to right and summing the cover then gives the exact area   */
+/*      inside each pixel. Only pixels an edge passes through are ever  */
+/*      stored; between them the coverage doesn't change, and the       */
+/*      pixels come out as runs (whole ones, mostly), so the work grows */
+/*      with the length of the boundary rather than the area.           */
+/************************************************************************/
+
+void CCAPRasterizer::getCoverage(int nXMin, int nYMin, int nXMax, int nYMax,
+                                 std::vector<CCAPSpan> &aoSpans) const
+{
+	if(aoEdges.empty() || nXMin >= nXMax || nYMin >= nYMax) return;
+
+	std::vector<CoverCell> aoCells;
+	for(size_t i = 0; i < aoEdges.size(); i++){
+		const Edge &e = aoEdges[i];
+		double dfYTop = e.dfY0 > nYMin ? e.dfY0 : nYMin;
+		double dfYBottom = e.dfY1 < nYMax ? e.dfY1 : nYMax;
+		if(dfYTop >= dfYBottom) continue;
+		double dfSlope = (e.dfX1 - e.dfX0) / (e.dfY1 - e.dfY0);
+
+		for(int y = (int)floor(dfYTop); y < dfYBottom; y++){
+			// the edge inside this line
+			double ya = y > dfYTop ? y : dfYTop;
+			double yb = y + 1 < dfYBottom ? y + 1 : dfYBottom;
+			double xa = e.dfX0 + (ya - e.dfY0) * dfSlope;
+			double xb = e.dfX0 + (yb - e.dfY0) * dfSlope;
+			if(ya == e.dfY0) xa = e.dfX0;
+			if(yb == e.dfY1) xb = e.dfX1;
+
+			// what lies left of the window only adds cover, and what lies
+			// right of it nothing, so walk just the part inside it
+			if(xa < nXMin || xb < nXMin){
+				if(xa <= nXMin && xb <= nXMin){
+					addCoverPiece(aoCells, y, nXMin - 1, nXMin, nXMax, xa, ya, xb, yb, e.nDir);
+					continue;
+				}
+				double yc = ya + (nXMin - xa) * (yb - ya) / (xb - xa);
+				if(xa < nXMin){
+					addCoverPiece(aoCells, y, nXMin - 1, nXMin, nXMax, xa, ya, nXMin, yc, e.nDir);
+					xa = nXMin;
+					ya = yc;
+				}else{
+					addCoverPiece(aoCells, y, nXMin - 1, nXMin, nXMax, nXMin, yc, xb, yb, e.nDir);
+					xb = nXMin;
+					yb = yc;
+				}
+			}
+			if(xa >= nXMax && xb >= nXMax) continue;
+			if(xa > nXMax || xb > nXMax){
+				double yc = ya + (nXMax - xa) * (yb - ya) / (xb - xa);
+				if(xa > nXMax){
+					xa = nXMax;
+					ya = yc;
+				}else{
+					xb = nXMax;
+					yb = yc;
+				}
+			}
+
+			// the pixels the piece passes through, first to last
+			int xcell, xlast;
+			if(xb > xa){
+				xcell = (int)floor(xa);
+				xlast = (int)ceil(xb) - 1;
+			}else if(xb < xa){
+				xcell = (int)ceil(xa) - 1;
+				xlast = (int)floor(xb);
+			}else{
+				xcell = xlast = (int)floor(xa);
+			}
+			if(xcell == xlast){
+				addCoverPiece(aoCells, y, xcell, nXMin, nXMax, xa, ya, xb, yb, e.nDir);
+				continue;
+			}
+
+			// across several pixels; cut it at each pixel boundary
+			int nStep = xb > xa ? 1 : -1;
+			double dfInvSlope = (yb - ya) / (xb - xa);
+			double xp = xa, yp = ya;
+			for(int x = xcell; ; x += nStep){
+				double xn = nStep > 0 ? x + 1 : x;
+				if(x == xlast) xn = xb;
+				double yn = x == xlast ? yb : ya + (xn - xa) * dfInvSlope;
+				addCoverPiece(aoCells, y, x, nXMin, nXMax, xp, yp, xn, yn, e.nDir);
+				if(x == xlast) break;
+				xp = xn;
+				yp = yn;
+			}
+		}
+	}
+	if(aoCells.empty()) return;
+
+	std::sort(aoCells.begin(), aoCells.end(), coverCellLess);
+
+	size_t c = 0;
+	while(c < aoCells.size()){
+		int y = aoCells[c].nLine;
+		double dfRunning = 0;  // coverage of the pixels between boundary pixels
+		int nNextX = nXMin;    // first pixel not yet output
+		while(c < aoCells.size() && aoCells[c].nLine == y){
+			int x = aoCells[c].nX;
+			double dfArea = 0, dfCover = 0;
+			for(; c < aoCells.size() && aoCells[c].nLine == y && aoCells[c].nX == x; c++){
+				dfArea += aoCells[c].dfArea;
+				dfCover += aoCells[c].dfCover;
+			}
+			if(x < nXMin){
+				dfRunning += dfCover;
+				continue;
+			}
+
+			// the pixels since the last boundary pixel
+			if(x > nNextX) appendCover(aoSpans, y, nNextX, x, coverOf(dfRunning));
+
+			appendCover(aoSpans, y, x, x + 1, coverOf(dfRunning + dfArea));
+			dfRunning += dfCover;
+			nNextX = x + 1;
+		}
+		// the polygon goes on past the window
+		if(nNextX < nXMax) appendCover(aoSpans, y, nNextX, nXMax, coverOf(dfRunning));
+	}
+}
@@ -0,0 +1,75 @@
+#ifndef CCAP_RASTERIZE_H
+#define CCAP_RASTERIZE_H
+
+#include <vector>
+
+class OGRGeometry;
+
+/* nCover of a pixel the polygon covers entirely */
+#define CCAP_COVER_SCALE 1000000
+
+/*
+* A run of covered pixels on one raster line. Pixels nXStart up to but not
+* including nXEnd on line nLine have their centers inside the polygon, or
+* from getCoverage(), nCover millionths of each of them is inside it.
+*/
+typedef struct {
+	int nLine;
+	int nXStart;
+	int nXEnd;
+	unsigned int nCover;
+} CCAPSpan;
+
+/************************************************************************/
+/*                            CCAPRasterizer                            */
+/*                                                                      */
+/*      Scanline rasterizer for polygons already in pixel/line          */
+/*      coordinates (see TransformCutlineToSource). A pixel is covered  */
+/*      when its center lies strictly inside the polygon, which is the  */
+/*      same rule as OGRPoint::Within() on (x+.5, y+.5). Rings are      */
+/*      filled with the even-odd rule so holes and multipolygons work.  */
+/*                                                                      */
+/*      getCoverage() measures the area of each pixel inside instead.   */
+/*      That sums the signed area under each edge, so it relies on      */
+/*      addGeometry() winding holes against their exterior rings.       */
+/************************************************************************/
+
+class CCAPRasterizer
+{
+public:
+	CCAPRasterizer() { clear(); }
+	void clear();
+	// nOrient of 1 or -1 turns the ring to wind that way for getCoverage(); 0 leaves it
+	void addRing(const double *padfX, const double *padfY, int nPoints, int nOrient = 0);
+	void addGeometry(OGRGeometry *poGeom);
+	int isEmpty() const { return aoEdges.empty(); }
+
+	// pixel/line bounding box of everything added so far
+	void getBounds(double *pdfMinX, double *pdfMinY, double *pdfMaxX, double *pdfMaxY) const;
+
+	// append the covered spans inside the window [nXMin,nXMax) x [nYMin,nYMax)
+	// to aoSpans, in line order and left to right within a line.
+	void getSpans(int nXMin, int nYMin, int nXMax, int nYMax,
+								std::vector<CCAPSpan> &aoSpans) const;
+
+	// the same, but with the exact share of each pixel inside the polygon:
+	// whole pixels as runs, pixels on the boundary one at a time
+	void getCoverage(int nXMin, int nYMin, int nXMax, int nYMax,
+	                 std::vector<CCAPSpan> &aoSpans) const;
+
+private:
+	struct Edge {
+		double dfX0, dfY0; // end with the smaller y
+		double dfX1, dfY1; // end with the larger y
+		int nDir;          // 1 if the ring runs from the first end to the second, else -1
+	};
+	struct Tie {
+		double dfY;
+		double dfXMin, dfXMax;
+	};
+	std::vector<Edge> aoEdges; // non-horizontal edges
+	std::vector<Tie> aoTies;   // boundary pieces lying exactly on a line of pixel centers
+	double dfMinX, dfMinY, dfMaxX, dfMaxY;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "ccap_scheme.h"
+
+/* NLCD: water, ice, the four developed, barren, three forests, two shrub,
+   grassland, the Alaska only sedge, lichen and moss, pasture, crops and
+   the two wetlands */
+static const unsigned char abyNLCDCodes[] = { 11, 12, 21, 22, 23, 24, 31, 41, 42, 43, 51, 52,
+                                              71, 72, 73, 74, 81, 82, 90, 95 };
+
+static const CCAPScheme asSchemes[] = {
+	{ "ccap", 25, NULL },
+	{ "ccap8", 8, NULL },   // C-CAP collapsed to 8 classes, numbered 1 to 8
+	{ "nlcd", (int)sizeof(abyNLCDCodes), abyNLCDCodes },
+	{ NULL, 0, NULL }
+};
+
+/************************************************************************/
+/*                         CCAPSchemeFromName()                         */
+/************************************************************************/
+
+int CCAPSchemeFromName(const char *pszName, CCAPScheme *psScheme)
+{
+	for(int i = 0; asSchemes[i].pszName != NULL; i++){
+		if(strcasecmp(pszName, asSchemes[i].pszName) == 0){
+			*psScheme = asSchemes[i];
+			return 1;
+		}
+	}
+
+	// any other legend numbered 1 to N
+	char *pszEnd = NULL;
+	long nClasses = strtol(pszName, &pszEnd, 10);
+	if(pszEnd != pszName && *pszEnd == '\0' && nClasses >= 1 && nClasses <= CCAP_MAX_SCHEME_CLASSES){
+		psScheme->pszName = pszName;
+		psScheme->nClasses = (int)nClasses;
+		psScheme->pabyCodes = NULL;
+		return 1;
+	}
+	fprintf(stderr,"Unknown class scheme %s, expected %s or a number of classes up to %d\n",
+	        pszName, CCAPSchemeNames(), CCAP_MAX_SCHEME_CLASSES);
+	return 0;
+}
+
+const char *CCAPSchemeNames()
+{
+	return "ccap, ccap8, nlcd";
+}
+
+/************************************************************************/
+/*                        CCAPSchemeClassTable()                        */
+/************************************************************************/
+
+void CCAPSchemeClassTable(const CCAPScheme *psScheme, unsigned char *pabyClasses)
+{
+	memset(pabyClasses, 0, 256);
+	for(int c = 1; c <= psScheme->nClasses; c++){
+		pabyClasses[psScheme->pabyCodes != NULL ? psScheme->pabyCodes[c-1] : c] = (unsigned char)c;
+	}
+}
+
+/************************************************************************/
+/*                        CCAPSchemeToClasses()                         */
+/************************************************************************/
+
+void CCAPSchemeToClasses(const unsigned char *pabyClasses, unsigned char *pabyPixels, size_t nPixels)
+{
+	for(size_t i = 0; i < nPixels; i++) pabyPixels[i] = pabyClasses[pabyPixels[i]];
+}
@@ -0,0 +1,60 @@
+#ifndef CCAP_SCHEME_H
+#define CCAP_SCHEME_H
+
+#include <stddef.h>
+
+/*
+* A class scheme: the legend of the single date rasters. Classes are
+* numbered 1 to nClasses with 0 the background, and a bivariate is
+* nClasses * (start - 1) + end, or 0 where either date is 0, so it runs
+* from 1 to nClasses squared. Legends whose pixel values aren't 1 to
+* nClasses (NLCD's 11, 21, ... 95) list their codes in pabyCodes, and
+* the single date pixels are turned into classes before combining.
+*
+* The tables the tools count into have a cell per bivariate value, so
+* a small scheme's tables are small: 65 cells for 8 classes against
+* C-CAP's 626. A scheme with no more than 15 classes has bivariates
+* that fit in a byte, and ccap2bivar writes them as Byte.
+*/
+typedef struct {
+	const char *pszName;
+	int nClasses;
+	const unsigned char *pabyCodes; // pixel value of class c at [c-1], NULL if the values are the classes
+} CCAPScheme;
+
+/* most classes a scheme can have, so bivariates fit in UInt16 */
+#define CCAP_MAX_SCHEME_CLASSES 255
+
+// "ccap" (25 classes, the default), "ccap8", "nlcd", or a number of classes
+// numbered from 1 for any other legend. FALSE with a message if it isn't one.
+int CCAPSchemeFromName(const char *pszName, CCAPScheme *psScheme);
+
+// the schemes known by name, for the usage messages
+const char *CCAPSchemeNames();
+
+static inline int CCAPSchemeBivariateMax(const CCAPScheme *psScheme)
+{
+	return psScheme->nClasses * psScheme->nClasses;
+}
+
+// cells in a table: one per bivariate value and 0
+static inline int CCAPSchemeCells(const CCAPScheme *psScheme)
+{
+	return CCAPSchemeBivariateMax(psScheme) + 1;
+}
+
+static inline int CCAPSchemeByteBivariate(const CCAPScheme *psScheme)
+{
+	return CCAPSchemeBivariateMax(psScheme) <= 255;
+}
+
+/*
+* The class of every pixel value, 0 for values outside the legend, in
+* a table of 256. Only needed for schemes with pabyCodes.
+*/
+void CCAPSchemeClassTable(const CCAPScheme *psScheme, unsigned char *pabyClasses);
+
+// replace pixel values by their classes with a table from CCAPSchemeClassTable()
+void CCAPSchemeToClasses(const unsigned char *pabyClasses, unsigned char *pabyPixels, size_t nPixels);
+
+#endif
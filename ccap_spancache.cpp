@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "gdal_priv.h"
+#include "cpl_conv.h"
+#include "cpl_string.h"
+#include "cpl_vsi.h"
+#include "ccap_spancache.h"
+#include "ccap_varint.h"
+
+/* bump when the rasterizer's idea of a covered pixel or the file layout changes */
+#define CCAP_SPANCACHE_VERSION 2
+
+static const char szMagic[8] = { 'C', 'C', 'A', 'P', 'S', 'P', 'N', '1' };
+
+/************************************************************************/
+/*                               fnv1a()                                */
+/************************************************************************/
+
+static GUIntBig fnv1a(const unsigned char *pabyData, size_t nBytes, GUIntBig nHash)
+{
+	for(size_t i = 0; i < nBytes; i++){
+		nHash ^= pabyData[i];
+		nHash *= 1099511628211ULL;
+	}
+	return nHash;
+}
+
+#define FNV_OFFSET 14695981039346656037ULL
+
+/************************************************************************/
+/*                              hashFile()                              */
+/************************************************************************/
+
+static int hashFile(const char *pszName, GUIntBig *pnHash, GUIntBig *pnSize)
+{
+	VSILFILE *fp = VSIFOpenL(pszName, "rb");
+	if(fp == NULL) return FALSE;
+
+	std::vector<unsigned char> abyBuf(1024*1024);
+	size_t nRead;
+	*pnHash = FNV_OFFSET;
+	*pnSize = 0;
+	while((nRead = VSIFReadL(&abyBuf[0], 1, abyBuf.size(), fp)) > 0){
+		*pnHash = fnv1a(&abyBuf[0], nRead, *pnHash);
+		*pnSize += nRead;
+	}
+	VSIFCloseL(fp);
+	return TRUE;
+}
+
+/************************************************************************/
+/*                                open()                                */
+/************************************************************************/
+
+int CCAPSpanCache::open(const char *pszDir, const char *pszVector, GDALDataset *poDS, char **papszTO,
+                        int bCoverage, int verbose)
+{
+	GUIntBig nVectorHash, nVectorSize;
+	if(!hashFile(pszVector, &nVectorHash, &nVectorSize)){
+		fprintf(stderr,"Can't read %s to key the span cache, not caching spans\n",pszVector);
+		return FALSE;
+	}
+
+	double adfGeoTransform[6] = { 0, 1, 0, 0, 0, 1 };
+	poDS->GetGeoTransform(adfGeoTransform);
+	const char *pszSRS = poDS->GetProjectionRef();
+
+	osKey = CPLSPrintf("ccap span cache %d\nvector %016llx %llu\nsize %d %d\n", CCAP_SPANCACHE_VERSION,
+	                   nVectorHash, nVectorSize, poDS->GetRasterXSize(), poDS->GetRasterYSize());
+	osKey += CPLSPrintf("geotransform %.17g %.17g %.17g %.17g %.17g %.17g\n", adfGeoTransform[0],
+	                    adfGeoTransform[1], adfGeoTransform[2], adfGeoTransform[3],
+	                    adfGeoTransform[4], adfGeoTransform[5]);
+	osKey += bCoverage ? "coverage exact\n" : "coverage centers\n";
+	osKey += "srs ";
+	osKey += pszSRS != NULL ? pszSRS : "";
+	osKey += "\n";
+	for(char **papszIter = papszTO; papszIter != NULL && *papszIter != NULL; papszIter++){
+		osKey += "option ";
+		osKey += *papszIter;
+		osKey += "\n";
+	}
+
+	GUIntBig nKeyHash = fnv1a((const unsigned char *)osKey.c_str(), osKey.size(), FNV_OFFSET);
+	VSIMkdir(pszDir, 0755);
+	osPath = CPLFormFilename(pszDir, CPLSPrintf("ccap_spans_%016llx", nKeyHash), "bin");
+
+	load(verbose);
+	return TRUE;
+}
+
+/************************************************************************/
+/*                                load()                                */
+/*                                                                      */
+/*      Read a cache file into abyData. A missing file is just an empty */
+/*      cache; a damaged one, or one for a different key, is ignored    */
+/*      and will be written over.                                       */
+/************************************************************************/
+
+int CCAPSpanCache::load(int verbose)
+{
+	VSILFILE *fp = VSIFOpenL(osPath.c_str(), "rb");
+	if(fp == NULL){
+		verbose && fprintf(stderr,"\tNo span cache yet at %s\n",osPath.c_str());
+		return FALSE;
+	}
+	VSIFSeekL(fp, 0, SEEK_END);
+	size_t nSize = (size_t)VSIFTellL(fp);
+	VSIFSeekL(fp, 0, SEEK_SET);
+	abyData.resize(nSize);
+	int bOK = nSize > 0 && VSIFReadL(&abyData[0], 1, nSize, fp) == nSize;
+	VSIFCloseL(fp);
+
+	const unsigned char *paby = bOK ? &abyData[0] : NULL;
+	const unsigned char *pabyEnd = paby + nSize;
+	size_t nKeySize = osKey.size();
+	bOK = bOK && nSize >= sizeof(szMagic) + 8 + nKeySize + 8
+	      && memcmp(paby, szMagic, sizeof(szMagic)) == 0
+	      && CCAPGetUInt64(paby + sizeof(szMagic)) == nKeySize
+	      && memcmp(paby + sizeof(szMagic) + 8, osKey.c_str(), nKeySize) == 0;
+	if(bOK){
+		paby += sizeof(szMagic) + 8 + nKeySize;
+		GUIntBig nFeatures = CCAPGetUInt64(paby);
+		paby += 8;
+		for(GUIntBig f = 0; bOK && f < nFeatures; f++){
+			if(pabyEnd - paby < 16){
+				bOK = FALSE;
+				break;
+			}
+			GIntBig nFID = (GIntBig)CCAPGetUInt64(paby);
+			GUIntBig nBytes = CCAPGetUInt64(paby + 8);
+			paby += 16;
+			if(nBytes > (GUIntBig)(pabyEnd - paby)){
+				bOK = FALSE;
+				break;
+			}
+			oSpans[nFID] = std::make_pair((size_t)(paby - &abyData[0]), (size_t)nBytes);
+			paby += nBytes;
+		}
+	}
+	if(!bOK){
+		fprintf(stderr,"Span cache %s is damaged or for another grid, ignoring it\n",osPath.c_str());
+		oSpans.clear();
+		abyData.clear();
+		return FALSE;
+	}
+	verbose && fprintf(stderr,"\tLoaded spans of %lu features from %s\n",(unsigned long)oSpans.size(),osPath.c_str());
+	return TRUE;
+}
+
+/************************************************************************/
+/*                                get()                                 */
+/************************************************************************/
+
+int CCAPSpanCache::get(GIntBig nFID, std::vector<CCAPSpan> &aoSpans)
+{
+	std::lock_guard<std::mutex> oLock(oMutex);
+	std::map<GIntBig, std::pair<size_t, size_t> >::const_iterator it = oSpans.find(nFID);
+	if(it == oSpans.end()){
+		nMisses++;
+		return FALSE;
+	}
+
+	const unsigned char *paby = &abyData[it->second.first];
+	const unsigned char *pabyEnd = paby + it->second.second;
+	GUIntBig nSpans, nLineDelta, nXDelta, nLength, nShort;
+	int nLine = 0, nXStart = 0;
+
+	aoSpans.clear();
+	// each span is four varints of a byte or more, so a count past that is damage
+	if(!CCAPGetVarint(&paby, pabyEnd, &nSpans) || nSpans > (GUIntBig)(pabyEnd - paby) / 4){
+		nMisses++;
+		return FALSE;
+	}
+	aoSpans.reserve(nSpans);
+	for(GUIntBig s = 0; s < nSpans; s++){
+		if(!CCAPGetVarint(&paby, pabyEnd, &nLineDelta) || !CCAPGetVarint(&paby, pabyEnd, &nXDelta)
+		   || !CCAPGetVarint(&paby, pabyEnd, &nLength) || !CCAPGetVarint(&paby, pabyEnd, &nShort)
+		   || nShort > CCAP_COVER_SCALE){
+			aoSpans.clear();
+			nMisses++;
+			return FALSE;
+		}
+		CCAPSpan oSpan;
+		oSpan.nLine = nLine += (int)nLineDelta;
+		oSpan.nXStart = nXStart += (int)CCAPUnzigzag(nXDelta);
+		oSpan.nXEnd = nXStart + (int)nLength;
+		oSpan.nCover = CCAP_COVER_SCALE - (unsigned int)nShort;
+		aoSpans.push_back(oSpan);
+	}
+	nHits++;
+	return TRUE;
+}
+
+/************************************************************************/
+/*                                put()                                 */
+/*                                                                      */
+/*      Each span is coded as the line step from the last span, the     */
+/*      zigzag step of its start from the last start, its length, and   */
+/*      how far short of whole its pixels' cover is.                    */
+/************************************************************************/
+
+void CCAPSpanCache::put(GIntBig nFID, const std::vector<CCAPSpan> &aoSpans)
+{
+	std::vector<unsigned char> abyCoded;
+	int nLine = 0, nXStart = 0;
+	CCAPPutVarint(abyCoded, aoSpans.size());
+	for(size_t s = 0; s < aoSpans.size(); s++){
+		CCAPPutVarint(abyCoded, aoSpans[s].nLine - nLine);
+		CCAPPutVarint(abyCoded, CCAPZigzag(aoSpans[s].nXStart - nXStart));
+		CCAPPutVarint(abyCoded, aoSpans[s].nXEnd - aoSpans[s].nXStart);
+		CCAPPutVarint(abyCoded, CCAP_COVER_SCALE - aoSpans[s].nCover);
+		nLine = aoSpans[s].nLine;
+		nXStart = aoSpans[s].nXStart;
+	}
+
+	std::lock_guard<std::mutex> oLock(oMutex);
+	oSpans[nFID] = std::make_pair(abyData.size(), abyCoded.size());
+	abyData.insert(abyData.end(), abyCoded.begin(), abyCoded.end());
+	bDirty = true;
+}
+
+/************************************************************************/
+/*                                save()                                */
+/*                                                                      */
+/*      Written to a temporary name and renamed into place, so a run    */
+/*      that dies part way, or two running at once, never leave a       */
+/*      half written cache behind.                                      */
+/************************************************************************/
+
+int CCAPSpanCache::save(int verbose)
+{
+	std::lock_guard<std::mutex> oLock(oMutex);
+	if(!bDirty) return TRUE;
+
+	std::vector<unsigned char> abyHeader(szMagic, szMagic + sizeof(szMagic));
+	CCAPPutUInt64(abyHeader, osKey.size());
+	abyHeader.insert(abyHeader.end(), osKey.begin(), osKey.end());
+	CCAPPutUInt64(abyHeader, oSpans.size());
+
+	std::string osTmp = osPath + CPLSPrintf(".%d.tmp", (int)getpid());
+	VSILFILE *fp = VSIFOpenL(osTmp.c_str(), "wb");
+	if(fp == NULL){
+		fprintf(stderr,"Failed to write span cache %s\n",osTmp.c_str());
+		return FALSE;
+	}
+	int bOK = VSIFWriteL(&abyHeader[0], 1, abyHeader.size(), fp) == abyHeader.size();
+	std::map<GIntBig, std::pair<size_t, size_t> >::const_iterator it;
+	for(it = oSpans.begin(); bOK && it != oSpans.end(); ++it){
+		std::vector<unsigned char> abyEntry;
+		CCAPPutUInt64(abyEntry, (GUIntBig)it->first);
+		CCAPPutUInt64(abyEntry, it->second.second);
+		bOK = VSIFWriteL(&abyEntry[0], 1, abyEntry.size(), fp) == abyEntry.size()
+		      && (it->second.second == 0
+		          || VSIFWriteL(&abyData[it->second.first], 1, it->second.second, fp) == it->second.second);
+	}
+	bOK = VSIFCloseL(fp) == 0 && bOK;
+	if(!bOK || VSIRename(osTmp.c_str(), osPath.c_str()) != 0){
+		fprintf(stderr,"Failed to write span cache %s\n",osPath.c_str());
+		VSIUnlink(osTmp.c_str());
+		return FALSE;
+	}
+	bDirty = false;
+	verbose && fprintf(stderr,"Saved spans of %lu features in %s\n",(unsigned long)oSpans.size(),osPath.c_str());
+	return TRUE;
+}
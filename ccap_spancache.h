@@ -0,0 +1,66 @@
+#ifndef CCAP_SPANCACHE_H
+#define CCAP_SPANCACHE_H
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "cpl_port.h"
+#include "ccap_rasterize.h"
+
+class GDALDataset;
+
+/************************************************************************/
+/*                             CCAPSpanCache                            */
+/*                                                                      */
+/*      The spans each feature covers on one raster grid, kept on disk  */
+/*      so later runs against other rasters on the same grid (the next  */
+/*      epoch pair, say) skip the transform and scan conversion. A      */
+/*      cache file is named for a hash of the vector file's contents,   */
+/*      the raster size, geotransform and SRS, the transformer options  */
+/*      and the coverage rule; the full key is stored in the file and   */
+/*      checked on load. Features are looked up by FID.                 */
+/*                                                                      */
+/*      Spans are stored varint delta coded, a few bytes each, and      */
+/*      stay coded in memory until asked for. get() and put() may be    */
+/*      called from any thread.                                         */
+/************************************************************************/
+
+class CCAPSpanCache
+{
+public:
+	CCAPSpanCache() : bDirty(false), nHits(0), nMisses(0) {}
+
+	/*
+	* Find or start the cache file in pszDir for features from pszVector
+	* on poDS's grid, with exact coverage if bCoverage is set. Returns FALSE if the vector file can't be hashed, in
+	* which case nothing is cached. Whether an existing file was loaded
+	* shows in size().
+	*/
+	int open(const char *pszDir, const char *pszVector, GDALDataset *poDS, char **papszTO,
+	         int bCoverage, int verbose);
+
+	// the spans of feature nFID, if cached
+	int get(GIntBig nFID, std::vector<CCAPSpan> &aoSpans);
+	void put(GIntBig nFID, const std::vector<CCAPSpan> &aoSpans);
+
+	// write the file out if put() added anything
+	int save(int verbose);
+
+	size_t size() const { return oSpans.size(); }
+	GIntBig hits() const { return nHits; }
+	GIntBig misses() const { return nMisses; }
+
+private:
+	int load(int verbose);
+
+	std::string osPath;
+	std::string osKey;
+	std::map<GIntBig, std::pair<size_t, size_t> > oSpans; // FID to offset and length of its coded spans in abyData
+	std::vector<unsigned char> abyData;
+	std::mutex oMutex;
+	bool bDirty;
+	GIntBig nHits, nMisses;
+};
+
+#endif
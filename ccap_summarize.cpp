@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <getopt.h>
 #include <strings.h>
 #include "gdal.h"
 #include "gdal_priv.h"
@@ -9,18 +10,76 @@
 #include "ogrsf_frmts.h"
 #include "ogr_api.h"
 //#include "commonutils.h"
-//#include <vector>
+#include <vector>
 //#include <map>
+#include <thread>
+#include "ccap_kernels.h"
+#include "ccap_queue.h"
+#include "ccap_mem.h"
+#include "ccap_map.h"
+#include "ccap_scheme.h"
+#include "ccap_lut.h"
 
-#define CCAP_CLASSES 625
+/* largest bivariate value counted, from the class scheme; 625 for C-CAP */
+static int nBivariateMax = 625;
+
+/* biggest strip of lines read at once, unless a memory limit makes it smaller */
+#define CCAP_MAX_STRIP_BYTES (64*1024*1024)
+static size_t nMaxStripBytes = CCAP_MAX_STRIP_BYTES;
+
+/* long options; -m is also --mem-limit */
+static struct option aoLongOptions[] = {
+	{ "mem-limit", required_argument, NULL, 'm' },
+	{ NULL, 0, NULL, 0 }
+};
+
+/*
+* One strip of one input file. With -j the strips of every file go
+* through one queue, so the threads stay busy across file boundaries.
+* psMap is the file's mapping when it could be mapped, and then the
+* strip is counted straight from it instead of being read. psLUT is
+* the file's codes when ccap2bivar -L made it.
+*/
+typedef struct {
+	const char *pszName;
+	const CCAPMappedBand *psMap;
+	const CCAPBivariateLUT *psLUT;
+	int nXSize;
+	int nYOff;
+	int nLines;
+} SummarizeJob;
+
+typedef CCAPQueue<SummarizeJob> SummarizeQueue;
+
+/*
+* A summarize thread: its own dataset handle, strip buffer and table.
+* The tables are added together once all the strips are done.
+*/
+struct SummarizeWorker {
+	const char *pszName; // file open in poDS
+	GDALDataset *poDS;
+	std::vector<unsigned short> anStrip;
+	std::vector<unsigned long long> anTable;
+};
 
 
 static int GDALExit( int nCode );
+static int stripLines( GDALRasterBand *poBand );
+static int summarizeStrip( GDALRasterBand *poBand, const CCAPBivariateLUT *psLUT, int nYOff, int nLines,
+                           std::vector<unsigned short> &anStrip, unsigned long long *table );
+static void summarizeMapped( const CCAPMappedBand *psMap, int nXSize, int nYOff, int nLines,
+                             unsigned long long *table );
+static void summarizeWorkerThread( SummarizeWorker *poWorker, SummarizeQueue *poQueue );
 
 void usage(char *name){
 	fprintf(stderr,"%s - calculate table from bivariate CCAP file\n",name);
-	fprintf(stderr,"USAGE: %s bivariate_files\n",name);
+	fprintf(stderr,"USAGE: %s [-j threads] [-m size] [-S scheme] bivariate_files\n",name);
 	
+	fprintf(stderr,"\tthreads = number of threads reading strips of the files [1]\n");
+	fprintf(stderr,"\tsize = -m or --mem-limit, memory to stay under, eg 4G or 512M [no limit]\n");
+	fprintf(stderr,"\t       uncompressed files are read through the block cache then, not mapped\n");
+	fprintf(stderr,"\tscheme = -S, class scheme the bivariates were made with: %s, or the number of classes [ccap]\n",
+	        CCAPSchemeNames());
 	fprintf(stderr,"\tbivariate_files = C-CAP bivariate files to analyze\n");
 
 }
@@ -35,6 +94,10 @@ int main(int argc, char **argv)
 	char *fieldname = NULL;
 	FILE *tfp = stdout;
 	int verbose = 0;
+	int nThreads = 1;
+	GIntBig nMemLimit = 0;
+	CCAPScheme sScheme;
+	const char *pszScheme = "ccap";
 
 	extern int optind;
 	extern char *optarg;
@@ -43,9 +106,23 @@ int main(int argc, char **argv)
 	GDALAllRegister();
 	OGRRegisterAll();
 
-	while((c = getopt(argc,argv,"1:2:t:s:vf:h")) != -1){
+	while((c = getopt_long(argc,argv,"1:2:t:s:vf:hj:m:S:",aoLongOptions,NULL)) != -1){
 		switch(c){
 			
+			case 'm':
+				if((nMemLimit = CCAPParseMemSize(optarg)) < 0){
+					fprintf(stderr,"Bad memory limit %s\n",optarg);
+					usage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'j':
+				nThreads = atoi(optarg);
+				if(nThreads < 1) nThreads = 1;
+				break;
+			case 'S':
+				pszScheme = optarg;
+				break;
 			case 'v':
 				verbose++;
 				break;
@@ -65,6 +142,11 @@ int main(int argc, char **argv)
 		usage(argv[0]);
 		return 1;
 	}
+	if(!CCAPSchemeFromName(pszScheme, &sScheme)){
+		usage(argv[0]);
+		return 1;
+	}
+	nBivariateMax = CCAPSchemeBivariateMax(&sScheme);
 	
 	
 
@@ -72,14 +154,37 @@ int main(int argc, char **argv)
 	// open all the raster datasets after allocating some space for them
 	int nrasters = argc-optind;
 
-	verbose && fprintf(stderr,"allocating %d bytes for ccap table\n", sizeof(unsigned long long)*(CCAP_CLASSES+1));
-	unsigned long long *table = (unsigned long long *)calloc(sizeof(unsigned long long)*(CCAP_CLASSES+1), sizeof(unsigned long long));
+	verbose && fprintf(stderr,"allocating %d bytes for ccap table\n", (int)(sizeof(unsigned long long)*(nBivariateMax+1)));
+	unsigned long long *table = (unsigned long long *)calloc(nBivariateMax+1, sizeof(unsigned long long));
 	if(table == NULL){
-		fprintf(stderr,"Failed to allocate %d bytes for ccap table\n",sizeof(unsigned long long)*(CCAP_CLASSES+1));
+		fprintf(stderr,"Failed to allocate %d bytes for ccap table\n",(int)(sizeof(unsigned long long)*(nBivariateMax+1)));
 		return 1;
 	}else{
 		verbose && fprintf(stderr,"Allocation done. table at address %x\n",table);
 	}
+
+	/*
+	* With -j the files are only opened here to check them and find the
+	* strips; the strips are read by the worker threads, each with its own
+	* handle on the file since GDAL datasets are not thread safe.
+	*/
+	// a strip buffer per thread, or just the one read here without -j
+	nMaxStripBytes = CCAPMemBudget(nMemLimit, 0, nThreads, CCAP_MAX_STRIP_BYTES, verbose);
+
+	SummarizeQueue oQueue(nThreads * 4);
+	std::vector<SummarizeWorker> aoWorkers(nThreads > 1 ? nThreads : 0);
+	std::vector<std::thread> aoThreads;
+	for(int t = 0; t < (int)aoWorkers.size(); t++){
+		aoWorkers[t].pszName = NULL;
+		aoWorkers[t].poDS = NULL;
+		aoWorkers[t].anTable.assign(nBivariateMax+1, 0);
+		aoThreads.push_back(std::thread(summarizeWorkerThread, &aoWorkers[t], &oQueue));
+	}
+	std::vector<unsigned short> anStrip;
+	// mapped files stay open until the workers are done with them
+	std::vector<GDALDataset *> apoMappedDS;
+	std::vector<CCAPMappedBand *> apsMaps;
+	std::vector<CCAPBivariateLUT *> apsLUTs;
 	
 	for(i = 0, j=optind; i < nrasters; i++, j++){
 		GDALDataset *poDataset = (GDALDataset *)GDALOpen( argv[j], GA_ReadOnly );
@@ -106,48 +211,180 @@ int main(int argc, char **argv)
     
 
     GDALRasterBand *poBand = poDataset->GetRasterBand( 1 );
-    int nXSize =  poBand->GetXSize();
   	int nYSize = poBand->GetYSize();
-  	
-  	// space for the scanline
-		unsigned short *pasScanline;
-		verbose && fprintf(stderr,"Allocating for a scanline\n");
-		pasScanline = (unsigned short *)CPLMalloc(sizeof(unsigned short)*nXSize);
-		if(pasScanline == NULL){
-			fprintf(stderr,"Failed to allocated %d bytes for a scanline for file %s\n",sizeof(unsigned short)*nXSize,argv[j]);
-		}
+  	int nStripLines = stripLines(poBand);
+  	verbose && fprintf(stderr,"Reading in strips of %d lines\n",nStripLines);
 
-		for(int y = 0; y < nYSize; y++){
-    	//fprintf(stderr,"\t\tworking on line %d\n",y);
-    	
-    	poBand->RasterIO( GF_Read, 0, y, nXSize, 1, 
-                          pasScanline, nXSize, 1, GDT_UInt16, 
-                          0, 0 );
-    	
-    	// now we have a line of data. Run through it and split into pieces
-    	
-    	for(int x = 0; x < nXSize; x++){
-
-    		if( pasScanline[x] > 0 && pasScanline[x] <= CCAP_CLASSES){
-    			table[pasScanline[x]]++;
-    		}
-    		
-    	}
-    	
+  	// uncompressed files are counted straight from their pages, but mapped
+  	// pages count in the RSS, so under -m they go through the budgeted block cache
+  	CCAPMappedBand *psMap = (CCAPMappedBand *)CPLMalloc(sizeof(CCAPMappedBand));
+  	if(nMemLimit > 0 || !CCAPMapBand(poBand, psMap, verbose)){
+  		CPLFree(psMap);
+  		psMap = NULL;
+  	}
+
+  	// Byte bivariates from ccap2bivar -L are decoded as they are read
+  	CCAPBivariateLUT *psLUT = (CCAPBivariateLUT *)CPLMalloc(sizeof(CCAPBivariateLUT));
+  	if(CCAPGetBivariateLUT(poBand, psLUT)){
+  		verbose && fprintf(stderr,"Decoding %d transitions from the RAT\n",psLUT->nCodes - 1);
+  		apsLUTs.push_back(psLUT);
+  	}else{
+  		CPLFree(psLUT);
+  		psLUT = NULL;
+  	}
+
+		for(int y = 0; y < nYSize; y += nStripLines){
+			int nLines = nYSize - y < nStripLines ? nYSize - y : nStripLines;
+			if(nThreads > 1){
+				SummarizeJob oJob;
+				oJob.pszName = argv[j];
+				oJob.psMap = psMap;
+				oJob.psLUT = psLUT;
+				oJob.nXSize = poBand->GetXSize();
+				oJob.nYOff = y;
+				oJob.nLines = nLines;
+				oQueue.push(oJob);
+			}else if(psMap != NULL){
+				summarizeMapped(psMap, poBand->GetXSize(), y, nLines, table);
+			}else if(summarizeStrip(poBand, psLUT, y, nLines, anStrip, table) != 0){
+				fprintf(stderr,"Failed reading file %s\n",argv[j]);
+				GDALExit(1);
+			}
+    }
+    if(psMap != NULL){
+    	apoMappedDS.push_back(poDataset);
+    	apsMaps.push_back(psMap);
+    }else{
+    	delete poDataset;
     }
-    delete poDataset;
  	}
 
+	// wait for the workers and add up their tables
+	oQueue.finish();
+	for(int t = 0; t < (int)aoThreads.size(); t++){
+		aoThreads[t].join();
+		for(int k = 0; k <= nBivariateMax; k++){
+			table[k] += aoWorkers[t].anTable[k];
+		}
+	}
+	for(size_t m = 0; m < apsMaps.size(); m++){
+		CCAPUnmapBand(apsMaps[m]);
+		CPLFree(apsMaps[m]);
+		delete apoMappedDS[m];
+	}
+	for(size_t l = 0; l < apsLUTs.size(); l++){
+		CPLFree(apsLUTs[l]);
+	}
+
  	// done with all rasters, dump out the answers in form Class#, #counted
- 	for(i = 1; i <= CCAP_CLASSES; i++){
+ 	for(i = 1; i <= nBivariateMax; i++){
  		if(table[i] > 0) printf("%d, %ld\n", i, table[i]);
  	}
 
+	if(verbose || nMemLimit > 0) CCAPReportPeakRSS(nMemLimit);
+
   
 }
 
 	
 
+/************************************************************************/
+/*                             stripLines()                             */
+/*                                                                      */
+/*      Lines to read at once: one row of blocks, unless a full width   */
+/*      row of blocks gets bigger than nMaxStripBytes.                  */
+/************************************************************************/
+
+static int stripLines( GDALRasterBand *poBand )
+{
+	int nBlockXSize, nBlockYSize;
+	int nXSize = poBand->GetXSize();
+	poBand->GetBlockSize(&nBlockXSize, &nBlockYSize);
+
+	int nStripLines = nBlockYSize > 0 ? nBlockYSize : 1;
+	if((double)nStripLines * nXSize * sizeof(unsigned short) > nMaxStripBytes){
+		nStripLines = nMaxStripBytes / (nXSize * sizeof(unsigned short));
+		if(nStripLines < 1) nStripLines = 1;
+	}
+	return nStripLines;
+}
+
+/************************************************************************/
+/*                           summarizeStrip()                           */
+/*                                                                      */
+/*      Read full width lines nYOff to nYOff+nLines and count them      */
+/*      into table. Zeros land in table[0], which isn't reported.       */
+/*      Coded lines are turned back into bivariate values first.        */
+/************************************************************************/
+
+static int summarizeStrip( GDALRasterBand *poBand, const CCAPBivariateLUT *psLUT, int nYOff, int nLines,
+                           std::vector<unsigned short> &anStrip, unsigned long long *table )
+{
+	int nXSize = poBand->GetXSize();
+	anStrip.resize((size_t)nXSize * nLines);
+	if(poBand->RasterIO( GF_Read, 0, nYOff, nXSize, nLines,
+	                     &anStrip[0], nXSize, nLines, GDT_UInt16, 0, 0 ) != CE_None){
+		fprintf(stderr,"Failed to read lines %d to %d\n", nYOff, nYOff + nLines);
+		return 1;
+	}
+	if(psLUT != NULL) CCAPDecodeBivariates(psLUT, &anStrip[0], anStrip.size());
+	CCAPHistogram(&anStrip[0], anStrip.size(), table, nBivariateMax);
+	return 0;
+}
+
+/************************************************************************/
+/*                          summarizeMapped()                           */
+/*                                                                      */
+/*      Count lines nYOff to nYOff+nLines of a mapped file in place.    */
+/*      When the lines are packed end to end the whole strip is one     */
+/*      run for the histogram kernel.                                   */
+/************************************************************************/
+
+static void summarizeMapped( const CCAPMappedBand *psMap, int nXSize, int nYOff, int nLines,
+                             unsigned long long *table )
+{
+	if(psMap->nLineSpace == (GIntBig)nXSize * (GIntBig)sizeof(unsigned short)){
+		CCAPHistogram(CCAPMappedLine(psMap, nYOff), (size_t)nXSize * nLines, table, nBivariateMax);
+		return;
+	}
+	for(int y = nYOff; y < nYOff + nLines; y++){
+		CCAPHistogram(CCAPMappedLine(psMap, y), nXSize, table, nBivariateMax);
+	}
+}
+
+/************************************************************************/
+/*                       summarizeWorkerThread()                        */
+/*                                                                      */
+/*      The strips come in file order, so the worker keeps the last     */
+/*      file open until a strip from the next one shows up.             */
+/************************************************************************/
+
+static void summarizeWorkerThread( SummarizeWorker *poWorker, SummarizeQueue *poQueue )
+{
+	SummarizeJob oJob;
+	while(poQueue->pop(oJob)){
+		if(oJob.psMap != NULL){
+			summarizeMapped(oJob.psMap, oJob.nXSize, oJob.nYOff, oJob.nLines, &poWorker->anTable[0]);
+			continue;
+		}
+		if(oJob.pszName != poWorker->pszName){
+			if(poWorker->poDS != NULL) GDALClose((GDALDatasetH) poWorker->poDS);
+			poWorker->poDS = (GDALDataset *)GDALOpen( oJob.pszName, GA_ReadOnly );
+			if(poWorker->poDS == NULL){
+				fprintf(stderr,"Failed to reopen file %s\n", oJob.pszName);
+				GDALExit(1);
+			}
+			poWorker->pszName = oJob.pszName;
+		}
+		if(summarizeStrip(poWorker->poDS->GetRasterBand( 1 ), oJob.psLUT, oJob.nYOff, oJob.nLines,
+		                  poWorker->anStrip, &poWorker->anTable[0]) != 0){
+			fprintf(stderr,"Failed reading file %s\n", oJob.pszName);
+			GDALExit(1);
+		}
+	}
+	if(poWorker->poDS != NULL) GDALClose((GDALDatasetH) poWorker->poDS);
+}
+
 /************************************************************************/
 /*                               GDALExit()                             */
 /*  This function exits and cleans up GDAL and OGR resources            */
@@ -0,0 +1,486 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <getopt.h>
+#include "gdal.h"
+#include "gdal_priv.h"
+#include "cpl_conv.h"
+#include "cpl_string.h"
+#include "ogr_spatialref.h"
+#include "ogrsf_frmts.h"
+#include "ogr_api.h"
+#include <string>
+#include <vector>
+#include "ccap_kernels.h"
+
+/*
+* Makes a synthetic C-CAP test set: start and end year rasters, the
+* bivariate of the two and a layer of polygons tiling the raster, for
+* benchmarking the ccap tools without shipping real data around.
+*
+* Everything comes from hashes of the seed and the pixel or polygon
+* position, not rand(), so the same options give the same files on any
+* machine. The land cover is blocky patches of classes drawn with about
+* the shares of a coastal C-CAP region, under a smooth field that puts
+* the ocean, estuarine and palustrine zones in bands along a ragged
+* coast, with background outside the coastal zone. Patch edges are
+* warped so they aren't straight. A few percent of the small patches
+* change class between the years, along the transitions real data has
+* (forest to scrub or development, marsh to water and so on).
+*/
+
+#define CCAP_CLASSES 25
+
+/* pixel size in meters and the corner of the raster, in CONUS Albers (EPSG:5070) */
+#define SYNTH_PIXEL 30.0
+#define SYNTH_ORIGIN_X 1500000.0
+#define SYNTH_ORIGIN_Y 1800000.0
+
+/* pixels in a land cover patch, and in a patch that can change */
+#define SYNTH_PATCH 48
+#define SYNTH_CHANGE_PATCH 12
+
+/* lines generated and written at once */
+#define SYNTH_STRIP_LINES 256
+
+/* points added along each side a polygon shares with a neighbour */
+#define SYNTH_EDGE_POINTS 8
+
+/* -co is spelled the way the GDAL utilities spell it */
+static struct option aoLongOptions[] = {
+	{ "co", required_argument, NULL, 'C' },
+	{ NULL, 0, NULL, 0 }
+};
+
+static int GDALExit( int nCode );
+
+void usage(char *name){
+	fprintf(stderr,"%s - make synthetic C-CAP rasters and polygons for benchmarks\n",name);
+	fprintf(stderr,"USAGE: %s [-v] [-x width] [-y height] [-n features] [-s seed] [-u every] [-d dir] [-co NAME=VALUE]...\n",name);
+	fprintf(stderr,"\twidth, height = raster size in pixels [4096 x 4096]\n");
+	fprintf(stderr,"\tfeatures = number of polygons in the layer [1000]\n");
+	fprintf(stderr,"\tseed = any number, the same one makes the same files [1]\n");
+	fprintf(stderr,"\tevery = give every'th polygon the FIPS of the one before, as a county in two parts\n");
+	fprintf(stderr,"\t        is two rows in census files. NAME is then the FIPS and the part number [no duplicates]\n");
+	fprintf(stderr,"\tdir = directory to write start.tif, end.tif, bivar.tif and features.shp in [.]\n");
+	fprintf(stderr,"\t-co = GeoTIFF creation option for the rasters, eg -co TILED=YES -co COMPRESS=LZW [none]\n");
+	fprintf(stderr,"The polygons have a 5 or more character FIPS field, state then county, so\n");
+	fprintf(stderr,"ccap2tbl -f FIPS,FIPS:2 reports states as well\n");
+}
+
+/************************************************************************/
+/*                              hashInt()                               */
+/*                                                                      */
+/*      Mixes the seed and two coordinates into 32 well spread bits.    */
+/************************************************************************/
+
+static GUInt32 hashInt(GUInt32 nSeed, int a, int b)
+{
+	GUInt32 h = nSeed * 0x9E3779B1U ^ (GUInt32)a * 0x85EBCA77U ^ (GUInt32)b * 0xC2B2AE3DU;
+	h ^= h >> 16;
+	h *= 0x7FEB352DU;
+	h ^= h >> 15;
+	h *= 0x846CA68BU;
+	h ^= h >> 16;
+	return h;
+}
+
+static double hashUnit(GUInt32 nSeed, int a, int b)
+{
+	return hashInt(nSeed, a, b) / 4294967296.0;
+}
+
+/************************************************************************/
+/*                             valueNoise()                             */
+/*                                                                      */
+/*      Smooth noise from 0 to 1 that varies over about dfScale pixels. */
+/************************************************************************/
+
+static double valueNoise(GUInt32 nSeed, double x, double y, double dfScale)
+{
+	double fx = x / dfScale, fy = y / dfScale;
+	int ix = (int)floor(fx), iy = (int)floor(fy);
+	double tx = fx - ix, ty = fy - iy;
+	tx = tx * tx * (3 - 2 * tx);
+	ty = ty * ty * (3 - 2 * ty);
+	double a = hashUnit(nSeed, ix, iy), b = hashUnit(nSeed, ix + 1, iy);
+	double c = hashUnit(nSeed, ix, iy + 1), d = hashUnit(nSeed, ix + 1, iy + 1);
+	return (a + (b - a) * tx) * (1 - ty) + (c + (d - c) * tx) * ty;
+}
+
+/************************************************************************/
+/*                             pickClass()                              */
+/*                                                                      */
+/*      One of the classes in panClasses, by their weights, for a hash  */
+/*      value from 0 to 1.                                              */
+/************************************************************************/
+
+static int pickClass(const int (*panClasses)[2], double dfPick)
+{
+	int nTotal = 0;
+	for(int i = 0; panClasses[i][0] != 0; i++) nTotal += panClasses[i][1];
+	double dfAt = dfPick * nTotal;
+	int i;
+	for(i = 0; panClasses[i+1][0] != 0; i++){
+		dfAt -= panClasses[i][1];
+		if(dfAt < 0) break;
+	}
+	return panClasses[i][0];
+}
+
+/* class and weight, ended by a 0 class */
+static const int anOpenWater[][2] = { {21, 90}, {23, 6}, {19, 4}, {0, 0} };
+static const int anEstuarine[][2] = { {18, 50}, {21, 20}, {19, 10}, {17, 8}, {16, 5}, {23, 7}, {0, 0} };
+static const int anPalustrine[][2] = { {13, 35}, {15, 25}, {14, 15}, {21, 15}, {22, 5}, {12, 5}, {0, 0} };
+static const int anUpland[][2] = { {9, 18}, {10, 14}, {6, 14}, {7, 10}, {11, 8}, {12, 8}, {8, 6},
+                                   {5, 6}, {4, 5}, {3, 2}, {21, 3}, {2, 1}, {20, 1}, {0, 0} };
+static const int anUrban[][2] = { {4, 30}, {3, 22}, {5, 18}, {2, 14}, {7, 5}, {9, 5}, {20, 3}, {21, 3}, {0, 0} };
+
+/************************************************************************/
+/*                             startClass()                             */
+/************************************************************************/
+
+static int startClass(GUInt32 nSeed, int x, int y)
+{
+	// the coast: small values are the sea, and below that outside the coastal zone
+	double dfCoast = 0.55 * valueNoise(nSeed + 1, x, y, 900) + 0.3 * valueNoise(nSeed + 2, x, y, 250)
+	               + 0.15 * valueNoise(nSeed + 3, x, y, 60);
+	if(dfCoast < 0.27) return 0;
+
+	// patches, with their edges pushed around so they aren't squares
+	double dfWarpX = x + 40 * (valueNoise(nSeed + 4, x, y, 70) - 0.5);
+	double dfWarpY = y + 40 * (valueNoise(nSeed + 5, x, y, 70) - 0.5);
+	int nPatchX = (int)floor(dfWarpX / SYNTH_PATCH), nPatchY = (int)floor(dfWarpY / SYNTH_PATCH);
+	double dfPick = hashUnit(nSeed + 6, nPatchX, nPatchY);
+
+	if(dfCoast < 0.33) return pickClass(anOpenWater, dfPick);
+	if(dfCoast < 0.37) return pickClass(anEstuarine, dfPick);
+	if(dfCoast < 0.42) return pickClass(anPalustrine, dfPick);
+	if(valueNoise(nSeed + 7, x, y, 400) > 0.72) return pickClass(anUrban, dfPick);
+	return pickClass(anUpland, dfPick);
+}
+
+/************************************************************************/
+/*                              endClass()                              */
+/*                                                                      */
+/*      What nStart has become by the end year. Most pixels are the     */
+/*      same; a changed patch moves along a common transition.          */
+/************************************************************************/
+
+static int endClass(GUInt32 nSeed, int x, int y, int nStart)
+{
+	if(nStart == 0) return 0;
+	double dfWarpX = x + 10 * (valueNoise(nSeed + 8, x, y, 20) - 0.5);
+	double dfWarpY = y + 10 * (valueNoise(nSeed + 9, x, y, 20) - 0.5);
+	int nPatchX = (int)floor(dfWarpX / SYNTH_CHANGE_PATCH), nPatchY = (int)floor(dfWarpY / SYNTH_CHANGE_PATCH);
+	GUInt32 nHash = hashInt(nSeed + 10, nPatchX, nPatchY);
+	if(nHash % 1000 >= 35) return nStart;
+
+	int nPick = (nHash >> 10) % 4;
+	switch(nStart){
+		case 9: case 10: case 11: { static const int an[] = { 12, 20, 5, 4 }; return an[nPick]; }
+		case 12:                  { static const int an[] = { 9, 10, 8, 4 }; return an[nPick]; }
+		case 6: case 7: case 8:   { static const int an[] = { 4, 3, 5, 12 }; return an[nPick]; }
+		case 20:                  { static const int an[] = { 3, 2, 12, 8 }; return an[nPick]; }
+		case 5: case 4:           { static const int an[] = { 3, 3, 2, nStart }; return an[nPick]; }
+		case 13: case 14: case 15:{ static const int an[] = { 21, 12, 4, 15 }; return an[nPick]; }
+		case 16: case 17: case 18:{ static const int an[] = { 21, 19, 23, 21 }; return an[nPick]; }
+		case 19:                  { static const int an[] = { 21, 18, 21, 20 }; return an[nPick]; }
+		default:                  return nStart;
+	}
+}
+
+/************************************************************************/
+/*                            writeRasters()                            */
+/************************************************************************/
+
+static int writeRasters(const std::string &osDir, int nXSize, int nYSize, GUInt32 nSeed,
+                        char **papszOptions, const char *pszWKT, int verbose)
+{
+	GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName("GTiff");
+	if(poDriver == NULL){
+		fprintf(stderr,"No GTiff driver\n");
+		return 1;
+	}
+
+	const char *apszNames[] = { "start.tif", "end.tif", "bivar.tif" };
+	GDALDataset *apoDS[3];
+	double adfGeoTransform[6] = { SYNTH_ORIGIN_X, SYNTH_PIXEL, 0, SYNTH_ORIGIN_Y, 0, -SYNTH_PIXEL };
+	for(int i = 0; i < 3; i++){
+		std::string osName = CPLFormFilename(osDir.c_str(), apszNames[i], NULL);
+		apoDS[i] = poDriver->Create(osName.c_str(), nXSize, nYSize, 1, i < 2 ? GDT_Byte : GDT_UInt16, papszOptions);
+		if(apoDS[i] == NULL){
+			fprintf(stderr,"Failed to create %s\n",osName.c_str());
+			return 1;
+		}
+		apoDS[i]->SetGeoTransform(adfGeoTransform);
+		if(pszWKT != NULL) apoDS[i]->SetProjection(pszWKT);
+	}
+
+	size_t nStripPixels = (size_t)nXSize * SYNTH_STRIP_LINES;
+	std::vector<unsigned char> abyStart(nStripPixels), abyEnd(nStripPixels);
+	std::vector<unsigned short> anBivar(nStripPixels);
+	CCAPCombineFunc pfnCombine = CCAPGetCombineKernel(NULL);
+	GUIntBig nChanged = 0;
+
+	for(int nYOff = 0; nYOff < nYSize; nYOff += SYNTH_STRIP_LINES){
+		int nLines = nYSize - nYOff < SYNTH_STRIP_LINES ? nYSize - nYOff : SYNTH_STRIP_LINES;
+		size_t k = 0;
+		for(int y = nYOff; y < nYOff + nLines; y++){
+			for(int x = 0; x < nXSize; x++, k++){
+				abyStart[k] = (unsigned char)startClass(nSeed, x, y);
+				abyEnd[k] = (unsigned char)endClass(nSeed, x, y, abyStart[k]);
+				nChanged += abyStart[k] != abyEnd[k];
+			}
+		}
+		pfnCombine(&abyStart[0], &abyEnd[0], &anBivar[0], k, CCAP_CLASSES);
+
+		if(apoDS[0]->GetRasterBand(1)->RasterIO(GF_Write, 0, nYOff, nXSize, nLines, &abyStart[0],
+		                                        nXSize, nLines, GDT_Byte, 0, 0) != CE_None
+		   || apoDS[1]->GetRasterBand(1)->RasterIO(GF_Write, 0, nYOff, nXSize, nLines, &abyEnd[0],
+		                                           nXSize, nLines, GDT_Byte, 0, 0) != CE_None
+		   || apoDS[2]->GetRasterBand(1)->RasterIO(GF_Write, 0, nYOff, nXSize, nLines, &anBivar[0],
+		                                           nXSize, nLines, GDT_UInt16, 0, 0) != CE_None){
+			fprintf(stderr,"Failed writing lines %d to %d\n",nYOff,nYOff+nLines-1);
+			return 1;
+		}
+		verbose > 1 && fprintf(stderr,"%d of %d lines\n",nYOff+nLines,nYSize);
+	}
+	for(int i = 0; i < 3; i++) GDALClose(apoDS[i]);
+	verbose && fprintf(stderr,"%dx%d rasters, %llu pixels changed\n",nXSize,nYSize,nChanged);
+	return 0;
+}
+
+/************************************************************************/
+/*                              edgePoint()                             */
+/*                                                                      */
+/*      Point k of SYNTH_EDGE_POINTS along the side from lattice corner */
+/*      (c0,r0) to (c1,r1), in pixels. Corners are jittered within      */
+/*      their cell and the points between wander off the straight      */
+/*      line; both are hashed from the lattice so the two polygons on   */
+/*      either side of an edge agree on it.                             */
+/************************************************************************/
+
+static void cornerPoint(GUInt32 nSeed, int c, int r, int nCols, int nRows, double dfCellX, double dfCellY,
+                        double *pdfX, double *pdfY)
+{
+	*pdfX = c * dfCellX;
+	*pdfY = r * dfCellY;
+	if(c > 0 && c < nCols) *pdfX += (hashUnit(nSeed + 20, c, r) - 0.5) * 0.5 * dfCellX;
+	if(r > 0 && r < nRows) *pdfY += (hashUnit(nSeed + 21, c, r) - 0.5) * 0.5 * dfCellY;
+}
+
+static void edgePoint(GUInt32 nSeed, int c0, int r0, int c1, int r1, int k, int nCols, int nRows,
+                      double dfCellX, double dfCellY, double *pdfX, double *pdfY)
+{
+	double x0, y0, x1, y1;
+	cornerPoint(nSeed, c0, r0, nCols, nRows, dfCellX, dfCellY, &x0, &y0);
+	cornerPoint(nSeed, c1, r1, nCols, nRows, dfCellX, dfCellY, &x1, &y1);
+	double t = (double)k / SYNTH_EDGE_POINTS;
+	*pdfX = x0 + (x1 - x0) * t;
+	*pdfY = y0 + (y1 - y0) * t;
+	if(k == 0 || k == SYNTH_EDGE_POINTS) return;
+
+	// sides along the raster's edge stay on it
+	int bHorizontal = r0 == r1;
+	if(bHorizontal && (r0 == 0 || r0 == nRows)) return;
+	if(!bHorizontal && (c0 == 0 || c0 == nCols)) return;
+	double dfWander = (hashUnit(nSeed + (bHorizontal ? 22 : 23), c0 * (SYNTH_EDGE_POINTS + 1) + k, r0) - 0.5) * 0.2;
+	if(bHorizontal) *pdfY += dfWander * dfCellY;
+	else *pdfX += dfWander * dfCellX;
+}
+
+/************************************************************************/
+/*                           writeFeatures()                            */
+/*                                                                      */
+/*      A lattice of nCols by nRows cells over the raster, the first    */
+/*      nFeatures of them as polygons. The states are bands of rows.    */
+/*      With nDupEvery, every nDupEvery'th polygon is a second part of  */
+/*      the county before it.                                           */
+/************************************************************************/
+
+static int writeFeatures(const std::string &osDir, int nXSize, int nYSize, int nFeatures, GUInt32 nSeed,
+                         int nDupEvery, OGRSpatialReference *poSRS, int verbose)
+{
+	OGRSFDriverH hDriver = OGRGetDriverByName("ESRI Shapefile");
+	if(hDriver == NULL){
+		fprintf(stderr,"No ESRI Shapefile driver\n");
+		return 1;
+	}
+	std::string osName = CPLFormFilename(osDir.c_str(), "features.shp", NULL);
+	VSIUnlink(osName.c_str());
+	OGRDataSourceH hDS = OGR_Dr_CreateDataSource(hDriver, osName.c_str(), NULL);
+	if(hDS == NULL){
+		fprintf(stderr,"Failed to create %s\n",osName.c_str());
+		return 1;
+	}
+	OGRLayer *poLayer = (OGRLayer *)OGR_DS_CreateLayer(hDS, "features", (OGRSpatialReferenceH)poSRS, wkbPolygon, NULL);
+	if(poLayer == NULL){
+		fprintf(stderr,"Failed to create the layer in %s\n",osName.c_str());
+		return 1;
+	}
+
+	int nCols = (int)ceil(sqrt((double)nFeatures * nXSize / nYSize));
+	if(nCols < 1) nCols = 1;
+	int nRows = (nFeatures + nCols - 1) / nCols;
+	double dfCellX = (double)nXSize / nCols, dfCellY = (double)nYSize / nRows;
+	int nStates = nRows < 4 ? nRows : 4;
+	int nPerState = ((nRows + nStates - 1) / nStates) * nCols;
+	int nCountyDigits = 3;
+	while(nPerState >= (int)pow(10.0, nCountyDigits)) nCountyDigits++;
+
+	OGRFieldDefn oFIPS("FIPS", OFTString);
+	oFIPS.SetWidth(2 + nCountyDigits);
+	OGRFieldDefn oName("NAME", OFTString);
+	oName.SetWidth(32);
+	if(poLayer->CreateField(&oFIPS) != OGRERR_NONE || poLayer->CreateField(&oName) != OGRERR_NONE){
+		fprintf(stderr,"Failed to add the fields to %s\n",osName.c_str());
+		return 1;
+	}
+
+	std::string osFIPS;
+	int nPart = 0;
+	for(int f = 0; f < nFeatures; f++){
+		int c = f % nCols, r = f / nCols;
+		int nState = r * nStates / nRows;
+		int nCounty = f - (nState * nRows + nStates - 1) / nStates * nCols + 1;
+		// clockwise, as shapefiles want: along the top, down the right, back along the bottom, up the left
+		int anSides[4][4] = { { c, r, c + 1, r }, { c + 1, r, c + 1, r + 1 }, { c, r + 1, c + 1, r + 1 }, { c, r, c, r + 1 } };
+		OGRLinearRing oRing;
+		for(int s = 0; s < 4; s++){
+			for(int j = 0; j < SYNTH_EDGE_POINTS; j++){
+				// the bottom and left are walked backwards, but hashed the same way as the neighbour walks them
+				int k = s < 2 ? j : SYNTH_EDGE_POINTS - j;
+				double x, y;
+				edgePoint(nSeed, anSides[s][0], anSides[s][1], anSides[s][2], anSides[s][3], k, nCols, nRows,
+				          dfCellX, dfCellY, &x, &y);
+				oRing.addPoint(SYNTH_ORIGIN_X + x * SYNTH_PIXEL, SYNTH_ORIGIN_Y - y * SYNTH_PIXEL);
+			}
+		}
+		oRing.closeRings();
+		OGRPolygon oPolygon;
+		oPolygon.addRing(&oRing);
+
+		OGRFeature *poFeature = OGRFeature::CreateFeature(poLayer->GetLayerDefn());
+		if(nDupEvery > 0 && f % nDupEvery == nDupEvery - 1){
+			nPart++;
+		}else{
+			osFIPS = CPLSPrintf("%02d%0*d", 10 + nState, nCountyDigits, nCounty);
+			nPart = 1;
+		}
+		poFeature->SetField("FIPS", osFIPS.c_str());
+		if(nDupEvery > 0){
+			poFeature->SetField("NAME", CPLSPrintf("%s part %d", osFIPS.c_str(), nPart));
+		}else{
+			poFeature->SetField("NAME", CPLSPrintf("Synthetic %d", f + 1));
+		}
+		poFeature->SetGeometry(&oPolygon);
+		if(poLayer->CreateFeature(poFeature) != OGRERR_NONE){
+			fprintf(stderr,"Failed to write feature %d to %s\n",f,osName.c_str());
+			return 1;
+		}
+		OGRFeature::DestroyFeature(poFeature);
+	}
+	OGR_DS_Destroy(hDS);
+	verbose && fprintf(stderr,"%d features in %d rows of %d, %d states\n",nFeatures,nRows,nCols,nStates);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	int verbose = 0;
+	int nXSize = 4096, nYSize = 4096;
+	int nFeatures = 1000;
+	int nDupEvery = 0;
+	GUInt32 nSeed = 1;
+	std::string osDir = ".";
+	char **papszOptions = NULL;
+
+	GDALAllRegister();
+	OGRRegisterAll();
+
+	while((c = getopt_long_only(argc,argv,"x:y:n:s:u:d:vh",aoLongOptions,NULL)) != -1){
+		switch(c){
+			case 'x':
+				nXSize = atoi(optarg);
+				break;
+			case 'y':
+				nYSize = atoi(optarg);
+				break;
+			case 'n':
+				nFeatures = atoi(optarg);
+				break;
+			case 's':
+				nSeed = (GUInt32)strtoul(optarg, NULL, 10);
+				break;
+			case 'u':
+				nDupEvery = atoi(optarg);
+				break;
+			case 'd':
+				osDir = optarg;
+				break;
+			case 'C':
+				papszOptions = CSLAddString(papszOptions, optarg);
+				break;
+			case 'v':
+				verbose++;
+				break;
+			case 'h':
+				usage(argv[0]);
+				return 0;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if(nXSize < 1 || nYSize < 1 || nFeatures < 1 || nDupEvery == 1 || nDupEvery < 0){
+		usage(argv[0]);
+		return 1;
+	}
+	VSIStatBufL sStat;
+	if(VSIStatL(osDir.c_str(), &sStat) != 0 && VSIMkdir(osDir.c_str(), 0755) != 0){
+		fprintf(stderr,"Failed to make directory %s\n",osDir.c_str());
+		return 1;
+	}
+
+	OGRSpatialReference oSRS;
+	char *pszWKT = NULL;
+	if(oSRS.importFromEPSG(5070) == OGRERR_NONE){
+		oSRS.exportToWkt(&pszWKT);
+	}else{
+		fprintf(stderr,"Warning: no EPSG:5070, the files won't have a projection\n");
+	}
+
+	if(writeRasters(osDir, nXSize, nYSize, nSeed, papszOptions, pszWKT, verbose) != 0) GDALExit(1);
+	if(writeFeatures(osDir, nXSize, nYSize, nFeatures, nSeed, nDupEvery, pszWKT != NULL ? &oSRS : NULL, verbose) != 0) GDALExit(1);
+
+	CPLFree(pszWKT);
+	CSLDestroy(papszOptions);
+	GDALExit(0);
+}
+
+/************************************************************************/
+/*                              GDALExit()                              */
+/*  This function exits and cleans up GDAL and OGR resources            */
+/*  Perhaps it will be used when the program is done, or it may be      */
+/*  used when there is an error.                                        */
+/************************************************************************/
+
+static int GDALExit( int nCode )
+{
+  const char  *pszDebug = CPLGetConfigOption("CPL_DEBUG",NULL);
+  if( pszDebug && (EQUAL(pszDebug,"ON") || EQUAL(pszDebug,"") ) )
+  {
+    GDALDumpOpenDatasets( stderr );
+    CPLDumpSharedList( NULL );
+  }
+
+  GDALDestroyDriverManager();
+
+#ifdef OGR_ENABLED
+  OGRCleanupAll();
+#endif
+
+  exit( nCode );
+}
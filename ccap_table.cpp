@@ -0,0 +1,315 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "ccap_table.h"
+#include "ccap_varint.h"
+
+/* written out whenever this much is buffered */
+#define CCAP_TABLE_BUFFER_BYTES (1024*1024)
+
+static const char szMagic[8] = { 'C', 'C', 'A', 'P', 'T', 'B', 'L', '2' };
+
+/* tables from before counts had a scale */
+static const char szMagicV1[8] = { 'C', 'C', 'A', 'P', 'T', 'B', 'L', '1' };
+
+/************************************************************************/
+/*                      CCAPTableFormatFromName()                       */
+/************************************************************************/
+
+int CCAPTableFormatFromName(const char *pszName)
+{
+	if(strcasecmp(pszName, "csv") == 0) return CCAP_TABLE_CSV;
+	if(strcasecmp(pszName, "binary") == 0 || strcasecmp(pszName, "bin") == 0) return CCAP_TABLE_BINARY;
+	return -1;
+}
+
+/************************************************************************/
+/*                             appendUInt()                             */
+/*                                                                      */
+/*      The counts are the bulk of a CSV table, and formatting them     */
+/*      by hand is several times quicker than a printf for each.        */
+/************************************************************************/
+
+static void appendUInt(std::vector<char> &ach, unsigned long long n)
+{
+	char achDigits[20];
+	int nDigits = 0;
+	do {
+		achDigits[nDigits++] = (char)('0' + n % 10);
+		n /= 10;
+	} while(n > 0);
+	while(nDigits > 0) ach.push_back(achDigits[--nDigits]);
+}
+
+/************************************************************************/
+/*                          CCAPTableWriter()                           */
+/************************************************************************/
+
+CCAPTableWriter::CCAPTableWriter(FILE *fpIn, int nFormatIn, int nYear1In, int nYear2In, int nClassesIn,
+                                 unsigned int nScaleIn)
+	: fp(fpIn), nFormat(nFormatIn), nYear1(nYear1In), nYear2(nYear2In), nClasses(nClassesIn),
+	  nScale(nScaleIn), nDecimals(0), bError(false), nRows(0), nGroupFeatures(0)
+{
+	for(unsigned int n = nScale; n >= 10; n /= 10) nDecimals++;
+
+	achBuf.reserve(CCAP_TABLE_BUFFER_BYTES + 64*1024);
+	if(nFormat == CCAP_TABLE_CSV){
+		static const char szHeader[] = "Year1, Year2, FeatureID, ClassID, Pixels\n";
+		achBuf.insert(achBuf.end(), szHeader, szHeader + strlen(szHeader));
+		char szPrefix[64];
+		snprintf(szPrefix, sizeof(szPrefix), "%d, %d, ", nYear1, nYear2);
+		osLinePrefix = szPrefix;
+	}else{
+		std::vector<unsigned char> abyHeader(szMagic, szMagic + sizeof(szMagic));
+		CCAPPutVarint(abyHeader, CCAPZigzag(nYear1));
+		CCAPPutVarint(abyHeader, CCAPZigzag(nYear2));
+		CCAPPutVarint(abyHeader, nClasses);
+		CCAPPutVarint(abyHeader, nScale);
+		achBuf.insert(achBuf.end(), abyHeader.begin(), abyHeader.end());
+	}
+}
+
+/************************************************************************/
+/*                               write()                                */
+/************************************************************************/
+
+void CCAPTableWriter::write(const char *pszFeature, const unsigned long long *panCounts)
+{
+	size_t nIDLength = strlen(pszFeature);
+
+	if(nFormat == CCAP_TABLE_CSV){
+		for(int i = 0; i < nClasses; i++){
+			if(panCounts[i] == 0) continue;
+			achBuf.insert(achBuf.end(), osLinePrefix.begin(), osLinePrefix.end());
+			achBuf.insert(achBuf.end(), pszFeature, pszFeature + nIDLength);
+			achBuf.push_back(',');
+			achBuf.push_back(' ');
+			appendUInt(achBuf, i);
+			achBuf.push_back(',');
+			achBuf.push_back(' ');
+			if(nDecimals == 0){
+				appendUInt(achBuf, panCounts[i]);
+			}else{
+				appendUInt(achBuf, panCounts[i] / nScale);
+				achBuf.push_back('.');
+				size_t nAt = achBuf.size();
+				appendUInt(achBuf, panCounts[i] % nScale);
+				achBuf.insert(achBuf.begin() + nAt, nDecimals - (achBuf.size() - nAt), '0');
+			}
+			achBuf.push_back('\n');
+			nRows++;
+		}
+		if(achBuf.size() >= CCAP_TABLE_BUFFER_BYTES) flush();
+		return;
+	}
+
+	CCAPPutVarint(abyIDs, nIDLength);
+	abyIDs.insert(abyIDs.end(), pszFeature, pszFeature + nIDLength);
+
+	int nCells = 0, nLast = -1;
+	for(int i = 0; i < nClasses; i++){
+		if(panCounts[i] == 0) continue;
+		CCAPPutVarint(abyClasses, i - nLast - 1);
+		CCAPPutVarint(abyCounts, panCounts[i]);
+		nLast = i;
+		nCells++;
+	}
+	CCAPPutVarint(abyCells, nCells);
+	nRows += nCells;
+
+	if(++nGroupFeatures >= CCAP_TABLE_GROUP_FEATURES
+	   || abyIDs.size() + abyClasses.size() + abyCounts.size() >= CCAP_TABLE_BUFFER_BYTES){
+		flushGroup();
+	}
+}
+
+/************************************************************************/
+/*                            flushGroup()                              */
+/************************************************************************/
+
+void CCAPTableWriter::flushGroup()
+{
+	if(nGroupFeatures == 0) return;
+
+	std::vector<unsigned char> abyHeader;
+	CCAPPutVarint(abyHeader, nGroupFeatures);
+	CCAPPutVarint(abyHeader, abyIDs.size());
+	CCAPPutVarint(abyHeader, abyCells.size());
+	CCAPPutVarint(abyHeader, abyClasses.size());
+	CCAPPutVarint(abyHeader, abyCounts.size());
+	achBuf.insert(achBuf.end(), abyHeader.begin(), abyHeader.end());
+	achBuf.insert(achBuf.end(), abyIDs.begin(), abyIDs.end());
+	achBuf.insert(achBuf.end(), abyCells.begin(), abyCells.end());
+	achBuf.insert(achBuf.end(), abyClasses.begin(), abyClasses.end());
+	achBuf.insert(achBuf.end(), abyCounts.begin(), abyCounts.end());
+
+	abyIDs.clear();
+	abyCells.clear();
+	abyClasses.clear();
+	abyCounts.clear();
+	nGroupFeatures = 0;
+	flush();
+}
+
+/************************************************************************/
+/*                               flush()                                */
+/************************************************************************/
+
+void CCAPTableWriter::flush()
+{
+	if(!achBuf.empty() && fwrite(&achBuf[0], 1, achBuf.size(), fp) != achBuf.size()) bError = true;
+	achBuf.clear();
+}
+
+/************************************************************************/
+/*                               close()                                */
+/************************************************************************/
+
+int CCAPTableWriter::close()
+{
+	if(nFormat == CCAP_TABLE_BINARY){
+		flushGroup();
+		achBuf.push_back(0);
+	}
+	flush();
+	if(fflush(fp) != 0) bError = true;
+	return !bError;
+}
+
+/************************************************************************/
+/*                            readVarint()                              */
+/************************************************************************/
+
+static int readVarint(FILE *fp, GUIntBig *pn)
+{
+	GUIntBig n = 0;
+	int c;
+	for(int nShift = 0; nShift < 64 && (c = fgetc(fp)) != EOF; nShift += 7){
+		n |= (GUIntBig)(c & 0x7f) << nShift;
+		if(!(c & 0x80)){
+			*pn = n;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/************************************************************************/
+/*                         CCAPTableReader::open()                      */
+/************************************************************************/
+
+int CCAPTableReader::open(FILE *fpIn)
+{
+	char achMagic[sizeof(szMagic)];
+	GUIntBig nY1, nY2, nC, nS = 1;
+
+	fp = fpIn;
+	nLeft = 0;
+	bError = false;
+	nFileSize = -1;
+	off_t nStart = ftello(fp);
+	if(nStart >= 0 && fseeko(fp, 0, SEEK_END) == 0){
+		nFileSize = (GIntBig)ftello(fp);
+		if(fseeko(fp, nStart, SEEK_SET) != 0) return FALSE;
+	}
+	if(fread(achMagic, 1, sizeof(achMagic), fp) != sizeof(achMagic)) return FALSE;
+	int bV1 = memcmp(achMagic, szMagicV1, sizeof(szMagicV1)) == 0;
+	if((!bV1 && memcmp(achMagic, szMagic, sizeof(szMagic)) != 0)
+	   || !readVarint(fp, &nY1) || !readVarint(fp, &nY2) || !readVarint(fp, &nC) || nC == 0
+	   || (!bV1 && (!readVarint(fp, &nS) || nS == 0 || nS > 0xffffffffU))){
+		return FALSE;
+	}
+	nYear1 = (int)CCAPUnzigzag(nY1);
+	nYear2 = (int)CCAPUnzigzag(nY2);
+	nClasses = (int)nC;
+	nScale = (unsigned int)nS;
+	return TRUE;
+}
+
+/************************************************************************/
+/*                       CCAPTableReader::readGroup()                   */
+/*                                                                      */
+/*      Returns FALSE at the 0 that ends the table, setting bError if   */
+/*      the file stops before it. The byte counts aren't trusted: a     */
+/*      group can't be bigger than what is left of the file, and one    */
+/*      from a pipe is read a buffer at a time, so a damaged table      */
+/*      never gets more memory than it has bytes.                       */
+/************************************************************************/
+
+int CCAPTableReader::readGroup()
+{
+	GUIntBig nFeatures, anBytes[4];
+
+	if(!readVarint(fp, &nFeatures)){
+		bError = true;
+		return FALSE;
+	}
+	if(nFeatures == 0) return FALSE;
+
+	GUIntBig nRemaining = ~(GUIntBig)0;
+	if(nFileSize >= 0){
+		GIntBig nPos = (GIntBig)ftello(fp);
+		nRemaining = nPos >= 0 && nPos <= nFileSize ? (GUIntBig)(nFileSize - nPos) : 0;
+	}
+	GUIntBig nTotal = 0;
+	for(int i = 0; i < 4; i++){
+		if(!readVarint(fp, &anBytes[i]) || anBytes[i] > nRemaining - nTotal){
+			bError = true;
+			return FALSE;
+		}
+		nTotal += anBytes[i];
+	}
+
+	abyGroup.resize(1); // never empty, so &abyGroup[0] is fine
+	for(GUIntBig nRead = 0; nRead < nTotal; ){
+		size_t nChunk = nTotal - nRead < CCAP_TABLE_BUFFER_BYTES ? (size_t)(nTotal - nRead) : CCAP_TABLE_BUFFER_BYTES;
+		abyGroup.resize(nRead + nChunk + 1);
+		if(fread(&abyGroup[nRead], 1, nChunk, fp) != nChunk){
+			bError = true;
+			return FALSE;
+		}
+		nRead += nChunk;
+	}
+	pabyIDs = &abyGroup[0];
+	pabyIDsEnd = pabyCells = pabyIDs + anBytes[0];
+	pabyCellsEnd = pabyClasses = pabyCells + anBytes[1];
+	pabyClassesEnd = pabyCounts = pabyClasses + anBytes[2];
+	pabyEnd = pabyCounts + anBytes[3];
+	nLeft = nFeatures;
+	return TRUE;
+}
+
+/************************************************************************/
+/*                         CCAPTableReader::next()                      */
+/************************************************************************/
+
+int CCAPTableReader::next(std::string &osFeature, std::vector<unsigned long long> &anCounts)
+{
+	if(bError) return FALSE;
+	if(nLeft == 0 && !readGroup()) return FALSE;
+
+	GUIntBig nLength, nCells;
+	if(!CCAPGetVarint(&pabyIDs, pabyIDsEnd, &nLength) || nLength > (GUIntBig)(pabyIDsEnd - pabyIDs)
+	   || !CCAPGetVarint(&pabyCells, pabyCellsEnd, &nCells)){
+		bError = true;
+		return FALSE;
+	}
+	osFeature.assign((const char *)pabyIDs, nLength);
+	pabyIDs += nLength;
+
+	anCounts.assign(nClasses, 0);
+	GIntBig nClass = -1;
+	for(GUIntBig i = 0; i < nCells; i++){
+		GUIntBig nDelta, nCount;
+		// the delta is checked before it is added, so a huge one can't wrap nClass back into range
+		if(!CCAPGetVarint(&pabyClasses, pabyClassesEnd, &nDelta) || !CCAPGetVarint(&pabyCounts, pabyEnd, &nCount)
+		   || nDelta >= (GUIntBig)(nClasses - 1 - nClass)){
+			bError = true;
+			return FALSE;
+		}
+		nClass += (GIntBig)nDelta + 1;
+		anCounts[nClass] = nCount;
+	}
+	nLeft--;
+	return TRUE;
+}
@@ -0,0 +1,113 @@
+#ifndef CCAP_TABLE_H
+#define CCAP_TABLE_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "cpl_port.h"
+
+/* table formats for ccap2tbl -F */
+#define CCAP_TABLE_CSV    0
+#define CCAP_TABLE_BINARY 1
+
+int CCAPTableFormatFromName(const char *pszName);
+
+/*
+* The binary table format. Everything after the magic is varints
+* (see ccap_varint.h); years are zigzag coded.
+*
+*   "CCAPTBL2" year1 year2 nClasses nScale
+*   groups of up to CCAP_TABLE_GROUP_FEATURES features, each:
+*     nFeatures  bytes of IDs  bytes of cells  bytes of classes  bytes of counts
+*     IDs:     per feature, the length of its ID and the ID's bytes
+*     cells:   per feature, how many classes it has pixels in
+*     classes: per cell, the class less one more than the cell before it
+*              in the same feature (so the first is the class itself)
+*     counts:  per cell, the pixel count times nScale
+*   0, where the next group's nFeatures would be
+*
+* Each feature ID is stored once for all its rows rather than on every
+* line, and the columns can be skipped by their byte counts, so a reader
+* after one column needn't decode the others. A file without the final
+* 0 was cut short. "CCAPTBL1" files are the same without nScale, which
+* is 1.
+*/
+
+/* features held before a group is written out */
+#define CCAP_TABLE_GROUP_FEATURES 4096
+
+/*
+* Writes the table a feature at a time, in either format, through its
+* own buffer so the output is a few large writes rather than a fprintf
+* per line. The CSV is what ccap2tbl has always printed. Counts are in
+* 1/nScale pixels, nScale a power of ten, and are printed with that many
+* decimals. close() must be called to flush; it doesn't close fp.
+*/
+class CCAPTableWriter
+{
+public:
+	CCAPTableWriter(FILE *fp, int nFormat, int nYear1, int nYear2, int nClasses, unsigned int nScale = 1);
+
+	// panCounts has a count for each of the nClasses classes
+	void write(const char *pszFeature, const unsigned long long *panCounts);
+
+	// FALSE if any write failed
+	int close();
+
+	GUIntBig rows() const { return nRows; }
+
+private:
+	void flush();
+	void flushGroup();
+
+	FILE *fp;
+	int nFormat;
+	int nYear1, nYear2;
+	int nClasses;
+	unsigned int nScale;
+	int nDecimals;
+	bool bError;
+	GUIntBig nRows;
+	std::vector<char> achBuf;                // CSV, or the binary header and groups ready to go
+	std::string osLinePrefix;                // "year1, year2, " for CSV
+	int nGroupFeatures;
+	std::vector<unsigned char> abyIDs, abyCells, abyClasses, abyCounts;
+};
+
+/*
+* Reads a binary table back a feature at a time.
+*/
+class CCAPTableReader
+{
+public:
+	CCAPTableReader() : fp(NULL), nFileSize(-1), nYear1(0), nYear2(0), nClasses(0), nScale(1), nLeft(0),
+	                    bError(false) {}
+
+	// FALSE if fp isn't a binary table
+	int open(FILE *fp);
+
+	int year1() const { return nYear1; }
+	int year2() const { return nYear2; }
+	int classes() const { return nClasses; }
+	unsigned int scale() const { return nScale; }
+
+	// the next feature and its count in every class; FALSE at the end of the table or on error()
+	int next(std::string &osFeature, std::vector<unsigned long long> &anCounts);
+	bool error() const { return bError; }
+
+private:
+	int readGroup();
+
+	FILE *fp;
+	GIntBig nFileSize; // -1 if fp can't seek, a pipe say
+	int nYear1, nYear2;
+	int nClasses;
+	unsigned int nScale;
+	GUIntBig nLeft;  // features left in the group
+	bool bError;
+	std::vector<unsigned char> abyGroup;
+	const unsigned char *pabyIDs, *pabyCells, *pabyClasses, *pabyCounts, *pabyEnd;
+	const unsigned char *pabyIDsEnd, *pabyCellsEnd, *pabyClassesEnd;
+};
+
+#endif
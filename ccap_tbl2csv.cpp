@@ -0,0 +1,85 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "ccap_table.h"
+
+/*
+* Turns a binary table from ccap2tbl -F binary back into the CSV
+* ccap2tbl would have printed. Doesn't need GDAL.
+*/
+
+void usage(char *name){
+	fprintf(stderr,"%s - convert a binary ccap2tbl table to CSV\n",name);
+	fprintf(stderr,"USAGE: %s [-v] [-t table] binary_table\n",name);
+	fprintf(stderr,"\ttable = output file for the CSV table [stdout]\n");
+	fprintf(stderr,"\tbinary_table = table written by ccap2tbl -F binary\n");
+}
+
+int main(int argc, char **argv)
+{
+	int c;
+	int verbose = 0;
+	const char *pszOut = NULL;
+	FILE *fpIn, *fpOut = stdout;
+
+	while((c = getopt(argc,argv,"t:vh")) != -1){
+		switch(c){
+			case 't':
+				pszOut = optarg;
+				break;
+			case 'v':
+				verbose++;
+				break;
+			case 'h':
+				usage(argv[0]);
+				return 0;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+	if(optind != argc - 1){
+		fprintf(stderr,"Need one binary table to convert\n");
+		usage(argv[0]);
+		return 1;
+	}
+
+	if((fpIn = fopen(argv[optind],"rb")) == NULL){
+		fprintf(stderr,"Failed to open '%s'\n",argv[optind]);
+		return 1;
+	}
+	CCAPTableReader oReader;
+	if(!oReader.open(fpIn)){
+		fprintf(stderr,"%s is not a binary ccap2tbl table\n",argv[optind]);
+		return 1;
+	}
+	if(pszOut != NULL && (fpOut = fopen(pszOut,"w")) == NULL){
+		fprintf(stderr,"Failed to open '%s' for output\n",pszOut);
+		return 1;
+	}
+
+	CCAPTableWriter oWriter(fpOut, CCAP_TABLE_CSV, oReader.year1(), oReader.year2(), oReader.classes(),
+	                        oReader.scale());
+	std::string osFeature;
+	std::vector<unsigned long long> anCounts;
+	GUIntBig nFeatures = 0;
+	while(oReader.next(osFeature, anCounts)){
+		oWriter.write(osFeature.c_str(), &anCounts[0]);
+		nFeatures++;
+	}
+	if(oReader.error()){
+		fprintf(stderr,"%s is damaged or cut short after %llu features\n",argv[optind],nFeatures);
+		return 1;
+	}
+	if(!oWriter.close()){
+		fprintf(stderr,"Error writing the CSV table\n");
+		return 1;
+	}
+	verbose && fprintf(stderr,"%llu features, %llu rows\n",nFeatures,oWriter.rows());
+
+	fclose(fpIn);
+	if(fpOut != stdout) fclose(fpOut);
+	return 0;
+}
@@ -0,0 +1,52 @@
+#ifndef CCAP_VARINT_H
+#define CCAP_VARINT_H
+
+#include <vector>
+#include "cpl_port.h"
+
+/*
+* Little endian base 128 varints, as in protocol buffers, for the span
+* cache and the binary tables. Signed values are zigzag coded first so
+* small negative deltas stay small.
+*/
+
+static inline void CCAPPutVarint(std::vector<unsigned char> &aby, GUIntBig n)
+{
+	while(n >= 0x80){
+		aby.push_back((unsigned char)(n | 0x80));
+		n >>= 7;
+	}
+	aby.push_back((unsigned char)n);
+}
+
+// FALSE if the varint runs past pabyEnd
+static inline int CCAPGetVarint(const unsigned char **ppaby, const unsigned char *pabyEnd, GUIntBig *pn)
+{
+	GUIntBig n = 0;
+	for(int nShift = 0; *ppaby < pabyEnd && nShift < 64; nShift += 7){
+		unsigned char b = *(*ppaby)++;
+		n |= (GUIntBig)(b & 0x7f) << nShift;
+		if(!(b & 0x80)){
+			*pn = n;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static inline GUIntBig CCAPZigzag(GIntBig n) { return ((GUIntBig)n << 1) ^ (GUIntBig)(n >> 63); }
+static inline GIntBig CCAPUnzigzag(GUIntBig n) { return (GIntBig)(n >> 1) ^ -(GIntBig)(n & 1); }
+
+static inline void CCAPPutUInt64(std::vector<unsigned char> &aby, GUIntBig n)
+{
+	for(int i = 0; i < 8; i++) aby.push_back((unsigned char)(n >> (8 * i)));
+}
+
+static inline GUIntBig CCAPGetUInt64(const unsigned char *paby)
+{
+	GUIntBig n = 0;
+	for(int i = 0; i < 8; i++) n |= (GUIntBig)paby[i] << (8 * i);
+	return n;
+}
+
+#endif
@@ -0,0 +1,38 @@
+#include <algorithm>
+#include "ccap_zones.h"
+
+/************************************************************************/
+/*                              addSpans()                              */
+/************************************************************************/
+
+void CCAPZoneIndex::addSpans(int nZone, const std::vector<CCAPSpan> &aoFeatureSpans)
+{
+	for(size_t i = 0; i < aoFeatureSpans.size(); i++){
+		CCAPZoneSpan oSpan;
+		oSpan.nLine = aoFeatureSpans[i].nLine;
+		oSpan.nXStart = aoFeatureSpans[i].nXStart;
+		oSpan.nXEnd = aoFeatureSpans[i].nXEnd;
+		oSpan.nZone = nZone;
+		oSpan.nCover = aoFeatureSpans[i].nCover;
+		aoSpans.push_back(oSpan);
+	}
+}
+
+/************************************************************************/
+/*                               finish()                               */
+/*                                                                      */
+/*      Order spans by line, then left to right, so the raster can be   */
+/*      streamed top to bottom. Ties keep zone order.                   */
+/************************************************************************/
+
+static bool zoneSpanLess(const CCAPZoneSpan &a, const CCAPZoneSpan &b)
+{
+	if(a.nLine != b.nLine) return a.nLine < b.nLine;
+	if(a.nXStart != b.nXStart) return a.nXStart < b.nXStart;
+	return a.nZone < b.nZone;
+}
+
+void CCAPZoneIndex::finish()
+{
+	std::sort(aoSpans.begin(), aoSpans.end(), zoneSpanLess);
+}
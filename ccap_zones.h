@@ -0,0 +1,45 @@
+#ifndef CCAP_ZONES_H
+#define CCAP_ZONES_H
+
+#include <vector>
+#include "ccap_rasterize.h"
+
+/*
+* One run of pixels on one line belonging to a zone (a feature number),
+* nCover of each as in CCAPSpan.
+*/
+typedef struct {
+	int nLine;
+	int nXStart;
+	int nXEnd;
+	int nZone;
+	unsigned int nCover;
+} CCAPZoneSpan;
+
+/************************************************************************/
+/*                            CCAPZoneIndex                             */
+/*                                                                      */
+/*      Run length encoded zone raster. Every feature is burned in as   */
+/*      the spans from CCAPRasterizer tagged with its zone number.      */
+/*      Unlike a dense zone-ID raster, pixels covered by more than one  */
+/*      feature keep all of their zones, so overlapping features are    */
+/*      counted the same as when they are tabulated one at a time.      */
+/************************************************************************/
+
+class CCAPZoneIndex
+{
+public:
+	void clear() { aoSpans.clear(); }
+	void addSpans(int nZone, const std::vector<CCAPSpan> &aoFeatureSpans);
+
+	// sort into line order. Must be called after the last addSpans()
+	void finish();
+
+	size_t size() const { return aoSpans.size(); }
+	const CCAPZoneSpan &operator[](size_t i) const { return aoSpans[i]; }
+
+private:
+	std::vector<CCAPZoneSpan> aoSpans;
+};
+
+#endif